@@ -0,0 +1,282 @@
+/*******************************************************************************
+BinaryMatrix.h
+
+Packed binary files of pairwise distance matrices
+
+Copyright 2012-2014 Chris Whidden
+cwhidden@dal.ca
+http://kiwi.cs.dal.ca/Software/RSPR
+March 3, 2014
+Version 1.2.1
+
+This file is part of rspr.
+
+rspr is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+rspr is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with rspr.  If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INCLUDE_BINARYMATRIX
+
+#define INCLUDE_BINARYMATRIX
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/* File layout, in native byte order:
+ *
+ * BinaryMatrixHeader
+ * the cells of rows row_start to row_end - 1, in order, each cell_bytes
+ *   wide (an unsigned 8 or 16 bit integer). Row i holds columns
+ *   row_begin(i) to col_end - 1, so a symmetric matrix stores only its
+ *   upper right triangle
+ *
+ * Cells that were not computed hold missing, and cells larger than the
+ * -pairwise_max value hold over_max(), one less than missing
+ */
+#define BINARY_MATRIX_MAGIC "rsprmat"
+#define BINARY_MATRIX_VERSION 1
+
+class BinaryMatrixHeader {
+	public:
+	char magic[8];
+	int version;
+	int cell_bytes;
+	int missing;
+	int symmetric;
+	int row_start;
+	int row_end;
+	int col_start;
+	int col_end;
+
+	BinaryMatrixHeader() {
+		memset(this, 0, sizeof(BinaryMatrixHeader));
+		memcpy(magic, BINARY_MATRIX_MAGIC, sizeof(magic));
+		version = BINARY_MATRIX_VERSION;
+	}
+
+	// the narrowest cells that hold distances up to max_distance
+	BinaryMatrixHeader(int max_distance, bool symmetric, int row_start,
+			int row_end, int col_start, int col_end) {
+		memset(this, 0, sizeof(BinaryMatrixHeader));
+		memcpy(magic, BINARY_MATRIX_MAGIC, sizeof(magic));
+		version = BINARY_MATRIX_VERSION;
+		cell_bytes = (max_distance < 254 ? 1 : 2);
+		missing = (cell_bytes == 1 ? 255 : 65535);
+		this->symmetric = symmetric;
+		this->row_start = row_start;
+		this->row_end = row_end;
+		this->col_start = col_start;
+		this->col_end = col_end;
+	}
+
+	// the value of cells larger than the -pairwise_max value
+	inline int over_max() const {
+		return missing - 1;
+	}
+
+	// first stored column of row i
+	inline int row_begin(int i) const {
+		return (symmetric && i > col_start ? i : col_start);
+	}
+
+	inline long long row_size(int i) const {
+		return max(0, col_end - row_begin(i));
+	}
+};
+
+/* BinaryMatrixWriter
+ * Write the rows of a binary matrix file in order
+ */
+class BinaryMatrixWriter {
+	private:
+	FILE *out;
+	vector<unsigned char> buffer;
+
+	BinaryMatrixWriter(const BinaryMatrixWriter &w);
+	BinaryMatrixWriter &operator=(const BinaryMatrixWriter &w);
+
+	public:
+	BinaryMatrixHeader header;
+	bool ok;
+
+	BinaryMatrixWriter() {
+		out = NULL;
+		ok = false;
+	}
+
+	~BinaryMatrixWriter() {
+		close();
+	}
+
+	bool open(const string &file, const BinaryMatrixHeader &header) {
+		this->header = header;
+		out = fopen(file.c_str(), "wb");
+		ok = out != NULL && fwrite(&header, sizeof(header), 1, out) == 1;
+		return ok;
+	}
+
+	/* write_row
+	 * Write row i from the distances of its stored columns, -1 if larger
+	 * than the -pairwise_max value and -2 if missing
+	 */
+	void write_row(int i, const int *distances) {
+		int size = header.row_size(i);
+		if (size == 0)
+			return;
+		buffer.resize(size * header.cell_bytes);
+		for(int j = 0; j < size; j++) {
+			int d = distances[j];
+			if (d == -1)
+				d = header.over_max();
+			else if (d < 0 || d >= header.over_max())
+				d = header.missing;
+			if (header.cell_bytes == 1) {
+				buffer[j] = d;
+			}
+			else {
+				unsigned short cell = d;
+				memcpy(&buffer[2 * j], &cell, 2);
+			}
+		}
+		ok = ok && fwrite(&buffer[0], 1, buffer.size(), out) == buffer.size();
+	}
+
+	// returns false if any write failed
+	bool close() {
+		if (out != NULL) {
+			ok = fclose(out) == 0 && ok;
+			out = NULL;
+		}
+		return ok;
+	}
+};
+
+/* BinaryMatrix
+ * A memory mapped binary matrix file
+ */
+class BinaryMatrix {
+	private:
+	char *map_start;
+	size_t map_size;
+	const unsigned char *cells;
+	vector<long long> row_offsets;	// first cell of each row
+
+	BinaryMatrix(const BinaryMatrix &b);
+	BinaryMatrix &operator=(const BinaryMatrix &b);
+
+	public:
+	BinaryMatrixHeader header;
+
+	BinaryMatrix() {
+		map_start = NULL;
+		map_size = 0;
+		cells = NULL;
+	}
+
+	~BinaryMatrix() {
+		if (map_start != NULL)
+			munmap(map_start, map_size);
+	}
+
+	/* load
+	 * Map file. Returns false and sets error if the file can not be used
+	 */
+	bool load(const string &file, string *error) {
+		int fd = open(file.c_str(), O_RDONLY);
+		if (fd < 0) {
+			*error = "could not open " + file;
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size < sizeof(BinaryMatrixHeader)) {
+			close(fd);
+			*error = file + " is not an rspr binary matrix file";
+			return false;
+		}
+		map_size = st.st_size;
+		void *m = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED) {
+			*error = "could not map " + file;
+			return false;
+		}
+		map_start = (char *)m;
+		memcpy(&header, map_start, sizeof(BinaryMatrixHeader));
+		if (memcmp(header.magic, BINARY_MATRIX_MAGIC, sizeof(header.magic))
+				!= 0) {
+			*error = file + " is not an rspr binary matrix file";
+			return false;
+		}
+		if (header.version != BINARY_MATRIX_VERSION
+				|| (header.cell_bytes != 1 && header.cell_bytes != 2)) {
+			*error = file + " has an unsupported version or byte order";
+			return false;
+		}
+		cells = (const unsigned char *)map_start + sizeof(BinaryMatrixHeader);
+		long long offset = 0;
+		for(int i = header.row_start; i < header.row_end; i++) {
+			row_offsets.push_back(offset);
+			offset += header.row_size(i);
+		}
+		if (offset * header.cell_bytes
+				> map_size - sizeof(BinaryMatrixHeader)) {
+			*error = file + " is truncated";
+			return false;
+		}
+		return true;
+	}
+
+	// whether cell (i,j) is stored
+	inline bool stored(int i, int j) {
+		return i >= header.row_start && i < header.row_end
+				&& j >= header.row_begin(i) && j < header.col_end;
+	}
+
+	/* distance
+	 * The distance of trees i and j, -1 if it is larger than the
+	 * -pairwise_max value or -2 if it is missing. A symmetric matrix gives
+	 * the mirrored cell left of the diagonal
+	 */
+	int distance(int i, int j) {
+		if (!stored(i, j)) {
+			if (header.symmetric && stored(j, i))
+				return distance(j, i);
+			return -2;
+		}
+		long long c = row_offsets[i - header.row_start] + j - header.row_begin(i);
+		int d;
+		if (header.cell_bytes == 1) {
+			d = cells[c];
+		}
+		else {
+			unsigned short cell;
+			memcpy(&cell, &cells[2 * c], 2);
+			d = cell;
+		}
+		if (d == header.missing)
+			return -2;
+		if (d == header.over_max())
+			return -1;
+		return d;
+	}
+};
+
+#endif
@@ -0,0 +1,231 @@
+/*******************************************************************************
+BinaryTrees.h
+
+Preprocessed binary files of tree collections
+
+Copyright 2012-2014 Chris Whidden
+cwhidden@dal.ca
+http://kiwi.cs.dal.ca/Software/RSPR
+March 3, 2014
+Version 1.2.1
+
+This file is part of rspr.
+
+rspr is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+rspr is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with rspr.  If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INCLUDE_BINARYTREES
+
+#define INCLUDE_BINARYTREES
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "CompactTree.h"
+
+using namespace std;
+
+/* File layout, in native byte order with every record 4 byte aligned:
+ *
+ * BinaryTreesHeader
+ * num_labels label records:
+ *   int number, int length, length chars padded to a multiple of 4
+ * num_trees tree records:
+ *   int name length, the name chars padded to a multiple of 4,
+ *   int num_nodes, int num_leaves,
+ *   the CompactTree arrays (CompactTree::data_size(num_nodes) ints)
+ *
+ * The CompactTree arrays are indexed by preorder number and hold the
+ * parent, first child, next sibling, subtree end and label of each node,
+ * so the preorder numbers and edge preorder intervals are stored as well.
+ * A loaded tree views the mapped file directly.
+ */
+#define BINARY_TREES_MAGIC "rsprbin"
+#define BINARY_TREES_VERSION 1
+
+// parse settings the trees were read with
+#define BINARY_TREES_ROOTED 1	// unrooted input was rooted with root()
+#define BINARY_TREES_IGNORE_MULTI 2
+
+class BinaryTreesHeader {
+	public:
+	char magic[8];
+	int version;
+	int flags;
+	double required_support;
+	double min_length;
+	int num_labels;
+	int num_trees;
+
+	BinaryTreesHeader() {
+		memset(this, 0, sizeof(BinaryTreesHeader));
+		memcpy(magic, BINARY_TREES_MAGIC, sizeof(magic));
+		version = BINARY_TREES_VERSION;
+	}
+};
+
+/* write_binary_trees
+ * Write trees with numbered labels, their names and the label map to file.
+ * Returns false if the file could not be written
+ */
+bool write_binary_trees(const string &file, BinaryTreesHeader header,
+		vector<CompactTree> &trees, vector<string> &names,
+		map<int, string> *reverse_label_map) {
+	FILE *out = fopen(file.c_str(), "wb");
+	if (out == NULL)
+		return false;
+	static const char padding[4] = {0, 0, 0, 0};
+	header.num_labels = reverse_label_map->size();
+	header.num_trees = trees.size();
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	map<int, string>::iterator l;
+	for(l = reverse_label_map->begin(); l != reverse_label_map->end(); l++) {
+		int record[2] = {l->first, (int)l->second.size()};
+		ok = ok && fwrite(record, sizeof(int), 2, out) == 2;
+		ok = ok && fwrite(l->second.data(), 1, record[1], out) == record[1];
+		ok = ok && fwrite(padding, 1, (4 - record[1] % 4) % 4, out)
+				== (4 - record[1] % 4) % 4;
+	}
+	for(int i = 0; i < trees.size(); i++) {
+		int name_length = names[i].size();
+		ok = ok && fwrite(&name_length, sizeof(int), 1, out) == 1;
+		ok = ok && fwrite(names[i].data(), 1, name_length, out) == name_length;
+		ok = ok && fwrite(padding, 1, (4 - name_length % 4) % 4, out)
+				== (4 - name_length % 4) % 4;
+		int record[2] = {trees[i].size(), trees[i].num_leaves()};
+		ok = ok && fwrite(record, sizeof(int), 2, out) == 2;
+		int size = CompactTree::data_size(trees[i].size());
+		ok = ok && fwrite(trees[i].get_data(), sizeof(int), size, out) == size;
+	}
+	return fclose(out) == 0 && ok;
+}
+
+/* BinaryTrees
+ * A memory mapped binary tree file. The trees returned by load() view the
+ * mapping, so this must outlive them
+ */
+class BinaryTrees {
+	private:
+	char *map_start;
+	size_t map_size;
+
+	// not copyable, the mapping belongs to one object
+	BinaryTrees(const BinaryTrees &b);
+	BinaryTrees &operator=(const BinaryTrees &b);
+
+	// advance past count ints, or return NULL if the file is too short
+	const int *take(const char **cursor, size_t count) {
+		const int *p = (const int *)*cursor;
+		if (count > (map_start + map_size - *cursor) / sizeof(int))
+			return NULL;
+		*cursor += count * sizeof(int);
+		return p;
+	}
+
+	// read a length prefixed string, or return false if too short
+	bool take_string(const char **cursor, string *s) {
+		const int *length = take(cursor, 1);
+		if (length == NULL || *length < 0)
+			return false;
+		const char *chars = *cursor;
+		if (take(cursor, (*length + 3) / 4) == NULL)
+			return false;
+		*s = string(chars, *length);
+		return true;
+	}
+
+	public:
+	BinaryTreesHeader header;
+
+	BinaryTrees() {
+		map_start = NULL;
+		map_size = 0;
+	}
+
+	~BinaryTrees() {
+		if (map_start != NULL)
+			munmap(map_start, map_size);
+	}
+
+	/* load
+	 * Map file and append its trees, names and labels. Returns false and
+	 * sets error if the file can not be used
+	 */
+	bool load(const string &file, vector<CompactTree> *trees,
+			vector<string> *names, map<string, int> *label_map,
+			map<int, string> *reverse_label_map, string *error) {
+		int fd = open(file.c_str(), O_RDONLY);
+		if (fd < 0) {
+			*error = "could not open " + file;
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size < sizeof(BinaryTreesHeader)) {
+			close(fd);
+			*error = file + " is not an rspr binary tree file";
+			return false;
+		}
+		map_size = st.st_size;
+		void *m = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED) {
+			*error = "could not map " + file;
+			return false;
+		}
+		map_start = (char *)m;
+		memcpy(&header, map_start, sizeof(BinaryTreesHeader));
+		if (memcmp(header.magic, BINARY_TREES_MAGIC, sizeof(header.magic))
+				!= 0) {
+			*error = file + " is not an rspr binary tree file";
+			return false;
+		}
+		if (header.version != BINARY_TREES_VERSION) {
+			*error = file + " has an unsupported version or byte order";
+			return false;
+		}
+		const char *cursor = map_start + sizeof(BinaryTreesHeader);
+		for(int i = 0; i < header.num_labels; i++) {
+			const int *number = take(&cursor, 1);
+			string label;
+			if (number == NULL || !take_string(&cursor, &label)) {
+				*error = file + " is truncated";
+				return false;
+			}
+			label_map->insert(make_pair(label, *number));
+			reverse_label_map->insert(make_pair(*number, label));
+		}
+		for(int i = 0; i < header.num_trees; i++) {
+			string name;
+			const int *record;
+			const int *data = NULL;
+			if (take_string(&cursor, &name)
+					&& (record = take(&cursor, 2)) != NULL && record[0] >= 0)
+				data = take(&cursor, CompactTree::data_size(record[0]));
+			if (data == NULL) {
+				*error = file + " is truncated";
+				return false;
+			}
+			names->push_back(name);
+			trees->push_back(CompactTree(data, record[0]));
+		}
+		return true;
+	}
+};
+
+#endif
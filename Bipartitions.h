@@ -0,0 +1,268 @@
+/*******************************************************************************
+Bipartitions.h
+
+Hashed cluster sets of trees for fast Robinson-Foulds distances
+
+Copyright 2012-2014 Chris Whidden
+cwhidden@dal.ca
+http://kiwi.cs.dal.ca/Software/RSPR
+March 3, 2014
+Version 1.2.1
+
+This file is part of rspr.
+
+rspr is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+rspr is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with rspr.  If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INCLUDE_BIPARTITIONS
+
+#define INCLUDE_BIPARTITIONS
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include "CompactTree.h"
+
+using namespace std;
+
+/* Split
+ * A cluster of leaves hashed as the xor of a random 128 bit value for
+ * each of its leaves. Equal clusters have equal hashes and the hash of the
+ * complement of a cluster is its xor with the hash of all of the leaves.
+ * Different clusters collide with probability 2^-128
+ */
+class Split {
+	public:
+	unsigned long long hi;
+	unsigned long long lo;
+
+	Split() {
+		hi = 0;
+		lo = 0;
+	}
+
+	Split(unsigned long long hi, unsigned long long lo) {
+		this->hi = hi;
+		this->lo = lo;
+	}
+
+	inline Split operator^(const Split &s) const {
+		return Split(hi ^ s.hi, lo ^ s.lo);
+	}
+	inline Split &operator^=(const Split &s) {
+		hi ^= s.hi;
+		lo ^= s.lo;
+		return *this;
+	}
+	inline bool operator==(const Split &s) const {
+		return hi == s.hi && lo == s.lo;
+	}
+	inline bool operator!=(const Split &s) const {
+		return !(*this == s);
+	}
+	inline bool operator<(const Split &s) const {
+		return hi < s.hi || (hi == s.hi && lo < s.lo);
+	}
+};
+
+// splitmix64, so that every run hashes a label the same way
+inline unsigned long long split_mix(unsigned long long x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+inline Split leaf_split(int label) {
+	unsigned long long x = split_mix(2 * (unsigned long long)label);
+	return Split(x, split_mix(x ^ (2 * (unsigned long long)label + 1)));
+}
+
+/* SplitSet
+ * The clusters of a rooted tree with at least 2 leaves and not all of
+ * them, sorted and without duplicates. A tree with a binary root and no
+ * other nodes with one child can also be kept for rf_distance_unrooted,
+ * with the size of each cluster by preorder number and the sorted hashes
+ * of each nontrivial cluster and complement
+ */
+class SplitSet {
+	public:
+	vector<Split> splits;
+	Split leaves;	// the cluster of all of the leaves
+	int num_leaves;
+	bool unrooted;	// can be rerooted by rf_distance_unrooted
+	vector<int> parents;
+	vector<int> cluster_sizes;
+	// (hash, 2 * preorder number + 1 if it is the complement)
+	vector<pair<Split, int> > sides;
+
+	SplitSet() {
+		num_leaves = 0;
+		unrooted = false;
+	}
+
+	SplitSet(const CompactTree &t, bool keep_sides) {
+		int size = t.size();
+		vector<Split> clusters = vector<Split>(size);
+		cluster_sizes = vector<int>(size, 0);
+		unrooted = size > 0;
+		for(int i = 0; i < size; i++) {
+			if (t.is_leaf(i)) {
+				clusters[i] = leaf_split(t.label(i));
+				cluster_sizes[i] = 1;
+			}
+			else if (t.next_sibling(t.first_child(i)) == -1) {
+				unrooted = false;
+			}
+		}
+		// children follow their parents in preorder
+		for(int i = size - 1; i > 0; i--) {
+			clusters[t.parent(i)] ^= clusters[i];
+			cluster_sizes[t.parent(i)] += cluster_sizes[i];
+		}
+		if (size > 0) {
+			leaves = clusters[0];
+			num_leaves = cluster_sizes[0];
+			if (t.is_leaf(0)
+					|| t.next_sibling(t.next_sibling(t.first_child(0))) != -1)
+				unrooted = false;
+		}
+		else {
+			num_leaves = 0;
+		}
+		for(int i = 1; i < size; i++) {
+			if (nontrivial(cluster_sizes[i]))
+				splits.push_back(clusters[i]);
+		}
+		sort(splits.begin(), splits.end());
+		splits.erase(unique(splits.begin(), splits.end()), splits.end());
+		unrooted = unrooted && keep_sides;
+		if (unrooted) {
+			parents = vector<int>(size);
+			for(int i = 0; i < size; i++)
+				parents[i] = t.parent(i);
+			// the second child of the root is the same edge as the first
+			int c2 = t.next_sibling(1);
+			for(int i = 1; i < size; i++) {
+				if (i == c2)
+					continue;
+				if (nontrivial(cluster_sizes[i]))
+					sides.push_back(make_pair(clusters[i], 2 * i));
+				if (nontrivial(num_leaves - cluster_sizes[i]))
+					sides.push_back(make_pair(clusters[i] ^ leaves, 2 * i + 1));
+			}
+			sort(sides.begin(), sides.end());
+		}
+		else {
+			vector<int>().swap(cluster_sizes);
+		}
+	}
+
+	inline bool same_leaves(const SplitSet &s) const {
+		return num_leaves == s.num_leaves && leaves == s.leaves;
+	}
+
+	inline bool nontrivial(int cluster_size) const {
+		return cluster_size > 1 && cluster_size < num_leaves;
+	}
+};
+
+/* rf_distance
+ * The number of clusters of exactly one of S1 and S2, which must have the
+ * same leaves, by merging their sorted splits
+ */
+int rf_distance(const SplitSet &S1, const SplitSet &S2) {
+	const vector<Split> &a = S1.splits;
+	const vector<Split> &b = S2.splits;
+	int i = 0;
+	int j = 0;
+	int common = 0;
+	while (i < a.size() && j < b.size()) {
+		if (a[i] < b[j])
+			i++;
+		else if (b[j] < a[i])
+			j++;
+		else {
+			common++;
+			i++;
+			j++;
+		}
+	}
+	return a.size() + b.size() - 2 * common;
+}
+
+/* rf_distance_unrooted
+ * The minimum of rf_distance(S1, S2) over the rootings of S2, which must
+ * have the same leaves and S2.unrooted. The two children of the root
+ * of S2 form one edge, represented by the first child. Rooting S2 on
+ * the edge above d replaces the cluster of each proper ancestor of d below
+ * the root by its complement and adds the complement of the cluster of d,
+ * so each rooting is scored from its parent's in constant time
+ */
+int rf_distance_unrooted(const SplitSet &S1, const SplitSet &S2) {
+	int size = S2.parents.size();
+	int c2 = size;	// the second child of the root
+	for(int i = 2; i < size; i++) {
+		if (S2.parents[i] == 0) {
+			c2 = i;
+			break;
+		}
+	}
+	// which clusters and complements of S2 are also in S1
+	vector<char> common = vector<char>(2 * size, 0);
+	const vector<Split> &a = S1.splits;
+	const vector<pair<Split, int> > &b = S2.sides;
+	int i = 0;
+	int j = 0;
+	while (i < a.size() && j < b.size()) {
+		if (a[i] < b[j].first)
+			i++;
+		else if (b[j].first < a[i])
+			j++;
+		else
+			common[b[j++].second] = 1;
+	}
+	// the nontrivial clusters of S2 and those also in S1 when rooted at the
+	// root, and the change in each count when the path to a node is
+	// complemented
+	int base_size = 0;
+	int base_common = 0;
+	vector<int> path_size = vector<int>(size, 0);
+	vector<int> path_common = vector<int>(size, 0);
+	for(int i = 1; i < size; i++) {
+		if (i == c2)
+			continue;
+		int in = S2.nontrivial(S2.cluster_sizes[i]);
+		int out = S2.nontrivial(S2.num_leaves - S2.cluster_sizes[i]);
+		base_size += in;
+		base_common += common[2 * i];
+		int p = S2.parents[i];
+		path_size[i] = path_size[p] + out - in;
+		path_common[i] = path_common[p] + common[2 * i + 1] - common[2 * i];
+	}
+	int best = INT_MAX;
+	for(int d = 1; d < size; d++) {
+		if (d == c2)
+			continue;
+		// the path sums count d as complemented, but d keeps its cluster
+		int d_size = base_size + path_size[d]
+				+ S2.nontrivial(S2.cluster_sizes[d]);
+		int d_common = base_common + path_common[d] + common[2 * d];
+		int k = a.size() + d_size - 2 * d_common;
+		if (k < best)
+			best = k;
+	}
+	return best;
+}
+
+#endif
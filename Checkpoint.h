@@ -0,0 +1,198 @@
+/*******************************************************************************
+Checkpoint.h
+
+Checkpoint files for resuming long pairwise and total distance runs
+
+Copyright 2012-2014 Chris Whidden
+cwhidden@dal.ca
+http://kiwi.cs.dal.ca/Software/RSPR
+March 3, 2014
+Version 1.2.1
+
+This file is part of rspr.
+
+rspr is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+rspr is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with rspr.  If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INCLUDE_CHECKPOINT
+
+#define INCLUDE_CHECKPOINT
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+/* File layout, in native byte order:
+ *
+ * CheckpointHeader
+ * (int row, int column, int distance) records, in order of completion
+ *
+ * Records are only appended, so a run that is killed loses at most the
+ * records since the last flush and a partial record at the end, which is
+ * ignored
+ */
+#define CHECKPOINT_MAGIC "rsprchk"
+#define CHECKPOINT_VERSION 1
+// seconds between flushes of the checkpoint file
+#define CHECKPOINT_INTERVAL 10
+
+/* CheckpointHeader
+ * Identifies the run a checkpoint belongs to. options should hold every
+ * setting that changes the distances and input is a hash of the trees
+ */
+class CheckpointHeader {
+	public:
+	char magic[8];
+	int version;
+	int num_trees;
+	long long options;
+	unsigned long long input;
+
+	CheckpointHeader() {
+		memset(this, 0, sizeof(CheckpointHeader));
+		memcpy(magic, CHECKPOINT_MAGIC, sizeof(magic));
+		version = CHECKPOINT_VERSION;
+	}
+
+	bool operator==(const CheckpointHeader &h) const {
+		return memcmp(magic, h.magic, sizeof(magic)) == 0
+				&& version == h.version && num_trees == h.num_trees
+				&& options == h.options && input == h.input;
+	}
+};
+
+// FNV-1a hash of size bytes of data, continuing from hash
+unsigned long long checkpoint_hash(const void *data, size_t size,
+		unsigned long long hash) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+#define CHECKPOINT_HASH_START 14695981039346656037ULL
+
+/* PairCheckpoint
+ * The distances of (row, column) pairs found by earlier runs, and the
+ * file that the distances of this run are appended to. find() may be
+ * called by several threads; add() and flush() must not be called
+ * concurrently
+ */
+class PairCheckpoint {
+	private:
+	FILE *out;
+	time_t last_flush;
+	unordered_map<long long, int> done;
+
+	static inline long long key(int row, int column) {
+		return ((long long)row << 32) | (unsigned int)column;
+	}
+
+	// not copyable, the file belongs to one object
+	PairCheckpoint(const PairCheckpoint &c);
+	PairCheckpoint &operator=(const PairCheckpoint &c);
+
+	public:
+	PairCheckpoint() {
+		out = NULL;
+		last_flush = time(NULL);
+	}
+
+	~PairCheckpoint() {
+		if (out != NULL)
+			fclose(out);
+	}
+
+	/* open
+	 * Start writing file. With resume, the distances already in file are
+	 * kept and can be found with find(). Returns false and sets error if
+	 * the file can not be used
+	 */
+	bool open(const string &file, bool resume, const CheckpointHeader &header,
+			string *error) {
+		FILE *in = (resume ? fopen(file.c_str(), "rb") : NULL);
+		// a run killed before writing anything starts over
+		if (in != NULL && fgetc(in) == EOF) {
+			fclose(in);
+			in = NULL;
+		}
+		if (in != NULL) {
+			rewind(in);
+			CheckpointHeader old_header;
+			if (fread(&old_header, sizeof(old_header), 1, in) != 1
+					|| !(old_header == header)) {
+				fclose(in);
+				*error = file + " is not a checkpoint of this input and options";
+				return false;
+			}
+			int record[3];
+			while (fread(record, sizeof(int), 3, in) == 3)
+				done[key(record[0], record[1])] = record[2];
+			fclose(in);
+			out = fopen(file.c_str(), "r+b");
+			if (out != NULL) {
+				// overwrite a partial final record
+				fseek(out, 0, SEEK_END);
+				long end = ftell(out);
+				end -= (end - sizeof(CheckpointHeader)) % (3 * sizeof(int));
+				fseek(out, end, SEEK_SET);
+			}
+		}
+		else {
+			out = fopen(file.c_str(), "wb");
+			if (out != NULL && (fwrite(&header, sizeof(header), 1, out) != 1
+					|| fflush(out) != 0)) {
+				fclose(out);
+				out = NULL;
+			}
+		}
+		if (out == NULL) {
+			*error = "could not write " + file;
+			return false;
+		}
+		return true;
+	}
+
+	inline int size() {
+		return done.size();
+	}
+
+	bool find(int row, int column, int *distance) {
+		unordered_map<long long, int>::iterator i = done.find(key(row, column));
+		if (i == done.end())
+			return false;
+		*distance = i->second;
+		return true;
+	}
+
+	void add(int row, int column, int distance) {
+		int record[3] = {row, column, distance};
+		fwrite(record, sizeof(int), 3, out);
+	}
+
+	// flush if force or CHECKPOINT_INTERVAL seconds have passed
+	void flush(bool force) {
+		time_t now = time(NULL);
+		if (force || now - last_flush >= CHECKPOINT_INTERVAL) {
+			fflush(out);
+			last_flush = now;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,285 @@
+/*******************************************************************************
+CompactTree.h
+
+Read-only, index based storage for input trees
+
+Copyright 2012-2014 Chris Whidden
+cwhidden@dal.ca
+http://kiwi.cs.dal.ca/Software/RSPR
+March 3, 2014
+Version 1.2.1
+
+This file is part of rspr.
+
+rspr is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+rspr is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with rspr.  If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INCLUDE_COMPACTTREE
+
+#define INCLUDE_COMPACTTREE
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <utility>
+#include "Node.h"
+#include "LineReader.h"
+
+using namespace std;
+
+/* CompactTree
+ * An immutable tree stored as arrays indexed by preorder number, with
+ * integer labels (-1 for unlabelled nodes). Trees that are only read,
+ * such as the input trees of -pairwise, are kept in this form and
+ * expanded into Nodes with to_node() when a pair is compared.
+ * Labels must already be numbers (see Node::labels_to_numbers)
+ */
+class CompactTree {
+	private:
+	// the parent, first child, next sibling, subtree end (last preorder
+	// number in the subtree) and label arrays, stored back to back
+	vector<int> storage;	// empty when the arrays are owned elsewhere
+	const int *data;
+	int num_nodes;
+	const int *parents;
+	const int *first_children;
+	const int *next_siblings;
+	const int *subtree_ends;
+	const int *labels;
+
+	void set_arrays(const int *data, int num_nodes) {
+		this->data = data;
+		this->num_nodes = num_nodes;
+		parents = data;
+		first_children = data + num_nodes;
+		next_siblings = data + 2 * num_nodes;
+		subtree_ends = data + 3 * num_nodes;
+		labels = data + 4 * num_nodes;
+	}
+
+	public:
+	CompactTree() {
+		set_arrays(NULL, 0);
+	}
+
+	CompactTree(Node *root) {
+		int size = root->size();
+		storage = vector<int>(CompactTree::data_size(size), -1);
+		set_arrays(&storage[0], size);
+		int *parents = &storage[0];
+		int *first_children = parents + size;
+		int *next_siblings = parents + 2 * size;
+		int *subtree_ends = parents + 3 * size;
+		int *labels = parents + 4 * size;
+		// preorder traversal with an explicit stack
+		vector<pair<Node *, int> > stack = vector<pair<Node *, int> >();
+		stack.push_back(make_pair(root, -1));
+		int index = 0;
+		while(!stack.empty()) {
+			Node *n = stack.back().first;
+			parents[index] = stack.back().second;
+			stack.pop_back();
+			subtree_ends[index] = index;
+			string name = n->get_name();
+			labels[index] = (name == "" ? -1 : atoi(name.c_str()));
+			list<Node *>::reverse_iterator c;
+			for(c = n->get_children().rbegin(); c != n->get_children().rend();
+					c++) {
+				stack.push_back(make_pair(*c, index));
+			}
+			index++;
+		}
+		// link siblings and find the subtree intervals
+		for(int i = size - 1; i > 0; i--) {
+			int parent = parents[i];
+			next_siblings[i] = first_children[parent];
+			first_children[parent] = i;
+			if (subtree_ends[i] > subtree_ends[parent])
+				subtree_ends[parent] = subtree_ends[i];
+		}
+	}
+
+	/* view arrays of data_size(num_nodes) ints laid out as by data(),
+	 * such as a memory mapped file. The memory must outlive the tree
+	 */
+	CompactTree(const int *data, int num_nodes) {
+		set_arrays(data, num_nodes);
+	}
+
+	CompactTree(const CompactTree &t) {
+		storage = t.storage;
+		set_arrays(storage.empty() ? t.data : &storage[0], t.num_nodes);
+	}
+
+	// t is left empty
+	CompactTree(CompactTree &&t) noexcept {
+		storage.swap(t.storage);
+		set_arrays(storage.empty() ? t.data : &storage[0], t.num_nodes);
+		t.set_arrays(NULL, 0);
+	}
+
+	CompactTree &operator=(const CompactTree &t) {
+		if (this != &t) {
+			storage = t.storage;
+			set_arrays(storage.empty() ? t.data : &storage[0], t.num_nodes);
+		}
+		return *this;
+	}
+
+	// t is left empty
+	CompactTree &operator=(CompactTree &&t) noexcept {
+		if (this != &t) {
+			storage.swap(t.storage);
+			set_arrays(storage.empty() ? t.data : &storage[0], t.num_nodes);
+			t.storage.clear();
+			t.set_arrays(NULL, 0);
+		}
+		return *this;
+	}
+
+	// number of ints used to store a tree with num_nodes nodes
+	static inline int data_size(int num_nodes) {
+		return 5 * num_nodes;
+	}
+	inline const int *get_data() const {
+		return data;
+	}
+	inline int size() const {
+		return num_nodes;
+	}
+	inline int parent(int i) const {
+		return parents[i];
+	}
+	inline int first_child(int i) const {
+		return first_children[i];
+	}
+	inline int next_sibling(int i) const {
+		return next_siblings[i];
+	}
+	inline int subtree_end(int i) const {
+		return subtree_ends[i];
+	}
+	inline int label(int i) const {
+		return labels[i];
+	}
+	inline bool is_leaf(int i) const {
+		return first_children[i] == -1;
+	}
+	int num_leaves() const {
+		int count = 0;
+		for(int i = 0; i < num_nodes; i++) {
+			if (first_children[i] == -1)
+				count++;
+		}
+		return count;
+	}
+
+	// replace each label l with numbers[l]. The tree must own its arrays
+	void relabel(const vector<int> &numbers) {
+		int *labels = &storage[0] + 4 * num_nodes;
+		for(int i = 0; i < num_nodes; i++) {
+			if (labels[i] >= 0)
+				labels[i] = numbers[labels[i]];
+		}
+	}
+
+	// build a Node tree with the same structure and labels
+	Node *to_node() const {
+		if (num_nodes == 0)
+			return new Node();
+		vector<Node *> nodes = vector<Node *>(num_nodes);
+		for(int i = 0; i < num_nodes; i++) {
+			string name = "";
+			if (labels[i] >= 0) {
+				stringstream ss;
+				ss << labels[i];
+				name = ss.str();
+			}
+			nodes[i] = new Node(name);
+			// preorder ensures the parent exists and children stay in order
+			if (parents[i] >= 0)
+				nodes[parents[i]]->add_child(nodes[i]);
+		}
+		return nodes[0];
+	}
+};
+
+#define READ_CHUNK_LINES 256
+
+/* read_compact_trees
+ * Read each line of a stream as a tree with numbered labels, skipping
+ * lines without a tree. Chunks of lines are parsed in parallel and each
+ * chunk numbers its labels in order of appearance. The chunk numberings
+ * are merged in input order, so the label numbers match a serial read
+ * regardless of the number of threads
+ */
+void read_compact_trees(istream &in, bool unrooted,
+		vector<CompactTree> *trees, vector<string> *names,
+		map<string, int> *label_map, map<int, string> *reverse_label_map) {
+	vector<char> buffer = vector<char>();
+	vector<char *> lines = vector<char *>();
+	vector<size_t> lengths = vector<size_t>();
+	read_lines(in, &buffer, &lines, &lengths);
+	int num_lines = lines.size();
+	int num_chunks = (num_lines + READ_CHUNK_LINES - 1) / READ_CHUNK_LINES;
+	vector<vector<CompactTree> > chunk_trees =
+			vector<vector<CompactTree> >(num_chunks);
+	vector<vector<string> > chunk_names = vector<vector<string> >(num_chunks);
+	vector<map<int, string> > chunk_labels =
+			vector<map<int, string> >(num_chunks);
+	#pragma omp parallel for schedule(dynamic)
+	for(int c = 0; c < num_chunks; c++) {
+		map<string, int> chunk_label_map = map<string, int>();
+		int end = min((c + 1) * READ_CHUNK_LINES, num_lines);
+		for(int i = c * READ_CHUNK_LINES; i < end; i++) {
+			string name = "";
+			Node *T = read_tree(lines[i], lengths[i], unrooted, &name,
+					&chunk_label_map, &chunk_labels[c]);
+			if (T != NULL) {
+				chunk_names[c].push_back(name);
+				chunk_trees[c].push_back(CompactTree(T));
+				T->delete_tree();
+			}
+		}
+	}
+	// number the labels of each chunk in input order
+	vector<vector<int> > chunk_numbers = vector<vector<int> >(num_chunks);
+	for(int c = 0; c < num_chunks; c++) {
+		chunk_numbers[c] = vector<int>(chunk_labels[c].size());
+		map<int, string>::iterator l;
+		for(l = chunk_labels[c].begin(); l != chunk_labels[c].end(); l++) {
+			map<string, int>::iterator i = label_map->find(l->second);
+			if (i == label_map->end()) {
+				int num = label_map->size();
+				i = label_map->insert(make_pair(l->second, num)).first;
+				reverse_label_map->insert(make_pair(num, l->second));
+			}
+			chunk_numbers[c][l->first] = i->second;
+		}
+	}
+	#pragma omp parallel for schedule(dynamic)
+	for(int c = 0; c < num_chunks; c++) {
+		for(int i = 0; i < chunk_trees[c].size(); i++)
+			chunk_trees[c][i].relabel(chunk_numbers[c]);
+	}
+	for(int c = 0; c < num_chunks; c++) {
+		for(int i = 0; i < chunk_trees[c].size(); i++) {
+			trees->push_back(std::move(chunk_trees[c][i]));
+			names->push_back(chunk_names[c][i]);
+		}
+	}
+}
+
+#endif
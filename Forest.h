@@ -136,7 +136,7 @@ class Forest {
 		deleted_nodes = vector<Node *>();
 		rho = false;
 		for(int i = 0; i < components.size(); i++) {
-				if (components[i]->str() == "p")
+				if (components[i]->is_rho())
 					rho = true;
 		}
 		twin = NULL;
@@ -196,18 +196,23 @@ class Forest {
 
 	// print the forest
 	void print_components() {
+		print_components(cout);
+	}
+
+	// print the forest to os
+	void print_components(ostream &os) {
 		vector<Node *>::iterator it = components.begin();
 		for(it = components.begin(); it != components.end(); it++) {
 			Node *root = *it;
 			if (root == NULL)
-				cout << "!";
+				os << "!";
 			else if (root->is_leaf() && root->str() == "")
-				cout << "*";
+				os << "*";
 			else
-				root->print_subtree_hlpr();
-			cout << " ";
+				os << root->str_subtree();
+			os << " ";
 		}
-		cout << endl;
+		os << endl;
 	}
 
 	// print the forest
@@ -495,12 +500,12 @@ bool sync_twins(Forest *T1, Forest *T2) {
 		for(j = unsorted_labels.begin(); j != unsorted_labels.end(); j++) {
 			Node *leaf = *j;
 //			cout << "T1: " << leaf->str() << endl;
-			if (leaf->str() == "p") {
+			if (leaf->is_rho()) {
 				T1_rho = leaf;
 			}
 			else {
 				// find smallest number contained in the label
-				int number = stomini(leaf->str());
+				int number = leaf->get_label_number();
 //				cout << "\t" << number << endl;
 				if (number < INT_MAX) {
 					if (number >= T1_labels.size())
@@ -517,12 +522,12 @@ bool sync_twins(Forest *T1, Forest *T2) {
 		for(j = unsorted_labels.begin(); j != unsorted_labels.end(); j++) {
 			Node *leaf = *j;
 //			cout << "T2: " << leaf->str() << endl;
-			if (leaf->str() == "p") {
+			if (leaf->is_rho()) {
 				T2_rho = leaf;
 			}
 			else {
 				// find smallest number contained in the label
-				int number = stomini(leaf->str());
+				int number = leaf->get_label_number();
 //				cout << "\t" << number << endl;
 				if (number < INT_MAX) {
 					if (number >= T2_labels.size())
@@ -555,7 +560,7 @@ bool sync_twins(Forest *T1, Forest *T2) {
 				Node *sibling = node->lchild();
 				if (sibling == T2_a)
 						sibling = node->rchild();
-				T2_labels[stomini(sibling->str())] = sibling;
+				T2_labels[sibling->get_label_number()] = sibling;
 			}
 			delete T2_a;
 			if (node->get_children().size() < 2) {
@@ -575,7 +580,7 @@ bool sync_twins(Forest *T1, Forest *T2) {
 				Node *sibling = node->lchild();
 				if (sibling == T1_a)
 						sibling = node->rchild();
-				T1_labels[stomini(sibling->str())] = sibling;
+				T1_labels[sibling->get_label_number()] = sibling;
 			}
 			delete T1_a;
 			if (node->get_children().size() < 2) {
@@ -604,7 +609,7 @@ bool sync_twins(Forest *T1, Forest *T2) {
 				Node *sibling = node->lchild();
 				if (sibling == T1_a)
 						sibling = node->rchild();
-				T1_labels[stomini(sibling->str())] = sibling;
+				T1_labels[sibling->get_label_number()] = sibling;
 			}
 			delete T1_a;
 			if (node->get_children().size() < 2) {
@@ -628,7 +633,7 @@ bool sync_twins(Forest *T1, Forest *T2) {
 				Node *sibling = node->lchild();
 				if (sibling == T2_a)
 						sibling = node->rchild();
-				T2_labels[stomini(sibling->str())] = sibling;
+				T2_labels[sibling->get_label_number()] = sibling;
 			}
 			delete T2_a;
 			if (node->get_children().size() < 2) {
@@ -717,7 +722,7 @@ void sync_interior_twins_real(Forest *T1, Forest *F2) {
 //		}
 //		cout << "foo" << endl;
 		// ignore rho components
-		if (F2_roots[i]->str() == "p") {
+		if (F2_roots[i]->is_rho()) {
 		//	F2_LCAs.push_back(LCA());
 		F2_LCAs.push_back(F2_roots[i]);
 		//F2_LCAs.push_back(NULL);//LCA(F2_roots[i]));
@@ -730,7 +735,7 @@ void sync_interior_twins_real(Forest *T1, Forest *F2) {
 		// list of nodes that get deleted when a component is finished
 		F2_roots[i]->initialize_removable_descendants(list<list<Node *>::iterator>());
 		// sync the component with T1
-		if (F2_roots[i]->str() != "p" &&
+		if (!F2_roots[i]->is_rho() &&
 				!(F2_roots[i]->get_twin() != NULL && F2_roots[i]->get_twin()->parent() == NULL)) {
 			sync_interior_twins(F2_roots[i], &T1_LCA);
 		}
@@ -35,6 +35,8 @@ along with rspr.  If not, see <http://www.gnu.org/licenses/>.
 #include "Node.h"
 #include <vector>
 #include <cmath>
+#include <climits>
+#include <list>
 using namespace std;
 
 int mylog2 (int val) {
@@ -54,100 +56,151 @@ int mylog2 (int val) {
     return ret;
 }
 
+/* LCA
+ * Constant time lowest common ancestor queries with linear space.
+ * Nodes are renumbered in preorder and P holds the number of each
+ * node's parent. For a before b in preorder, lca(a,b) is the parent
+ * with the smallest number in P(a,b]. Range minimums use blocks of 32
+ * entries: a sparse table over the block minimums and, inside a block,
+ * a bitmask of the prefix minimums ending at each entry.
+ */
+#define LCA_BLOCK 32
 class LCA {
 	private:
 	Node *tree;
-	vector<int> E;		// preorder numbers of euler tour
-	vector<int> L;		// levels of euler tour
-	vector<int> H;		// first occurence of a preorder number in E
 	vector<int> T;    // real preorder to internal preorder mapping
 	vector<Node *> N;	// preorder to node mapping
-	vector<vector<int> > RMQ;	// precomputed RMQ values
+	vector<int> P;		// preorder number of the parent
+	vector<unsigned int> M;	// prefix minimum masks within each block
+	vector<int> B;		// sparse table of block minimums, one row per level
+	int num_blocks;
 
 	public:
 	LCA(Node *tree) {
 		this->tree = tree;
-		T = vector<int>();
 		if (tree->get_preorder_number() == -1)
 			tree->preorder_number();
-		euler_tour(tree, 0);
+		preorder(tree);
 		precompute_rmq();
 	}
 
 	LCA() {
 		this->tree = NULL;
+		num_blocks = 0;
 	}
-	void euler_tour(Node *node, int depth) {
-		// First visit
-		int preorder_number = N.size();
-		int euler_number = E.size();
-		N.push_back(node);
-		if (T.size() <= node->get_preorder_number())
-			T.resize(node->get_preorder_number()+1,-1);
-		T[node->get_preorder_number()] = preorder_number;
-
-		//cout << preorder_number << "\t";
-		//node->print_subtree();
-		H.push_back(euler_number);
-		L.push_back(depth);
-		E.push_back(preorder_number);
-
-		// TODO: check that this is correct for multifurcating trees
-		
-		list<Node *>::const_iterator c;
-		for(c = node->get_children().begin(); c != node->get_children().end();
-				c++) {
-			euler_tour(*c, depth+1);
-			// Middle/Last visit
-			L.push_back(depth);
-			E.push_back(preorder_number);
-		}
 
+	void preorder(Node *root) {
+		vector<pair<Node *, int> > stack = vector<pair<Node *, int> >();
+		stack.push_back(make_pair(root, -1));
+		while(!stack.empty()) {
+			Node *node = stack.back().first;
+			int parent = stack.back().second;
+			stack.pop_back();
+			int preorder_number = N.size();
+			N.push_back(node);
+			P.push_back(parent);
+			if (T.size() <= node->get_preorder_number())
+				T.resize(node->get_preorder_number()+1,-1);
+			T[node->get_preorder_number()] = preorder_number;
+			list<Node *>::const_reverse_iterator c;
+			for(c = node->get_children().rbegin();
+					c != node->get_children().rend(); c++) {
+				stack.push_back(make_pair(*c, preorder_number));
+			}
+		}
 	}
 
 	void precompute_rmq() {
-		// E gives queries of length 1
-		RMQ.push_back(E);
-		for(int length = 1; length < E.size(); length *= 2) {
-			vector<int> V = vector<int>();
-			for(int start = 0; start < E.size() - length; start++) {
-				V.push_back(rmq(start, start + length));
+		int n = P.size();
+		num_blocks = (n + LCA_BLOCK - 1) / LCA_BLOCK;
+		M.resize(n);
+		B.resize(num_blocks);
+		for(int block = 0; block < num_blocks; block++) {
+			int start = block * LCA_BLOCK;
+			int end = start + LCA_BLOCK;
+			if (end > n)
+				end = n;
+			// stack of prefix minimums as a bitmask
+			unsigned int mask = 0;
+			for(int j = start; j < end; j++) {
+				while (mask != 0 && P[start + 31 - __builtin_clz(mask)] > P[j])
+					mask ^= 1u << (31 - __builtin_clz(mask));
+				mask |= 1u << (j - start);
+				M[j] = mask;
+			}
+			B[block] = P[start + __builtin_ctz(M[end - 1])];
+		}
+		for(int length = 1; 2 * length <= num_blocks; length *= 2) {
+			int row = B.size() - num_blocks;
+			for(int block = 0; block < num_blocks; block++) {
+				int value = B[row + block];
+				if (block + length < num_blocks && B[row + block + length] < value)
+					value = B[row + block + length];
+				B.push_back(value);
 			}
-			RMQ.push_back(V);
 		}
 	}
-	//vector<vector<int> > RMQ;	// precomputed RMQ values
 
-	// find the index of the rmq between indices i and j of E
+	// minimum of P[i..j], i and j in the same block
+	inline int block_rmq(int i, int j) {
+		return P[i + __builtin_ctz(M[j] >> (i % LCA_BLOCK))];
+	}
+
+	// minimum of P[i..j]
 	int rmq(int i, int j) {
+		int block_i = i / LCA_BLOCK;
+		int block_j = j / LCA_BLOCK;
+		if (block_i == block_j)
+			return block_rmq(i, j);
+		int min = block_rmq(i, block_i * LCA_BLOCK + LCA_BLOCK - 1);
+		int value = block_rmq(block_j * LCA_BLOCK, j);
+		if (value < min)
+			min = value;
+		block_i++;
+		block_j--;
+		if (block_i <= block_j) {
+			int level = mylog2(block_j - block_i + 1);
+			int row = level * num_blocks;
+			value = B[row + block_i];
+			if (value < min)
+				min = value;
+			value = B[row + block_j - (1 << level) + 1];
+			if (value < min)
+				min = value;
+		}
+		return min;
+	}
+
+	// lca of the nodes with internal preorder numbers i <= j
+	inline Node *lca_index(int i, int j) {
 		if (i == j)
-			return E[i];
-		int length = j - i - 1;
-		//cout << "  " << i << " " << j << endl;
-		//cout << "  " << length << endl;
-		//cout << "  " << mylog2(length) << endl;
-		length = (mylog2(length));
-		//cout << "  " << length << endl;
-		//cout << "  " << j - (1 << (length)) << endl;
-		int rmq1 = RMQ[length+1][i];
-		int rmq2;
-		if (length >= 0)
-			rmq2 = RMQ[length+1][j - (1 << (length))];
-		else
-			rmq2 = RMQ[length+1][j];
-		if (rmq1 < rmq2)
-			return rmq1;
-		return rmq2;
+			return N[i];
+		return N[rmq(i + 1, j)];
 	}
+
 	Node *get_lca(Node *a, Node *b) {
 		int preorder_a = T[a->get_preorder_number()];
 		int preorder_b = T[b->get_preorder_number()];
-		int lca_index;
 		if (preorder_a <= preorder_b)
-			lca_index = rmq(H[preorder_a], H[preorder_b]);
+			return lca_index(preorder_a, preorder_b);
 		else
-			lca_index = rmq(H[preorder_b], H[preorder_a]);
-		return N[lca_index];
+			return lca_index(preorder_b, preorder_a);
+	}
+
+	// lca of a set of nodes with a single range query
+	Node *get_lca(const vector<Node *> &nodes) {
+		int first = INT_MAX;
+		int last = -1;
+		for(int i = 0; i < nodes.size(); i++) {
+			int preorder = T[nodes[i]->get_preorder_number()];
+			if (preorder < first)
+				first = preorder;
+			if (preorder > last)
+				last = preorder;
+		}
+		if (last == -1)
+			return NULL;
+		return lca_index(first, last);
 	}
 
 	Node *get_tree() {
@@ -159,29 +212,17 @@ class LCA {
 	}
 	*/
 	void debug() {
-		for(int i = 0; i < E.size(); i++) {
-			cout << " " << E[i];
+		for(int i = 0; i < P.size(); i++) {
+			cout << " " << P[i];
 		}
 		cout << endl;
 		cout << endl;
-		for(int i = 0; i < L.size(); i++) {
-			cout << " " << L[i];
+		for(int i = 0; i < B.size(); i++) {
+			cout << " " << B[i];
+			if ((i + 1) % num_blocks == 0)
+				cout << endl;
 		}
 		cout << endl;
-		cout << endl;
-		for(int i = 0; i < H.size(); i++) {
-			cout << " " << H[i];
-		}
-		cout << endl;
-		cout << endl;
-		cout << endl;
-		for(int i = 0; i < RMQ.size(); i++) {
-			for(int j = 0; j < RMQ[i].size(); j++) {
-			cout << " " << RMQ[i][j];
-			}
-			cout << endl;
-			cout << endl;
-		}
 	}
 };
 
@@ -0,0 +1,132 @@
+/*******************************************************************************
+LineReader.h
+
+Chunked line reader for large tree files
+
+Copyright 2012-2014 Chris Whidden
+cwhidden@dal.ca
+http://kiwi.cs.dal.ca/Software/RSPR
+March 3, 2014
+Version 1.2.1
+
+This file is part of rspr.
+
+rspr is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+rspr is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with rspr.  If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef INCLUDE_LINEREADER
+
+#define INCLUDE_LINEREADER
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+#define LINE_READER_CHUNK (1 << 20)
+
+/* LineReader
+ * Read a stream in large chunks and return its lines in place, without
+ * copying each line into a string. Lines are null terminated (the
+ * newline is replaced) and stay valid until the next call to next().
+ * Like getline, a final line without a newline is returned
+ */
+class LineReader {
+	private:
+	istream *in;
+	vector<char> buffer;
+	size_t begin;	// start of the unread data
+	size_t end;		// end of the unread data
+	bool done;		// the stream is exhausted
+
+	// move the unread data to the front and read another chunk
+	void fill() {
+		if (begin > 0) {
+			memmove(&buffer[0], &buffer[begin], end - begin);
+			end -= begin;
+			begin = 0;
+		}
+		// keep a byte free to terminate a final line
+		if (end + 1 >= buffer.size())
+			buffer.resize(buffer.size() * 2);
+		in->read(&buffer[end], buffer.size() - end - 1);
+		end += in->gcount();
+		if (in->gcount() == 0)
+			done = true;
+	}
+
+	public:
+	LineReader(istream &in) {
+		this->in = &in;
+		buffer = vector<char>(LINE_READER_CHUNK);
+		begin = 0;
+		end = 0;
+		done = false;
+	}
+
+	bool next(char **line, size_t *len) {
+		size_t searched = begin;
+		while(true) {
+			char *newline = (char *)memchr(&buffer[searched], '\n',
+					end - searched);
+			if (newline != NULL) {
+				*newline = '\0';
+				*line = &buffer[begin];
+				*len = newline - *line;
+				begin += *len + 1;
+				return true;
+			}
+			if (done) {
+				if (begin == end)
+					return false;
+				buffer[end] = '\0';
+				*line = &buffer[begin];
+				*len = end - begin;
+				begin = end;
+				return true;
+			}
+			searched = end - begin;
+			fill();
+			searched += begin;
+		}
+	}
+};
+
+/* read_lines
+ * Read the rest of a stream into buffer and find its lines, null
+ * terminated in place, so that they can be split among threads. As with
+ * LineReader, a final line without a newline is included
+ */
+void read_lines(istream &in, vector<char> *buffer, vector<char *> *lines,
+		vector<size_t> *lengths) {
+	size_t end = 0;
+	while (in) {
+		buffer->resize(end + LINE_READER_CHUNK);
+		in.read(&(*buffer)[end], LINE_READER_CHUNK);
+		end += in.gcount();
+	}
+	// keep a byte free to terminate a final line
+	buffer->resize(end + 1);
+	size_t start = 0;
+	while (start < end) {
+		char *newline = (char *)memchr(&(*buffer)[start], '\n', end - start);
+		size_t line_end = (newline == NULL ? end : newline - &(*buffer)[0]);
+		(*buffer)[line_end] = '\0';
+		lines->push_back(&(*buffer)[start]);
+		lengths->push_back(line_end - start);
+		start = line_end + 1;
+	}
+}
+
+#endif
@@ -34,12 +34,16 @@ along with rspr.  If not, see <http://www.gnu.org/licenses/>.
 #define DEBUG_SUPPORT 0
 
 #include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <map>
 #include <set>
+#include <algorithm>
 #include "Forest.h"
 
 using namespace std;
@@ -65,11 +69,162 @@ void str_subtree_hlpr(string *s);
 list<Node *> find_sibling_pairs(Node *node);
 vector<Node *> find_leaves(Node *node);
 */
-int stomini(string s);
+int stomini(const string &s);
 
 
 class Forest;
 
+#ifndef NO_NODE_POOL
+/* NodePool
+ * Nodes are carved from slabs of NODE_POOL_SLAB nodes owned by the
+ * thread that created them and recycled through a free list in each
+ * slab, so copying and deleting forests does not go through the system
+ * allocator. Each node is preceded by a pointer to its slab. A node
+ * deleted by another thread, such as one of a forest returned by an
+ * OpenMP task, is queued back to the owning pool, which takes the queue
+ * before it adds a slab. Slabs with no nodes in use are released,
+ * except for one kept by each pool. Build with -DNO_NODE_POOL to
+ * allocate each node separately
+ */
+#define NODE_POOL_SLAB 4096
+// bytes before each node that hold its slab, keeping the node aligned
+#define NODE_POOL_HEADER 16
+struct NodePool;
+struct NodePoolBlock {
+	NodePoolBlock *next;
+};
+struct NodeSlab {
+	NodePool *pool;
+	NodeSlab *prev;		// in the list of slabs with free nodes
+	NodeSlab *next;
+	NodePoolBlock *free;
+	int num_free;
+};
+struct NodePool {
+	NodeSlab *slabs;	// slabs with free nodes
+	int num_empty;		// slabs with no nodes in use
+	NodePoolBlock *remote;	// nodes deleted by other threads
+	NodePool() {
+		slabs = NULL;
+		num_empty = 0;
+		remote = NULL;
+	}
+};
+NodePool *NODE_POOL = NULL;
+#pragma omp threadprivate(NODE_POOL)
+
+inline NodeSlab *&node_pool_slab(void *p) {
+	return *(NodeSlab **)((char *)p - NODE_POOL_HEADER);
+}
+
+void node_pool_unlink(NodePool *pool, NodeSlab *slab) {
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		pool->slabs = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+}
+
+void node_pool_add_slab(NodePool *pool, size_t size) {
+	size_t header = (sizeof(NodeSlab) + 15) / 16 * 16;
+	size_t stride = (NODE_POOL_HEADER + size + 15) / 16 * 16;
+	char *memory = (char *)::operator new(header + stride * NODE_POOL_SLAB);
+	NodeSlab *slab = (NodeSlab *)memory;
+	slab->pool = pool;
+	slab->free = NULL;
+	slab->num_free = NODE_POOL_SLAB;
+	for(int i = NODE_POOL_SLAB - 1; i >= 0; i--) {
+		void *p = memory + header + i * stride + NODE_POOL_HEADER;
+		node_pool_slab(p) = slab;
+		NodePoolBlock *block = (NodePoolBlock *)p;
+		block->next = slab->free;
+		slab->free = block;
+	}
+	slab->prev = NULL;
+	slab->next = pool->slabs;
+	if (pool->slabs != NULL)
+		pool->slabs->prev = slab;
+	pool->slabs = slab;
+	pool->num_empty++;
+}
+
+// return p to its slab, which belongs to this thread's pool
+void node_pool_release(NodePool *pool, void *p) {
+	NodeSlab *slab = node_pool_slab(p);
+	NodePoolBlock *block = (NodePoolBlock *)p;
+	block->next = slab->free;
+	slab->free = block;
+	if (slab->num_free++ == 0) {
+		slab->prev = NULL;
+		slab->next = pool->slabs;
+		if (pool->slabs != NULL)
+			pool->slabs->prev = slab;
+		pool->slabs = slab;
+	}
+	if (slab->num_free == NODE_POOL_SLAB) {
+		if (pool->num_empty > 0) {
+			node_pool_unlink(pool, slab);
+			::operator delete(slab);
+		}
+		else {
+			pool->num_empty++;
+		}
+	}
+}
+
+// take back the nodes of pool deleted by other threads
+void node_pool_collect(NodePool *pool) {
+	NodePoolBlock *remote;
+	#pragma omp atomic read
+	remote = pool->remote;
+	if (remote == NULL)
+		return;
+	#pragma omp critical(node_pool_remote)
+	{
+		remote = pool->remote;
+		pool->remote = NULL;
+	}
+	while (remote != NULL) {
+		NodePoolBlock *next = remote->next;
+		node_pool_release(pool, remote);
+		remote = next;
+	}
+}
+
+void *node_pool_new(size_t size) {
+	NodePool *pool = NODE_POOL;
+	if (pool == NULL)
+		pool = NODE_POOL = new NodePool();
+	if (pool->slabs == NULL)
+		node_pool_collect(pool);
+	if (pool->slabs == NULL)
+		node_pool_add_slab(pool, size);
+	NodeSlab *slab = pool->slabs;
+	if (slab->num_free-- == NODE_POOL_SLAB)
+		pool->num_empty--;
+	NodePoolBlock *block = slab->free;
+	slab->free = block->next;
+	if (slab->free == NULL)
+		node_pool_unlink(pool, slab);
+	return block;
+}
+
+void node_pool_delete(void *p) {
+	NodePool *pool = node_pool_slab(p)->pool;
+	if (pool == NODE_POOL) {
+		node_pool_release(pool, p);
+		return;
+	}
+	NodePoolBlock *block = (NodePoolBlock *)p;
+	#pragma omp critical(node_pool_remote)
+	{
+		block->next = pool->remote;
+		pool->remote = block;
+	}
+}
+#endif
+
 class Node {
 	private:
 	//Node *lc;			// left child
@@ -79,6 +234,7 @@ class Node {
 	list<Node *>:: iterator p_link;		// location in parents list
 	Node *twin;			// counterpart in another tree
 	string name;		// label
+	int name_number;	// smallest number in name, INT_MAX if none
 	int depth;			//distance from root
 	int pre_num;	// preorder number
 	int edge_pre_start;
@@ -107,6 +263,22 @@ class Node {
         int non_leaf_children = 0;
 
 	public:
+#ifndef NO_NODE_POOL
+	static void *operator new(size_t size) {
+		if (size != sizeof(Node))
+			return ::operator new(size);
+		return node_pool_new(size);
+	}
+	static void operator delete(void *p, size_t size) {
+		if (p == NULL)
+			return;
+		if (size != sizeof(Node)) {
+			::operator delete(p);
+			return;
+		}
+		node_pool_delete(p);
+	}
+#endif
 	Node() {
 		init(NULL, NULL, NULL, "", 0);
 	}
@@ -123,7 +295,7 @@ class Node {
 //		this->lc = lc;
 //		this->rc = rc;
 		this->p = p;
-		this->name = string(n);
+		set_name(n);
 		this->twin = NULL;
 		this->depth = d;
 		this->pre_num = -1;
@@ -157,6 +329,7 @@ class Node {
 	Node(const Node &n) {
 		p = NULL;
 		name = n.name.c_str();
+		name_number = n.name_number;
 		twin = n.twin;
 		depth = n.depth;
 //		depth = 0;
@@ -218,6 +391,7 @@ class Node {
         Node(const Node &n, map<Node*, Node*> *node_map) {
 		p = NULL;
 		name = n.name.c_str();
+		name_number = n.name_number;
 //		twin = n.twin;
 		depth = n.depth;
 //		depth = 0;
@@ -281,6 +455,7 @@ class Node {
 	Node(const Node &n, Node *parent) {
 		p = parent;
 		name = n.name.c_str();
+		name_number = n.name_number;
 		twin = n.twin;
 		if (p != NULL)
 			depth = p->depth+1;
@@ -521,6 +696,7 @@ class Node {
 	}
 	void set_name(string n) {
 		name = string(n);
+		name_number = stomini(name);
 	}
 	int set_depth(int d) {
 		depth = d;
@@ -920,7 +1096,7 @@ class Node {
 			// dead component or singleton, will be cleaned up by the forest
 			if (children.empty()) {
 				if (str() == "")
-					name = DEAD_COMPONENT;
+					set_name(DEAD_COMPONENT);
 			}
 			if (children.size() == 1) {
 					child = children.front();
@@ -952,7 +1128,8 @@ class Node {
 							set_twin(child->get_twin());
 							child->get_twin()->set_twin(this);
 						}
-						name = child->get_name().c_str();
+						name = child->name;
+						name_number = child->name_number;
 //						name = child->str();
 					}
 					// TODO: redundant?
@@ -1275,6 +1452,60 @@ class Node {
 	string get_name() {
 		return name;
 	}
+
+	// smallest number in str(), without building the string
+	int get_label_number() {
+		int min = name_number;
+		if (contracted_lc != NULL) {
+			int n = contracted_lc->get_c_subtree_label_number();
+			if (n < min)
+				min = n;
+		}
+		for (auto c = contracted_children.begin(); c != contracted_children.end(); c++) {
+			int n = (*c)->get_c_subtree_label_number();
+			if (n < min)
+				min = n;
+		}
+		if (contracted_rc != NULL) {
+			int n = contracted_rc->get_c_subtree_label_number();
+			if (n < min)
+				min = n;
+		}
+		return min;
+	}
+
+	// smallest number in str_c_subtree()
+	int get_c_subtree_label_number() {
+		int min = get_label_number();
+		list<Node *>::iterator c;
+		for(c = children.begin(); c != children.end(); c++) {
+			int n = (*c)->get_c_subtree_label_number();
+			if (n < min)
+				min = n;
+		}
+		return min;
+	}
+
+	// the numbers of the labels in str_c_subtree()
+	void find_label_numbers(vector<int> *numbers) {
+		if (name_number < INT_MAX)
+			numbers->push_back(name_number);
+		if (contracted_lc != NULL)
+			contracted_lc->find_label_numbers(numbers);
+		for (auto c = contracted_children.begin(); c != contracted_children.end(); c++)
+			(*c)->find_label_numbers(numbers);
+		if (contracted_rc != NULL)
+			contracted_rc->find_label_numbers(numbers);
+		list<Node *>::iterator c;
+		for(c = children.begin(); c != children.end(); c++)
+			(*c)->find_label_numbers(numbers);
+	}
+
+	// true if str() == "p"
+	bool is_rho() {
+		return name.size() == 1 && name[0] == 'p' && contracted_lc == NULL
+				&& contracted_rc == NULL && contracted_children.empty();
+	}
   
 	void str_hlpr(string *s) {
 		if (!name.empty())
@@ -1873,7 +2104,7 @@ class Node {
 	}
 
 	bool contains_leaf(int number) {
-		if (stomini(get_name()) == number)
+		if (name_number == number)
 			return true;
 		list<Node *>::iterator c;
 		for(c = children.begin(); c != children.end(); c++) {
@@ -1969,14 +2200,14 @@ class Node {
 			stringstream ss;
 			if (i != label_map->end()) {
 				ss << i->second;
-				name = ss.str();
+				set_name(ss.str());
 			}
 			else {
 				int num = label_map->size();
 				ss << num;
 				label_map->insert(make_pair(name, num));
 				reverse_label_map->insert(make_pair(num, name));
-				name = ss.str();
+				set_name(ss.str());
 			}
 		}
 		list<Node *>::iterator c;
@@ -2018,7 +2249,7 @@ class Node {
 				old_loc = loc;
 			}
 			converted_name.append(name.substr(old_loc, name.size() - old_loc)); 
-			name = converted_name;
+			set_name(converted_name);
 
 
 
@@ -2048,7 +2279,7 @@ class Node {
 
 	void count_numbered_labels(vector<int> *label_counts) {
 		if (name != "") {
-			int label = stomini(name);
+			int label = name_number;
 			if (label_counts->size() <= label)
 				label_counts->resize(label+1,0);
 			(*label_counts)[label]++;
@@ -2097,6 +2328,26 @@ class Node {
 		return next;
 	}
 
+	/* renumber
+	 * set_depth(0), fix_depths() and preorder_number() in one traversal,
+	 * for trees that are rerooted many times
+	 */
+	void renumber() {
+		depth = 0;
+		renumber(0);
+	}
+
+	int renumber(int next) {
+		pre_num = next;
+		next++;
+		list<Node *>::iterator c;
+		for(c = children.begin(); c != children.end(); c++) {
+			(*c)->depth = depth + 1;
+			next = (*c)->renumber(next);
+		}
+		return next;
+	}
+
 	void edge_preorder_interval() {
 		edge_pre_start = pre_num;
 		if (is_leaf()) {
@@ -2376,9 +2627,7 @@ void reroot(Node *new_lc) {
 
 void reroot_clean(Node *new_lc) {
 	this->reroot(new_lc);
-	this->set_depth(0);
-	this->fix_depths();
-	this->preorder_number();
+	this->renumber();
 	this->edge_preorder_interval();
 }
 
@@ -2437,7 +2686,7 @@ Node *expand_parent_edge(Node *n) {
 		new_child->contracted_rc = contracted_rc;
 		if (contracted_rc != NULL)
 		contracted_rc->p = new_child;
-		name = "";
+		set_name("");
 		contracted_lc = NULL;
 		contracted_rc = NULL;
 		add_child(new_child);
@@ -2457,6 +2706,7 @@ Node *undo_expand_parent_edge() {
 	else {
 		Node *child = children.front();
 		name = child->name;
+		name_number = child->name_number;
 		Node *new_lc = child->lchild();
 		Node *new_rc = child->rchild();
 		new_lc->cut_parent();
@@ -2469,7 +2719,7 @@ Node *undo_expand_parent_edge() {
 			contracted_rc->p = this;
 		child->contracted_lc = NULL;
 		child->contracted_rc = NULL;
-		child->name = "";
+		child->set_name("");
 		add_child(new_lc);
 		add_child(new_rc);
 		return child;
@@ -2801,12 +3051,14 @@ Node *build_tree(string s);
 Node *build_tree(string s, set<string, StringCompare> *include_only);
 Node *build_tree(string s, int start_depth);
 Node *build_tree(string s, int start_depth, set<string, StringCompare> *include_only);
-
-int build_tree_helper(int start, const string& s, Node *parent,
-		bool &valid, set<string, StringCompare> *include_only);
+Node *build_tree(const char *s, size_t len, int start_depth,
+		set<string, StringCompare> *include_only,
+		map<string, int> *label_map, map<int, string> *reverse_label_map);
 //void preorder_number(Node *node);
 //int preorder_number(Node *node, int next);
 string strip_newick_name(string &T);
+Node *read_tree(char *line, size_t length, bool unrooted, string *name,
+		map<string, int> *label_map, map<int, string> *reverse_label_map);
 vector<Node *> contract_deepest_siblings(vector<vector<Node *>> &siblings_by_depth);
 
 
@@ -2821,85 +3073,124 @@ Node *build_tree(string s, set<string, StringCompare> *include_only) {
 	return build_tree(s, 0, include_only);
 }
 Node *build_tree(string s, int start_depth, set<string, StringCompare> *include_only) {
-	if (s == "")
-		return new Node();
-	Node *dummy_head = new Node("p", start_depth-1);
-	bool valid = true;
-	build_tree_helper(0, s, dummy_head, valid, include_only);
-	Node *head = dummy_head->lchild();
-	if (valid && head != NULL) {
-		delete dummy_head;
-		return head;
+	return build_tree(s.c_str(), s.size(), start_depth, include_only, NULL,
+			NULL);
+}
+
+// replace a label with its number, adding new labels to the maps
+void intern_label(string &name, map<string, int> *label_map,
+		map<int, string> *reverse_label_map) {
+	map<string, int>::iterator i = label_map->find(name);
+	if (i != label_map->end()) {
+		name = to_string(i->second);
 	}
 	else {
-		if (head != NULL)
-			head->delete_tree();
-		return dummy_head;
+		int num = label_map->size();
+		label_map->insert(make_pair(name, num));
+		reverse_label_map->insert(make_pair(num, name));
+		name = to_string(num);
 	}
+}
 
+// create a node for the label s[start,end) unless it is excluded
+Node *build_tree_node(const char *s, int start, int end, Node *parent,
+		set<string, StringCompare> *include_only,
+		map<string, int> *label_map, map<int, string> *reverse_label_map) {
+	int name_end = start;
+	while (name_end < end && s[name_end] != ':')
+		name_end++;
+	string name = string(s + start, name_end - start);
+	if (include_only != NULL &&
+			include_only->find(name) == include_only->end())
+		return NULL;
+	if (label_map != NULL && name != "")
+		intern_label(name, label_map, reverse_label_map);
+	Node *node = new Node(name);
+	parent->add_child(node);
+	return node;
 }
 
-// build_tree recursive helper function
-int build_tree_helper(int start, const string& s, Node *parent,
-		bool &valid, set<string, StringCompare> *include_only) {
-	int loc = s.find_first_of("(,)", start);
-	if (loc == string::npos) {
-		string name = s.substr(start, s.size() - start);
-		int name_end = name.find(':');
-		if (name_end != string::npos)
-			name = name.substr(0, name_end);
-		if (include_only == NULL ||
-				include_only->find(name) != include_only->end()) {
-			Node *node = new Node(name);
-			parent->add_child(node);
-		}
-		loc = s.size()-1;
-		return loc;
-	}
-	while(s[start] == ' ' || s[start] == '\t')
-		start++;
-	int end = loc;
-	while(s[end] == ' ' || s[end] == '\t')
-		end--;
-	string name = s.substr(start, end - start);
-	int name_end = name.find(':');
-	if (name_end != string::npos)
-		name = name.substr(0, name_end);
-	Node *node = NULL;
-	if (include_only == NULL ||
-			include_only->find(name) != include_only->end()) {
-		node = new Node(name);
-		parent->add_child(node);
-	}
-
-	int count = 1;
-	if (s[loc] == '(') {
-			loc = build_tree_helper(loc + 1, s, node, valid, include_only);
-			while(s[loc] == ',') {
-				loc = build_tree_helper(loc + 1, s, node, valid, include_only);
-				count++;
+// position of the first character of chars in s[start,len), -1 if none
+inline int newick_find(const char *s, size_t len, int start,
+		const char *chars) {
+	for(int i = start; i < len; i++) {
+		for(const char *c = chars; *c != '\0'; c++) {
+			if (s[i] == *c)
+				return i;
+		}
+	}
+	return -1;
+}
+
+/* build_tree
+ * Build a tree from the newick string s[0,len) without recursion or
+ * copying the string. s[len] must be readable and not part of a label
+ * (e.g. the string's terminating null). If label_map is given then
+ * labels are replaced by their numbers as they are read, as
+ * labels_to_numbers would
+ */
+Node *build_tree(const char *s, size_t len, int start_depth,
+		set<string, StringCompare> *include_only,
+		map<string, int> *label_map, map<int, string> *reverse_label_map) {
+	if (len == 0)
+		return new Node();
+	Node *dummy_head = new Node("p", start_depth-1);
+	bool valid = true;
+	// internal nodes whose children are being read
+	vector<Node *> nodes = vector<Node *>();
+	vector<int> counts = vector<int>();
+	vector<bool> unnamed = vector<bool>();
+	Node *parent = dummy_head;
+	int start = 0;
+	int loc;
+	while(true) {
+		// read a node starting at start
+		loc = newick_find(s, len, start, "(,)");
+		if (loc == -1) {
+			build_tree_node(s, start, len, parent, include_only, label_map,
+					reverse_label_map);
+			loc = len-1;
+		}
+		else {
+			while(s[start] == ' ' || s[start] == '\t')
+				start++;
+			Node *node = build_tree_node(s, start, loc, parent, include_only,
+					label_map, reverse_label_map);
+			if (s[loc] == '(') {
+				nodes.push_back(node);
+				counts.push_back(1);
+				unnamed.push_back(loc == start || s[start] == ':');
+				parent = node;
+				start = loc + 1;
+				continue;
+			}
+		}
+		// the node is finished, continue with its parent
+		while(!nodes.empty()) {
+			Node *node = nodes.back();
+			if (s[loc] == ',') {
+				counts.back()++;
+				break;
 			}
-//			int loc_check = s.find_first_of("(,)", loc);
-//			if (loc_check != string::npos &&
-//					s[loc_check] == ','
 			if (s[loc] != ')'
-					|| (IGNORE_MULTI && count > 2)) {
+					|| (IGNORE_MULTI && counts.back() > 2)) {
 				valid = false;
-					return s.size()-1;
+				loc = len-1;
 			}
-			// TODO: get the support values here (and branch lengths?)
-			// contract_node() if support is less than a threshold
-			loc++;
-			if (s[loc-1] == ')') {
+			else {
+				// TODO: get the support values here (and branch lengths?)
+				// contract_node() if support is less than a threshold
+				loc++;
 				int numc = node->get_children().size();
 				bool contracted = false;
-				int next = s.find_first_of(",)", loc);
-				if (next != string::npos) {
+				int next = newick_find(s, len, loc, ",)");
+				if (next != -1) {
 					if (next > loc && (REQUIRED_SUPPORT > 0 || MIN_LENGTH >= 0)) {
-						string info = s.substr(loc, next - loc);
+						const char *info = s + loc;
+						const char *info_end = s + next;
 						// support values (a number after a close bracket)
 						if (info[0] != ':') {
-							double support = atof(info.c_str()) / SUPPORT_BY_VALUE;
+							double support = atof(info) / SUPPORT_BY_VALUE;
 							#if DEBUG_SUPPORT
 							cout << "support=" << support << endl;
 							#endif
@@ -2912,10 +3203,9 @@ int build_tree_helper(int start, const string& s, Node *parent,
 							}
 						}
 						// branch lengths (a number after a colon)
-						int next_colon = info.find_first_of(":");
-						if (next_colon != string::npos) {
-							string length_str = info.substr(next_colon+1);
-							double length = atof(length_str.c_str());
+						const char *next_colon = find(info, info_end, ':');
+						if (next_colon != info_end) {
+							double length = atof(next_colon + 1);
 #if DEBUG_SUPPORT
 							cout << "length=" << length << endl;
 							#endif
@@ -2928,10 +3218,9 @@ int build_tree_helper(int start, const string& s, Node *parent,
 							}
 						}
 						// support values (a number in square brackets)
-						int square_bracket = info.find_first_of("[");
-						if (square_bracket != string::npos) {
-							string support_str = info.substr(square_bracket+1);
-							double support = atof(support_str.c_str()) / 100.0;
+						const char *square_bracket = find(info, info_end, '[');
+						if (square_bracket != info_end) {
+							double support = atof(square_bracket + 1) / 100.0;
 							#if DEBUG_SUPPORT
 							cout << "support=" << support << endl;
 							#endif
@@ -2950,14 +3239,31 @@ int build_tree_helper(int start, const string& s, Node *parent,
 				if (!contracted) {
 					if (numc == 1)
 						node->contract_node();
-					else if (numc == 0 && name == "") {
+					else if (numc == 0 && unnamed.back()) {
 						node->cut_parent();
 						delete node;
 					}
 				}
 			}
+			nodes.pop_back();
+			counts.pop_back();
+			unnamed.pop_back();
+		}
+		if (nodes.empty())
+			break;
+		parent = nodes.back();
+		start = loc + 1;
+	}
+	Node *head = dummy_head->lchild();
+	if (valid && head != NULL) {
+		delete dummy_head;
+		return head;
+	}
+	else {
+		if (head != NULL)
+			head->delete_tree();
+		return dummy_head;
 	}
-	return loc;
 }
 
 // swap two nodes
@@ -2986,30 +3292,22 @@ int preorder_number(Node *node, int next) {
 */
 // return the smallest number in s
 
-int stomini(string s) {
-//	cout << "stomini" << endl;
-	string number_characters = "+-0123456789";
-	int i = 0;
+int stomini(const string &s) {
 	int min = INT_MAX;
-	string current = "";
-	for(int i = 0; i < s.size(); i++) {
-		if (number_characters.find(s[i]) != string::npos) {
-			current += s[i];
-		}
-		else if (current.size() > 0) {
-			int num = atoi(current.c_str());
+	const char *c = s.c_str();
+	int i = 0;
+	while (i < s.size()) {
+		if (isdigit(c[i]) || c[i] == '+' || c[i] == '-') {
+			// atoi stops at the end of the run of number characters
+			int num = atoi(c + i);
 			if (num < min)
 				min = num;
-			current = "";
+			while (i < s.size() && (isdigit(c[i]) || c[i] == '+' || c[i] == '-'))
+				i++;
 		}
+		else
+			i++;
 	}
-	if (current.size() > 0) {
-		int num = atoi(current.c_str());
-		if (num < min)
-			min = num;
-		current = "";
-	}
-//	cout << "returning " << min << endl;
 	return min;
 }
 
@@ -3074,6 +3372,26 @@ template <typename T> void print_vector(vector <T> V) {
 	cout << endl;
 }
 
+/* read_tree
+ * Build the tree on a line of input, which may start with a name for the
+ * tree, numbering its labels with label_map. Unrooted trees are rooted
+ * first (see root). Returns NULL if the line has no tree
+ */
+Node *read_tree(char *line, size_t length, bool unrooted, string *name,
+		map<string, int> *label_map, map<int, string> *reverse_label_map) {
+	char *tree = (char *)memchr(line, '(', length);
+	if (tree == NULL)
+		return NULL;
+	*name = string(line, tree - line);
+	length -= tree - line;
+	if (unrooted) {
+		string rooted = root(string(tree, length));
+		return build_tree(rooted.c_str(), rooted.size(), 0, NULL, label_map,
+				reverse_label_map);
+	}
+	return build_tree(tree, length, 0, NULL, label_map, reverse_label_map);
+}
+
 string strip_newick_name(string &line) {
 	string name;
 	size_t loc = line.find_first_of("(");
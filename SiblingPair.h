@@ -34,6 +34,7 @@ along with rspr.  If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include <sstream>
 #include <set>
+#include <vector>
 #include "Node.h"
 
 using namespace std;
@@ -66,9 +67,149 @@ class SiblingPair {
 	}
 };
 
+/* SiblingPairSet
+ * Sibling pairs ordered by key, with at most one pair per key like a
+ * set<SiblingPair>. Keys are preorder numbers so the pairs are stored
+ * in an array indexed by key with a bitmap of the used keys. Insert and
+ * erase are constant time and the next pair is found by scanning the
+ * bitmap a word at a time. The arrays grow as needed and are not shrunk
+ */
+class SiblingPairSet {
+	private:
+	vector<SiblingPair> pairs;
+	vector<unsigned long long> used;
+	int num_pairs;
+
+	// unnumbered nodes have key -1
+	static inline int slot(int key) {
+		return key + 1;
+	}
+
+	void reserve_slot(int s) {
+		if (s >= pairs.size()) {
+			int new_size = (s / 64 + 1) * 64;
+			if (new_size < pairs.size() * 2)
+				new_size = pairs.size() * 2;
+			pairs.resize(new_size);
+			used.resize(new_size / 64, 0);
+		}
+	}
+
+	public:
+	class iterator {
+		public:
+		SiblingPairSet *owner;
+		int s;
+
+		iterator() {
+			owner = NULL;
+			s = -1;
+		}
+		iterator(SiblingPairSet *o, int slot) {
+			owner = o;
+			s = slot;
+		}
+		SiblingPair &operator*() const {
+			return owner->pairs[s];
+		}
+		SiblingPair *operator->() const {
+			return &owner->pairs[s];
+		}
+		iterator &operator++() {
+			s = owner->next_slot(s + 1);
+			return *this;
+		}
+		iterator operator++(int) {
+			iterator old = *this;
+			s = owner->next_slot(s + 1);
+			return old;
+		}
+		bool operator==(const iterator &i) const {
+			return s == i.s;
+		}
+		bool operator!=(const iterator &i) const {
+			return s != i.s;
+		}
+	};
+
+	SiblingPairSet() {
+		num_pairs = 0;
+	}
+
+	// first used slot at or after s, -1 if none
+	int next_slot(int s) {
+		int w = s / 64;
+		if (w >= used.size())
+			return -1;
+		unsigned long long bits = used[w] & (~0ULL << (s % 64));
+		while (bits == 0) {
+			w++;
+			if (w >= used.size())
+				return -1;
+			bits = used[w];
+		}
+		return w * 64 + __builtin_ctzll(bits);
+	}
+
+	iterator begin() {
+		if (num_pairs == 0)
+			return end();
+		return iterator(this, next_slot(0));
+	}
+
+	iterator end() {
+		return iterator(this, -1);
+	}
+
+	iterator find(const SiblingPair &sp) {
+		int s = slot(sp.key);
+		if (s < pairs.size() && (used[s / 64] >> (s % 64)) & 1)
+			return iterator(this, s);
+		return end();
+	}
+
+	pair<iterator, bool> insert(const SiblingPair &sp) {
+		int s = slot(sp.key);
+		reserve_slot(s);
+		if ((used[s / 64] >> (s % 64)) & 1)
+			return make_pair(iterator(this, s), false);
+		used[s / 64] |= 1ULL << (s % 64);
+		pairs[s] = sp;
+		num_pairs++;
+		return make_pair(iterator(this, s), true);
+	}
+
+	void erase(iterator i) {
+		used[i.s / 64] &= ~(1ULL << (i.s % 64));
+		num_pairs--;
+	}
+
+	int erase(const SiblingPair &sp) {
+		iterator i = find(sp);
+		if (i == end())
+			return 0;
+		erase(i);
+		return 1;
+	}
+
+	bool empty() {
+		return num_pairs == 0;
+	}
+
+	int size() {
+		return num_pairs;
+	}
+
+	void clear() {
+		for(int w = 0; w < used.size(); w++)
+			used[w] = 0;
+		num_pairs = 0;
+	}
+};
+
 	// TODO: binary only
 	void find_sibling_pairs_set_hlpr(Node *n,
-			set<SiblingPair> *sibling_pairs) {
+			SiblingPairSet *sibling_pairs) {
 		Node *lchild = n->lchild();
 		Node *rchild = n->rchild();
 		bool lchild_leaf = false;
@@ -93,20 +234,20 @@ class SiblingPair {
 	}
 	
 	// find the sibling pairs in this node's subtree
-	void append_sibling_pairs_set(Node *n,set<SiblingPair> *sibling_pairs) {
+	void append_sibling_pairs_set(Node *n,SiblingPairSet *sibling_pairs) {
 		find_sibling_pairs_set_hlpr(n,sibling_pairs);
 	}
 
 	// find the sibling pairs in this node's subtree
-	set<SiblingPair> *find_sibling_pairs_set(Node *n) {
-		set<SiblingPair> *sibling_pairs = new set<SiblingPair>();
+	SiblingPairSet *find_sibling_pairs_set(Node *n) {
+		SiblingPairSet *sibling_pairs = new SiblingPairSet();
 		find_sibling_pairs_set_hlpr(n,sibling_pairs);
 		return sibling_pairs;
 	}
 
 	// return a set of the sibling pairs
-	set<SiblingPair> *find_sibling_pairs_set(Forest *f) {
-		set<SiblingPair> *sibling_pairs = new set<SiblingPair>();
+	SiblingPairSet *find_sibling_pairs_set(Forest *f) {
+		SiblingPairSet *sibling_pairs = new SiblingPairSet();
 		for(int i = 0; i < f->num_components(); i++) {
 			Node *component = f->get_component(i);
 			append_sibling_pairs_set(component,sibling_pairs);
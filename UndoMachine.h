@@ -31,58 +31,114 @@ along with rspr.  If not, see <http://www.gnu.org/licenses/>.
 #include "Node.h"
 #include "Forest.h"
 #include <list>
-#include <typeinfo>
+#include <vector>
+#include <string>
 
 
 class Node;
 
-class Undoable {
+enum UndoType {
+	UNDO_ADD_RHO,
+	UNDO_ADD_COMPONENT,
+	UNDO_ADD_COMPONENT_TO_FRONT,
+	UNDO_CUT_PARENT,
+	UNDO_CLEAR_SIBLING_PAIR,
+	UNDO_POP_SIBLING_PAIR,
+	UNDO_CONTRACT_SIBLING_PAIR,
+	UNDO_ADD_TO_FRONT_SIBLING_PAIRS,
+	UNDO_ADD_TO_SIBLING_PAIRS,
+	UNDO_ADD_TO_SET_SIBLING_PAIRS,
+	UNDO_REMOVE_SET_SIBLING_PAIRS,
+	UNDO_ADD_IN_SIBLING_PAIRS,
+	UNDO_SET_TWIN,
+	UNDO_CHANGE_NAME,
+	UNDO_CHANGE_EDGE_PRE_INTERVAL,
+	UNDO_CHANGE_PRE_NUM,
+	UNDO_CHANGE_RIGHT_CHILD,
+	UNDO_CHANGE_LEFT_CHILD,
+	UNDO_ADD_CHILD,
+	UNDO_ADD_CONTRACTED_LC,
+	UNDO_ADD_CONTRACTED_RC,
+	UNDO_CREATE_NODE,
+	UNDO_PROTECT_EDGE,
+	UNDO_UNPROTECT_EDGE,
+	UNDO_LIST_PUSH_BACK,
+	UNDO_LIST_POP_BACK
+};
+
+/* UndoEvent
+ * A plain record of one alteration. The classes below fill in the
+ * fields for each type of event and UndoMachine::undo() replays them
+ */
+class UndoEvent {
+	public:
+	UndoType type;
+	Node *n1;
+	Node *n2;
+	void *target;	// the forest, list or set that was changed
+	int v1;
+	int v2;
+	int v3;
+	int v4;
+};
+
+/* UndoLog
+ * The events of all UndoMachines of a thread. UndoMachines are nested
+ * like the recursion that creates them, so each one owns the top of the
+ * log above the point where it was created. The buffers are kept and
+ * reused for the whole search
+ */
+class UndoLog {
 	public:
-	virtual ~Undoable() {}
-	virtual void undo() = 0;
+	vector<UndoEvent> events;
+	vector<string> names;	// old names of ChangeName events
 };
 
+UndoLog *UNDO_LOG = NULL;
+#pragma omp threadprivate(UNDO_LOG)
+
 class UndoMachine {
 	public:
-	list<Undoable *> events;
-	int size;
+	UndoLog *log;
+	int base;
 
 	UndoMachine() {
-		events = list<Undoable *>();
-		size = 0;
+		if (UNDO_LOG == NULL)
+			UNDO_LOG = new UndoLog();
+		log = UNDO_LOG;
+		base = log->events.size();
 	}
 
-	void add_event(Undoable *event) {
-		events.push_back(event);
-		size++;
+	// drop any events left by an early return without undoing them
+	~UndoMachine() {
+		clear_to(0);
 	}
 
-	void insert_event(list<Undoable *>::iterator i, Undoable *event) {
-		list<Undoable *>::iterator j = i;
-		j++;
-		events.insert(j, event);
-		size++;
+	void add_event(const UndoEvent &event) {
+		log->events.push_back(event);
+		if (event.type == UNDO_CHANGE_NAME) {
+			log->events.back().v1 = log->names.size();
+			log->names.push_back(event.n1->get_name());
+		}
 	}
 
-	 list<Undoable *>::iterator get_bookmark() {
-		 list<Undoable *>::iterator bookmark = events.end();
-		 if (size > 0)
-		 	bookmark--;
-		 else
-			 bookmark = events.begin();
-		 return bookmark;
-	 }
+	// insert an event at a bookmark (must not be a ChangeName)
+	void insert_event(int bookmark, const UndoEvent &event) {
+		log->events.insert(log->events.begin() + base + bookmark, event);
+	}
+
+	int get_bookmark() {
+		return num_events();
+	}
 
 	void undo() {
-		if (!events.empty()) {
-			Undoable *event = events.back();
+		if (log->events.size() > base) {
+			UndoEvent e = log->events.back();
 #ifdef DEBUG_UNDO
-			cout << typeid(*event).name() << endl;
+			cout << e.type << endl;
 #endif
-			events.pop_back();
-			event->undo();
-			delete event;
-			size--;
+			log->events.pop_back();
+			undo_event(e);
 		}
 	}
 
@@ -99,540 +155,505 @@ class UndoMachine {
 	}
 
 	void undo_to(int to) {
-		while (size > to)
+		while (num_events() > to)
 			undo();
 	}
 
 	void clear_to(int to) {
-		while (size > to) {
-			Undoable *event = events.back();
-			events.pop_back();
-			delete event;
-			size--;
+		while (num_events() > to) {
+			if (log->events.back().type == UNDO_CHANGE_NAME)
+				log->names.resize(log->events.back().v1);
+			log->events.pop_back();
 		}
-
 	}
 
 	int num_events() {
-		return size;
+		return log->events.size() - base;
 	}
+
+	void undo_event(UndoEvent &e);
 };
 
 void ContractEvent(UndoMachine *um, Node *n);
 
-class AddRho : public Undoable {
+class AddRho : public UndoEvent {
 	public:
-	Forest *F;
 	AddRho(Forest *f) {
-		F = f;
-	}
-	void undo() {
-		F->set_rho(false);
-		F->get_component(F->num_components()-1)->delete_tree();
-		F->erase_components(F->num_components()-1,F->num_components());
+		type = UNDO_ADD_RHO;
+		target = f;
 	}
 };
 
-class AddComponent : public Undoable {
+class AddComponent : public UndoEvent {
 	public:
-	Forest *F;
 	AddComponent(Forest *f) {
-		F = f;
-	}
-	void undo() {
-		F->erase_components(F->num_components()-1,F->num_components());
+		type = UNDO_ADD_COMPONENT;
+		target = f;
 	}
 };
 
-class AddComponentToFront : public Undoable {
+class AddComponentToFront : public UndoEvent {
 	public:
-	Forest *F;
 	AddComponentToFront(Forest *f) {
-		F = f;
-	}
-	void undo() {
-		F->erase_components(0,1);
+		type = UNDO_ADD_COMPONENT_TO_FRONT;
+		target = f;
 	}
 };
 
 // TODO: use new insert_child function with a stored successor sibling
 // does the end work? maybe a seperate variable for that?
-class CutParent : public Undoable {
+// n1 = child, n2 = parent, v1 = branch, v2 = depth
+class CutParent : public UndoEvent {
 	public:
-	Node *child;
-	Node *parent;
-	int branch;
-	int depth;
 	CutParent(Node *c) {
-		child = c;
-		parent = c->parent();
-		branch = 0;
-		depth = c->get_depth();
-		if (parent != NULL) {
-			if (parent->lchild() == child)
-				branch = 1;
-			else
-				branch = 2;
-		}
-	}
-
-	void undo() {
-		if (branch == 1) {
-			if (parent->is_leaf())
-				parent->add_child(child);
+		type = UNDO_CUT_PARENT;
+		n1 = c;
+		n2 = c->parent();
+		v1 = 0;
+		v2 = c->get_depth();
+		if (n2 != NULL) {
+			if (n2->lchild() == c)
+				v1 = 1;
 			else
-				parent->insert_child(parent->get_children().front(), child);
+				v1 = 2;
 		}
-		else if (branch == 2)
-			parent->add_child(child);
-		child->set_depth(depth);
 	}
 };
 
-class ClearSiblingPair : public Undoable {
+// n1 = a, n2 = c, v1 = a_status, v2 = c_status
+class ClearSiblingPair : public UndoEvent {
 	public:
-		Node *a;
-		Node *c;
-		int a_status;
-		int c_status;
 		ClearSiblingPair(Node *x, Node *y) {
+			type = UNDO_CLEAR_SIBLING_PAIR;
 			if (x->get_sibling_pair_status() == 1 ||
 					y->get_sibling_pair_status() == 2) {
-				a = x;
-				c = y;
+				n1 = x;
+				n2 = y;
 			}
 			else {
-				a = y;
-				c = x;
+				n1 = y;
+				n2 = x;
 			}
-			a_status = a->get_sibling_pair_status();
-			c_status = c->get_sibling_pair_status();
-		}
-
-		void undo() {
-			a->set_sibling_pair_status(1);
-			c->set_sibling_pair_status(2);
-			if (a_status == 0) {
-				c->set_sibling(a);
-			}
-			else if (c_status == 0) {
-				a->set_sibling(c);
-			}
-
+			v1 = n1->get_sibling_pair_status();
+			v2 = n2->get_sibling_pair_status();
 		}
 };
 
-class PopClearedSiblingPair : public Undoable {
+class PopClearedSiblingPair : public UndoEvent {
 	public:
-		Node *a;
-		Node *c;
-		int a_status;
-		int c_status;
-
-		list<Node *> *sibling_pairs;
 		PopClearedSiblingPair(Node *x, Node *y, list<Node *> *s) {
-			sibling_pairs = s;
-			a = x;
-			c = y;
-		}
-
-		void undo() {
-			sibling_pairs->push_back(c);
-			sibling_pairs->push_back(a);
+			type = UNDO_POP_SIBLING_PAIR;
+			target = s;
+			n1 = x;
+			n2 = y;
 		}
 };
 
-class PopSiblingPair : public Undoable {
+class PopSiblingPair : public UndoEvent {
 	public:
-		Node *a;
-		Node *c;
-		list<Node *> *sibling_pairs;
 		PopSiblingPair(Node *x, Node *y, list<Node *> *s) {
-			sibling_pairs = s;
-				a = x;
-				c = y;
-		}
-
-		void undo() {
-			sibling_pairs->push_back(c);
-			sibling_pairs->push_back(a);
+			type = UNDO_POP_SIBLING_PAIR;
+			target = s;
+			n1 = x;
+			n2 = y;
 		}
 };
 
-class ContractSiblingPair : public Undoable {
+// n1 = node, v1 = c1_depth, v2 = c2_depth, v3 = binary_node,
+// v4 = node_protected
+class ContractSiblingPair : public UndoEvent {
 	public:
-		Node *node;
-		int c1_depth;
-		int c2_depth;
-		bool binary_node;
-		bool node_protected;
 		ContractSiblingPair(Node *n) {
 			init(n);
-			if (n->is_protected())
-				node_protected = true;
-			else
-				node_protected = false;
+			v4 = n->is_protected();
 		}
 		ContractSiblingPair(Node *n, Node *child1, Node *child2,
 				UndoMachine *um) {
 			if (n->get_children().size() == 2)
 				init(n);
 			else {
-				um->add_event(new CutParent(child1));
-				um->add_event(new CutParent(child2));
-				binary_node = false;
-				node = n;
+				um->add_event(CutParent(child1));
+				um->add_event(CutParent(child2));
+				type = UNDO_CONTRACT_SIBLING_PAIR;
+				v3 = false;
+				n1 = n;
 			}
-			if (n->is_protected())
-				node_protected = true;
-			else
-				node_protected = false;
+			v4 = n->is_protected();
 		}
 
 		void init(Node *n) {
-			node = n;
+			type = UNDO_CONTRACT_SIBLING_PAIR;
+			n1 = n;
 			if (n->lchild() != NULL)
-				c1_depth = n->lchild()->get_depth();
+				v1 = n->lchild()->get_depth();
 			else
-				c1_depth = -1;
+				v1 = -1;
 			if (n->rchild() != NULL)
-				c2_depth = n->rchild()->get_depth();
+				v2 = n->rchild()->get_depth();
 			else
-				c2_depth = -1;
-			binary_node = true;
-		}
-
-		void undo() {
-			if (binary_node) {
-				node->undo_contract_sibling_pair();
-				if (c1_depth > -1)
-					node->lchild()->set_depth(c1_depth);
-				if (c2_depth > -1)
-					node->rchild()->set_depth(c2_depth);
-			}
-			if (node_protected)
-				node->protect_edge();
+				v2 = -1;
+			v3 = true;
 		}
 };
 
-class AddToFrontSiblingPairs : public Undoable {
+class AddToFrontSiblingPairs : public UndoEvent {
 	public:
-		list<Node *> *sibling_pairs;
 		AddToFrontSiblingPairs(list<Node *> *s) {
-			sibling_pairs = s;
-		}
-		void undo() {
-			if (!sibling_pairs->empty()) {
-				sibling_pairs->pop_front();
-				sibling_pairs->pop_front();
-			}
+			type = UNDO_ADD_TO_FRONT_SIBLING_PAIRS;
+			target = s;
 		}
 };
 
-class AddToSiblingPairs : public Undoable {
+class AddToSiblingPairs : public UndoEvent {
 	public:
-		list<Node *> *sibling_pairs;
 		AddToSiblingPairs(list<Node *> *s) {
-			sibling_pairs = s;
-		}
-		void undo() {
-			if (!sibling_pairs->empty()) {
-				sibling_pairs->pop_back();
-				sibling_pairs->pop_back();
-			}
+			type = UNDO_ADD_TO_SIBLING_PAIRS;
+			target = s;
 		}
 };
 
-class AddToSetSiblingPairs : public Undoable {
+// n1 = a, n2 = c, v1 = key, v2 = key2
+class AddToSetSiblingPairs : public UndoEvent {
 	public:
-		set<SiblingPair> *sibling_pairs;
-		SiblingPair pair;
-		AddToSetSiblingPairs(set<SiblingPair> *sp, SiblingPair p) {
-			sibling_pairs = sp;
-			//pair = SiblingPair(p->a,p->c);
-			pair = p;
-		}
-		void undo() {
-			if (!sibling_pairs->empty()) {
-				sibling_pairs->erase(pair);
-			}
+		AddToSetSiblingPairs(SiblingPairSet *sp, SiblingPair p) {
+			type = UNDO_ADD_TO_SET_SIBLING_PAIRS;
+			target = sp;
+			n1 = p.a;
+			n2 = p.c;
+			v1 = p.key;
+			v2 = p.key2;
 		}
 };
 
-class RemoveSetSiblingPairs : public Undoable {
+class RemoveSetSiblingPairs : public UndoEvent {
 	public:
-		set<SiblingPair> *sibling_pairs;
-		SiblingPair pair;
-		RemoveSetSiblingPairs(set<SiblingPair> *sp, SiblingPair p) {
-			sibling_pairs = sp;
-			pair = p;
-		}
-		void undo() {
-			sibling_pairs->insert(pair);
+		RemoveSetSiblingPairs(SiblingPairSet *sp, SiblingPair p) {
+			type = UNDO_REMOVE_SET_SIBLING_PAIRS;
+			target = sp;
+			n1 = p.a;
+			n2 = p.c;
+			v1 = p.key;
+			v2 = p.key2;
 		}
 };
 
-class AddInSiblingPairs : public Undoable {
+// v1 = pos
+class AddInSiblingPairs : public UndoEvent {
 	public:
-		list<Node *> *sibling_pairs;
-		int pos;
 		AddInSiblingPairs(list<Node *> *s, int p) {
-			sibling_pairs = s;
-			pos = p;
-		}
-		void undo() {
-			if (!sibling_pairs->empty()) {
-				list<Node *>::iterator c = sibling_pairs->begin();
-				for(int i = 0; i <= pos && c != sibling_pairs->end(); i++) {
-					c++;
-				}
-				if (c != sibling_pairs->end()) {
-					list<Node *>::iterator rem = c;
-					c++;
-					sibling_pairs->erase(rem);
-					rem = c;
-					c++;
-					sibling_pairs->erase(rem);
-				}
-			}
+			type = UNDO_ADD_IN_SIBLING_PAIRS;
+			target = s;
+			v1 = p;
 		}
 };
 
-class SetTwin : public Undoable {
+// n1 = node, n2 = twin
+class SetTwin : public UndoEvent {
 	public:
-		Node *node;
-		Node *twin;
-
 		SetTwin(Node *n) {
-			node = n;
-			twin = n->get_twin();
-		}
-
-		void undo() {
-			node->set_twin(twin);
+			type = UNDO_SET_TWIN;
+			n1 = n;
+			n2 = n->get_twin();
 		}
 };
 
-class ChangeName : public Undoable {
+// the old name is kept by the UndoLog
+class ChangeName : public UndoEvent {
 	public:
-		Node *node;
-		string name;
-
 		ChangeName(Node *n) {
-			node = n;
-			name = string(n->get_name());
-		}
-
-		void undo() {
-			node->set_name(name);
+			type = UNDO_CHANGE_NAME;
+			n1 = n;
 		}
 };
 
-class ChangeEdgePreInterval : public Undoable {
+// v1 = start, v2 = end
+class ChangeEdgePreInterval : public UndoEvent {
 	public:
-		Node *node;
-		int start;
-		int end;
-
 		ChangeEdgePreInterval(Node *n) {
-			start = n->get_edge_pre_start();
-			end = n->get_edge_pre_end();
-			node = n;
-		}
-
-		void undo() {
-			node->set_edge_pre_start(start);
-			node->set_edge_pre_end(end);
+			type = UNDO_CHANGE_EDGE_PRE_INTERVAL;
+			n1 = n;
+			v1 = n->get_edge_pre_start();
+			v2 = n->get_edge_pre_end();
 		}
 };
 
-class ChangePreNum : public Undoable {
+class ChangePreNum : public UndoEvent {
 	public:
-		Node *node;
-		int prenum;
-
 		ChangePreNum(Node *n) {
-			prenum = n->get_preorder_number();
-			node = n;
-		}
-
-		void undo() {
-			node->set_preorder_number(prenum);
+			type = UNDO_CHANGE_PRE_NUM;
+			n1 = n;
+			v1 = n->get_preorder_number();
 		}
 };
 
-class ChangeRightChild : public Undoable {
+// n1 = node, n2 = rchild, v1 = rchild_depth
+class ChangeRightChild : public UndoEvent {
 	public:
-		Node *node;
-		Node *rchild;
-		int rchild_depth;
-
 		ChangeRightChild(Node *n) {
-			node = n;
-			rchild = n->rchild();
-			if (rchild != NULL)
-				rchild_depth = rchild->get_depth();
-		}
-
-		void undo() {
-			if (rchild != NULL) {
-				//node->add_child_keep_depth(rchild);
-				node->add_child(rchild);
-				rchild->set_depth(rchild_depth);
-			}
-			else
-				if (node->rchild() != NULL)
-					node->rchild()->cut_parent();
+			type = UNDO_CHANGE_RIGHT_CHILD;
+			n1 = n;
+			n2 = n->rchild();
+			if (n2 != NULL)
+				v1 = n2->get_depth();
 		}
 };
 
-class ChangeLeftChild : public Undoable {
+// n1 = node, n2 = lchild, v1 = lchild_depth
+class ChangeLeftChild : public UndoEvent {
 	public:
-		Node *node;
-		Node *lchild;
-		int lchild_depth;
-
 		ChangeLeftChild(Node *n) {
-			node = n;
-			lchild = n->lchild();
-			if (lchild != NULL)
-				lchild_depth = lchild->get_depth();
-		}
-
-		void undo() {
-			if (lchild != NULL) {
-				//node->add_child_keep_depth(lchild);
-				node->add_child(lchild);
-				lchild->set_depth(lchild_depth);
-			}
-			else
-				if (node->lchild() != NULL)
-					node->lchild()->cut_parent();
+			type = UNDO_CHANGE_LEFT_CHILD;
+			n1 = n;
+			n2 = n->lchild();
+			if (n2 != NULL)
+				v1 = n2->get_depth();
 		}
 };
 
-class AddChild : public Undoable {
+// n1 = child, v1 = depth
+class AddChild : public UndoEvent {
 	public:
-		Node *child;
-		int depth;
-
 		AddChild(Node *c) {
-			child = c;
+			type = UNDO_ADD_CHILD;
+			n1 = c;
 			if (c != NULL)
-				depth = c->get_depth();
-		}
-
-		void undo() {
-			if (child != NULL) {
-				child->cut_parent();
-				child->set_depth(depth);
-			}
+				v1 = c->get_depth();
 		}
 };
 
-class AddContractedLC : public Undoable {
+class AddContractedLC : public UndoEvent {
 	public:
-		Node *node;
-
 		AddContractedLC(Node *n) {
-			node = n;
-		}
-
-		void undo() {
-			node->set_contracted_lc(NULL);
+			type = UNDO_ADD_CONTRACTED_LC;
+			n1 = n;
 		}
 };
 
-class AddContractedRC : public Undoable {
+class AddContractedRC : public UndoEvent {
 	public:
-		Node *node;
-
 		AddContractedRC(Node *n) {
-			node = n;
-		}
-
-		void undo() {
-			node->set_contracted_rc(NULL);
+			type = UNDO_ADD_CONTRACTED_RC;
+			n1 = n;
 		}
 };
 
-class CreateNode : public Undoable {
+class CreateNode : public UndoEvent {
 	public:
-		Node *node;
-
 		CreateNode(Node *n) {
-			node = n;
-		}
-
-		void undo() {
-			if (node != NULL)
-				delete node;
+			type = UNDO_CREATE_NODE;
+			n1 = n;
 		}
 };
 
-class ProtectEdge : public Undoable {
+class ProtectEdge : public UndoEvent {
 	public:
-		Node *node;
-
 		ProtectEdge(Node *n) {
-			node = n;
-		}
-
-		void undo() {
-			if (node != NULL)
-				node->unprotect_edge();
+			type = UNDO_PROTECT_EDGE;
+			n1 = n;
 		}
 };
 
-class UnprotectEdge : public Undoable {
+class UnprotectEdge : public UndoEvent {
 	public:
-		Node *node;
-
 		UnprotectEdge(Node *n) {
-			node = n;
-		}
-
-		void undo() {
-			if (node != NULL)
-				node->protect_edge();
+			type = UNDO_UNPROTECT_EDGE;
+			n1 = n;
 		}
 };
 
-class ListPushBack : public Undoable {
+class ListPushBack : public UndoEvent {
 	public:
-		list<Node *> *l;
-
 		ListPushBack(list<Node *> *x) {
-			l = x;
-		}
-
-		void undo() {
-			l->pop_back();
+			type = UNDO_LIST_PUSH_BACK;
+			target = x;
 		}
 };
 
-class ListPopBack : public Undoable {
+// n1 = node
+class ListPopBack : public UndoEvent {
 	public:
-		list<Node *> *l;
-		Node *node;
-
 		ListPopBack(list<Node *> *x) {
-			l = x;
-			if (!l->empty())
-				node = l->back();
+			type = UNDO_LIST_POP_BACK;
+			target = x;
+			if (!x->empty())
+				n1 = x->back();
 			else
-				node = NULL;
+				n1 = NULL;
 		}
+};
 
-		void undo() {
-			if (node != NULL)
-				l->push_back(node);
+void UndoMachine::undo_event(UndoEvent &e) {
+	Node *node = e.n1;
+	switch(e.type) {
+		case UNDO_ADD_RHO: {
+			Forest *F = (Forest *)e.target;
+			F->set_rho(false);
+			F->get_component(F->num_components()-1)->delete_tree();
+			F->erase_components(F->num_components()-1,F->num_components());
+			break;
+		}
+		case UNDO_ADD_COMPONENT: {
+			Forest *F = (Forest *)e.target;
+			F->erase_components(F->num_components()-1,F->num_components());
+			break;
+		}
+		case UNDO_ADD_COMPONENT_TO_FRONT:
+			((Forest *)e.target)->erase_components(0,1);
+			break;
+		case UNDO_CUT_PARENT: {
+			Node *parent = e.n2;
+			if (e.v1 == 1) {
+				if (parent->is_leaf())
+					parent->add_child(node);
+				else
+					parent->insert_child(parent->get_children().front(), node);
+			}
+			else if (e.v1 == 2)
+				parent->add_child(node);
+			node->set_depth(e.v2);
+			break;
+		}
+		case UNDO_CLEAR_SIBLING_PAIR:
+			e.n1->set_sibling_pair_status(1);
+			e.n2->set_sibling_pair_status(2);
+			if (e.v1 == 0) {
+				e.n2->set_sibling(e.n1);
+			}
+			else if (e.v2 == 0) {
+				e.n1->set_sibling(e.n2);
+			}
+			break;
+		case UNDO_POP_SIBLING_PAIR: {
+			list<Node *> *sibling_pairs = (list<Node *> *)e.target;
+			sibling_pairs->push_back(e.n2);
+			sibling_pairs->push_back(e.n1);
+			break;
+		}
+		case UNDO_CONTRACT_SIBLING_PAIR:
+			if (e.v3) {
+				node->undo_contract_sibling_pair();
+				if (e.v1 > -1)
+					node->lchild()->set_depth(e.v1);
+				if (e.v2 > -1)
+					node->rchild()->set_depth(e.v2);
+			}
+			if (e.v4)
+				node->protect_edge();
+			break;
+		case UNDO_ADD_TO_FRONT_SIBLING_PAIRS: {
+			list<Node *> *sibling_pairs = (list<Node *> *)e.target;
+			if (!sibling_pairs->empty()) {
+				sibling_pairs->pop_front();
+				sibling_pairs->pop_front();
+			}
+			break;
 		}
-};
+		case UNDO_ADD_TO_SIBLING_PAIRS: {
+			list<Node *> *sibling_pairs = (list<Node *> *)e.target;
+			if (!sibling_pairs->empty()) {
+				sibling_pairs->pop_back();
+				sibling_pairs->pop_back();
+			}
+			break;
+		}
+		case UNDO_ADD_TO_SET_SIBLING_PAIRS:
+		case UNDO_REMOVE_SET_SIBLING_PAIRS: {
+			SiblingPairSet *sibling_pairs = (SiblingPairSet *)e.target;
+			SiblingPair pair = SiblingPair();
+			pair.a = e.n1;
+			pair.c = e.n2;
+			pair.key = e.v1;
+			pair.key2 = e.v2;
+			if (e.type == UNDO_REMOVE_SET_SIBLING_PAIRS)
+				sibling_pairs->insert(pair);
+			else if (!sibling_pairs->empty())
+				sibling_pairs->erase(pair);
+			break;
+		}
+		case UNDO_ADD_IN_SIBLING_PAIRS: {
+			list<Node *> *sibling_pairs = (list<Node *> *)e.target;
+			if (!sibling_pairs->empty()) {
+				list<Node *>::iterator c = sibling_pairs->begin();
+				for(int i = 0; i <= e.v1 && c != sibling_pairs->end(); i++) {
+					c++;
+				}
+				if (c != sibling_pairs->end()) {
+					list<Node *>::iterator rem = c;
+					c++;
+					sibling_pairs->erase(rem);
+					rem = c;
+					c++;
+					sibling_pairs->erase(rem);
+				}
+			}
+			break;
+		}
+		case UNDO_SET_TWIN:
+			node->set_twin(e.n2);
+			break;
+		case UNDO_CHANGE_NAME:
+			node->set_name(log->names[e.v1]);
+			log->names.resize(e.v1);
+			break;
+		case UNDO_CHANGE_EDGE_PRE_INTERVAL:
+			node->set_edge_pre_start(e.v1);
+			node->set_edge_pre_end(e.v2);
+			break;
+		case UNDO_CHANGE_PRE_NUM:
+			node->set_preorder_number(e.v1);
+			break;
+		case UNDO_CHANGE_RIGHT_CHILD:
+		case UNDO_CHANGE_LEFT_CHILD: {
+			Node *child = e.n2;
+			if (child != NULL) {
+				//node->add_child_keep_depth(child);
+				node->add_child(child);
+				child->set_depth(e.v1);
+			}
+			else {
+				Node *old = (e.type == UNDO_CHANGE_RIGHT_CHILD) ?
+						node->rchild() : node->lchild();
+				if (old != NULL)
+					old->cut_parent();
+			}
+			break;
+		}
+		case UNDO_ADD_CHILD:
+			if (node != NULL) {
+				node->cut_parent();
+				node->set_depth(e.v1);
+			}
+			break;
+		case UNDO_ADD_CONTRACTED_LC:
+			node->set_contracted_lc(NULL);
+			break;
+		case UNDO_ADD_CONTRACTED_RC:
+			node->set_contracted_rc(NULL);
+			break;
+		case UNDO_CREATE_NODE:
+			if (node != NULL)
+				delete node;
+			break;
+		case UNDO_PROTECT_EDGE:
+			if (node != NULL)
+				node->unprotect_edge();
+			break;
+		case UNDO_UNPROTECT_EDGE:
+			if (node != NULL)
+				node->protect_edge();
+			break;
+		case UNDO_LIST_PUSH_BACK:
+			((list<Node *> *)e.target)->pop_back();
+			break;
+		case UNDO_LIST_POP_BACK:
+			if (node != NULL)
+				((list<Node *> *)e.target)->push_back(node);
+			break;
+	}
+}
 
 
-void ContractEvent(UndoMachine *um, Node *n, list<Undoable *>::iterator
-		bookmark) {
+void ContractEvent(UndoMachine *um, Node *n, int bookmark) {
 		Node *parent = n->parent();
 		Node *child;
 		Node *lc = n->lchild();
@@ -642,22 +663,22 @@ void ContractEvent(UndoMachine *um, Node *n, list<Undoable *>::iterator
 		if (parent != NULL) {
 			if (lc && !rc) {
 				child = lc;
-				um->add_event(new ChangeEdgePreInterval(child));
-				um->add_event(new CutParent(child));
-				um->add_event(new CutParent(n));
+				um->add_event(ChangeEdgePreInterval(child));
+				um->add_event(CutParent(child));
+				um->add_event(CutParent(n));
 				if (n->is_protected() && !child->is_protected())
-					um->add_event(new ProtectEdge(child));
+					um->add_event(ProtectEdge(child));
 			}
 			else if (rc && !lc) {
 				child = rc;
-				um->add_event(new ChangeEdgePreInterval(child));
-				um->add_event(new CutParent(child));
-				um->add_event(new CutParent(n));
+				um->add_event(ChangeEdgePreInterval(child));
+				um->add_event(CutParent(child));
+				um->add_event(CutParent(n));
 				if (n->is_protected() && !child->is_protected())
-					um->add_event(new ProtectEdge(child));
+					um->add_event(ProtectEdge(child));
 			}
 			else if (lc == NULL && rc == NULL) {
-				um->insert_event(bookmark, new CutParent(n));
+				um->insert_event(bookmark, CutParent(n));
 				parent->delete_child(n);
 				ContractEvent(um, parent);
 				parent->add_child(n);
@@ -668,26 +689,26 @@ void ContractEvent(UndoMachine *um, Node *n, list<Undoable *>::iterator
 
 			// dead component or singleton, will be cleaned up by the forest
 			if (n->get_children().empty()) {
-				um->add_event(new ChangeName(n));
+				um->add_event(ChangeName(n));
 			}
 			else if (n->get_children().size() == 1) {
 				child = n->get_children().front();
 //				if (rc == NULL) {
-//					um->add_event(new ChangeRightChild(n));
+//					um->add_event(ChangeRightChild(n));
 //					child = lc;
 //				}
 //				else {
-//					um->add_event(new ChangeLeftChild(n));
+//					um->add_event(ChangeLeftChild(n));
 //					child = rc;
 //				}
-				um->add_event(new CutParent(child));
+				um->add_event(CutParent(child));
 				/* cluster hack - if we delete a cluster node then
 				 * we may try to use it later. This only happens once
 				 * per cluster so we can spend linear time to update
 				 * the forest
 				 */
 				if (child->get_num_clustered_children() > 0) {
-					//um->add_event(new CutParent(n));
+					//um->add_event(CutParent(n));
 				}
 				if (child->get_num_clustered_children() <= 0) {
 					// if child is a leaf then get rid of this so we don't lose refs
@@ -700,24 +721,24 @@ void ContractEvent(UndoMachine *um, Node *n, list<Undoable *>::iterator
 					Node *new_rc = child->rchild();
 					if (child->is_leaf()) {
 						if (child->get_twin() != NULL) {
-							um->add_event(new SetTwin(n));
-							um->add_event(new SetTwin(child->get_twin()));
+							um->add_event(SetTwin(n));
+							um->add_event(SetTwin(child->get_twin()));
 						}
-						um->add_event(new ChangeName(n));
+						um->add_event(ChangeName(n));
 					}
-					um->add_event(new ChangePreNum(n));
+					um->add_event(ChangePreNum(n));
 					// redundant?
-					//um->add_event(new CutParent(child));
+					//um->add_event(CutParent(child));
 					list<Node *>::iterator c;
 					for(c = child->get_children().begin();
 							c != child->get_children().end();
 							c++) {
-						um->add_event(new CutParent(*c));
+						um->add_event(CutParent(*c));
 					}
 					if (child->get_contracted_lc() != NULL)
-						um->add_event(new AddContractedLC(n));
+						um->add_event(AddContractedLC(n));
 					if (child->get_contracted_rc() != NULL)
-						um->add_event(new AddContractedRC(n));
+						um->add_event(AddContractedRC(n));
 				}
 			}
 		}
@@ -725,7 +746,7 @@ void ContractEvent(UndoMachine *um, Node *n, list<Undoable *>::iterator
 	}
 
 void ContractEvent(UndoMachine *um, Node *n) {
-	list<Undoable *>::iterator bookmark = um->get_bookmark();
+	int bookmark = um->get_bookmark();
 	ContractEvent(um, n, bookmark);
 }
 
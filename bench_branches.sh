@@ -0,0 +1,25 @@
+#!/bin/bash
+# Branch and bound throughput on the 100 leaf test trees
+# usage: ./bench_branches.sh [rspr binary] [repeats]
+rspr=${1:-./rspr}
+repeats=${2:-5}
+
+declare -a tests=(
+		  "trees_100_9.txt"
+		  "trees_100_17.txt"
+		  "trees_100_24.txt"
+		  )
+
+printf "%-20s %12s %10s %14s\n" "trees" "branch nodes" "seconds" "nodes/second"
+for i in ${tests[@]}
+do
+	nodes=`$rspr -bb -q -count_branches < test_trees/$i | grep 'branch nodes' | grep -o '[0-9]\+$'`
+	start=`date +%s%N`
+	for (( r = 0; r < $repeats; r++ ))
+	do
+		$rspr -bb -q < test_trees/$i > /dev/null
+	done
+	end=`date +%s%N`
+	awk -v i=$i -v n=$nodes -v t=$(( $end - $start )) -v r=$repeats \
+		'BEGIN { s = t / 1e9 / r; printf "%-20s %12d %10.4f %14.0f\n", i, n, s, n / s }'
+done
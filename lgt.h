@@ -101,7 +101,7 @@ void show_moves(Node *T1, Node *T2, map<string, int> *label_map,
 void add_transfers(vector<vector<int> > *transfer_counts, Node *super_tree,
 		vector<Node *> *gene_trees, map<int, string> *reverse_label_map) {
 	cout << "Super tree size " << super_tree->size() << endl;
-	#pragma omp parallel for
+	#pragma omp parallel for copyin(PREFER_RHO)
 	for(int i = 0; i < gene_trees->size(); i++) {
 		Forest *MAF1 = NULL;
 		Forest *MAF2 = NULL;
@@ -178,7 +178,6 @@ void add_transfers(vector<vector<int> > *transfer_counts, Forest *F1,
 			continue;
 		}
 
-		#pragma omp atomic
 		if(!IGNORE_MULTI && MULTIFURCATING){
 			Node *F1_source_new = F1_source;
 			Node *F1_target_new = F1_target;
@@ -313,7 +312,7 @@ void add_transfers(vector<vector<int> > *transfer_counts, Forest *F1,
 
 void print_transfers(Node *super_tree, vector<Node *> *gene_trees,
 		vector<string> *gene_tree_names, map<int, string> *reverse_label_map) {
-	#pragma omp parallel for
+	#pragma omp parallel for copyin(PREFER_RHO)
 	for(int i = 0; i < gene_trees->size(); i++) {
 		Forest *MAF1 = NULL;
 		Forest *MAF2 = NULL;
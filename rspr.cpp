@@ -125,10 +125,90 @@ PAIRWISE COMPARISON OPTIONS
                          left triangle of the matrix. With this option the
                          lower triangle is filled in.
 
+-fill-symmetric-pairwise Compute only the upper right triangle of the matrix
+                         but output the lower left triangle as well, copied
+                         from the upper right. Replaces piping the output
+                         through fill_matrix.
+
 -pairwise_max x          Use with -pairwise to only compute distances at most x.
                          Larger values are output as -1. Very efficient for
                          small distances (e.g. 1-10).
 
+-pairwise_estimate
+-pairwise_estimate x     Instead of computing the -pairwise matrix, print its
+                         estimated cost from the approximate distance of
+                         each pair. With x, also time the exact search of x
+                         pairs spread over the range of costs and print the
+                         estimated running time on one thread.
+
+--dump-binary x          Read the input trees and write them to the file x
+                         in a preprocessed binary form, then exit. Uses the
+                         -unrooted, -support and -min_length options.
+
+--load-binary x          Read the trees for -pairwise or -total from the
+                         binary file x written by --dump-binary instead of
+                         STDIN. The file is memory mapped, so large tree
+                         sets load without parsing.
+
+-pairwise_binary x       Write the -pairwise matrix to the file x instead of
+                         STDOUT, as packed 8 bit (or 16 bit for large trees)
+                         integers with a short header. Only the upper right
+                         triangle is stored unless -no-symmetric-pairwise
+                         is used. The file can be memory mapped.
+
+--print-binary-matrix x  Print the matrix in the file x written by
+                         -pairwise_binary as text, with the lower left
+                         triangle filled in. Distances above the
+                         -pairwise_max value are printed as -1 and cells
+                         that were not computed are left empty.
+
+-pairwise_tiered
+-pairwise_tiered x       Compute a -pairwise matrix of bounds first and
+                         exact distances second. Each pair is bounded by
+                         its 3-approximation, and then the exact search
+                         raises the lower bound until the bounds meet.
+                         This finishes for pairs that may have distance at
+                         most x. Pairs left unresolved are output as
+                         [lo,hi]. Rooted rSPR distances only.
+
+-pairwise_budget s       Use with -pairwise_tiered to keep narrowing the
+                         bounds of each pair for s seconds (default 0).
+
+-pairwise_append x       Extend the -pairwise matrix x of the first trees of
+                         the input, in text or -pairwise_binary format, to
+                         all of the input trees. Only the pairs with a new
+                         tree are computed. The earlier trees must come
+                         first, in the same order, so their labels are
+                         numbered the same way. Also used with
+                         -merge_shards when the shards extended x.
+
+-pairwise_sparse         Output the -pairwise matrix as lines i,j,distance,
+                         one for each pair of different trees with a
+                         distance. With -pairwise_max x, only pairs with
+                         distance at most x are output.
+
+-shard i/N               Compute only shard i (1 to N) of the -pairwise
+                         matrix, including any row and column ranges. The
+                         tiles of the matrix are split among the N shards by
+                         their estimated cost so each shard has a similar
+                         amount of work. Each cell is output as a line
+                         i,j,distance after a header line.
+
+-merge_shards x1 x2 ...  Merge the outputs x1 x2 ... of all N shards of a
+                         -shard run into the symmetric distance matrix.
+                         Fails if a shard or cell is missing.
+
+-checkpoint x            Append each finished -pairwise cell or exact -total
+                         gene tree distance to the file x, flushed every few
+                         seconds, so an interrupted run can be resumed.
+
+-resume                  Use with -checkpoint to skip the distances already
+                         in the checkpoint file and print them with the new
+                         ones. The input trees and distance options must
+                         match. Row and column ranges may differ, so each
+                         shard of a split -pairwise run can be restarted
+                         from its own checkpoint.
+
 *******************************************************************************
 OTHER OPTIONS
 *******************************************************************************
@@ -136,6 +216,28 @@ OTHER OPTIONS
             algorithm
 
 -q          Quiet; Do not output the input trees or approximation
+
+-parallel_bb    Split the exact search for each pair of trees into parallel
+                tasks. Requires an OpenMP build (make omp). Applies to each
+                cluster of the default search and to -bb, but not to
+                -parallel_clusters or multifurcating trees. The distances
+                are unchanged; MAF ties are broken by search order
+
+-parallel_clusters      Solve the clusters of each pair of trees in parallel.
+                        Requires an OpenMP build (make omp)
+
+-memoize_search         Keep the branch and bound search tree between
+                        iterations of the exact search, so the approximation
+                        bound is not rechecked. Off by default: hashing each
+                        search state usually costs more than it saves
+
+-memoize [x]    Remember the distance of solved clusters and tree pairs so
+                repeated subproblems are not searched again. Keeps at most
+                x solutions, discarding the least recently used
+                (default 100000)
+
+-count_branches Count the nodes of the branch and bound search tree and
+                print the total when done
 *******************************************************************************
 
 Example:
@@ -182,6 +284,9 @@ total exact drSPR=4
 #include "LCA.h"
 #include "ClusterInstance.h"
 #include "UndoMachine.h"
+#include "LineReader.h"
+#include "BinaryTrees.h"
+#include "Checkpoint.h"
 #include "lgt.h"
 
 using namespace std;
@@ -205,12 +310,29 @@ bool CLUSTER_TEST = false;
 bool TOTAL = false;
 bool PAIRWISE = false;
 bool PAIRWISE_SYMMETRIC = true;
+bool PAIRWISE_FILL = false;
+bool PAIRWISE_ESTIMATE = false;
+int PAIRWISE_ESTIMATE_SAMPLES = 0;
 int PAIRWISE_START = 0;
 int PAIRWISE_END = INT_MAX;
 int PAIRWISE_COL_START = 0;
 int PAIRWISE_COL_END = INT_MAX;
 bool PAIRWISE_MAX = false;
 int PAIRWISE_MAX_SPR = INT_MAX;
+string DUMP_BINARY_FILE = "";
+string LOAD_BINARY_FILE = "";
+string CHECKPOINT_FILE = "";
+bool RESUME = false;
+int SHARD = 0;
+int NUM_SHARDS = 0;
+vector<string> MERGE_SHARD_FILES = vector<string>();
+string PAIRWISE_BINARY_FILE = "";
+string PAIRWISE_APPEND_FILE = "";
+bool PAIRWISE_TIERED = false;
+int PAIRWISE_TIERED_MAX = -1;
+double PAIRWISE_BUDGET = 0;
+bool PAIRWISE_SPARSE = false;
+string PRINT_BINARY_MATRIX_FILE = "";
 bool APPROX = false;
 bool LOWER_BOUND = false;
 bool REDUCE_ONLY = false;
@@ -337,10 +459,90 @@ string USAGE =
 "                         left triangle of the matrix. With this option the\n"
 "                         lower triangle is filled in.\n"
 "\n"
+"-fill-symmetric-pairwise Compute only the upper right triangle of the matrix\n"
+"                         but output the lower left triangle as well, copied\n"
+"                         from the upper right. Replaces piping the output\n"
+"                         through fill_matrix.\n"
+"\n"
 "-pairwise_max x          Use with -pairwise to only compute distances at most x.\n"
 "                         Larger values are output as -1. Very efficient for\n"
 "                         small distances (e.g. 1-10).\n"
 "\n"
+"-pairwise_estimate\n"
+"-pairwise_estimate x     Instead of computing the -pairwise matrix, print its\n"
+"                         estimated cost from the approximate distance of\n"
+"                         each pair. With x, also time the exact search of x\n"
+"                         pairs spread over the range of costs and print the\n"
+"                         estimated running time on one thread.\n"
+"\n"
+"--dump-binary x          Read the input trees and write them to the file x\n"
+"                         in a preprocessed binary form, then exit. Uses the\n"
+"                         -unrooted, -support and -min_length options.\n"
+"\n"
+"--load-binary x          Read the trees for -pairwise or -total from the\n"
+"                         binary file x written by --dump-binary instead of\n"
+"                         STDIN. The file is memory mapped, so large tree\n"
+"                         sets load without parsing.\n"
+"\n"
+"-pairwise_binary x       Write the -pairwise matrix to the file x instead of\n"
+"                         STDOUT, as packed 8 bit (or 16 bit for large trees)\n"
+"                         integers with a short header. Only the upper right\n"
+"                         triangle is stored unless -no-symmetric-pairwise\n"
+"                         is used. The file can be memory mapped.\n"
+"\n"
+"--print-binary-matrix x  Print the matrix in the file x written by\n"
+"                         -pairwise_binary as text, with the lower left\n"
+"                         triangle filled in. Distances above the\n"
+"                         -pairwise_max value are printed as -1 and cells\n"
+"                         that were not computed are left empty.\n"
+"\n"
+"-pairwise_tiered\n"
+"-pairwise_tiered x       Compute a -pairwise matrix of bounds first and\n"
+"                         exact distances second. Each pair is bounded by\n"
+"                         its 3-approximation, and then the exact search\n"
+"                         raises the lower bound until the bounds meet.\n"
+"                         This finishes for pairs that may have distance at\n"
+"                         most x. Pairs left unresolved are output as\n"
+"                         [lo,hi]. Rooted rSPR distances only.\n"
+"\n"
+"-pairwise_budget s       Use with -pairwise_tiered to keep narrowing the\n"
+"                         bounds of each pair for s seconds (default 0).\n"
+"\n"
+"-pairwise_append x       Extend the -pairwise matrix x of the first trees of\n"
+"                         the input, in text or -pairwise_binary format, to\n"
+"                         all of the input trees. Only the pairs with a new\n"
+"                         tree are computed. The earlier trees must come\n"
+"                         first, in the same order, so their labels are\n"
+"                         numbered the same way. Also used with\n"
+"                         -merge_shards when the shards extended x.\n"
+"\n"
+"-pairwise_sparse         Output the -pairwise matrix as lines i,j,distance,\n"
+"                         one for each pair of different trees with a\n"
+"                         distance. With -pairwise_max x, only pairs with\n"
+"                         distance at most x are output.\n"
+"\n"
+"-shard i/N               Compute only shard i (1 to N) of the -pairwise\n"
+"                         matrix, including any row and column ranges. The\n"
+"                         tiles of the matrix are split among the N shards by\n"
+"                         their estimated cost so each shard has a similar\n"
+"                         amount of work. Each cell is output as a line\n"
+"                         i,j,distance after a header line.\n"
+"\n"
+"-merge_shards x1 x2 ...  Merge the outputs x1 x2 ... of all N shards of a\n"
+"                         -shard run into the symmetric distance matrix.\n"
+"                         Fails if a shard or cell is missing.\n"
+"\n"
+"-checkpoint x            Append each finished -pairwise cell or exact -total\n"
+"                         gene tree distance to the file x, flushed every few\n"
+"                         seconds, so an interrupted run can be resumed.\n"
+"\n"
+"-resume                  Use with -checkpoint to skip the distances already\n"
+"                         in the checkpoint file and print them with the new\n"
+"                         ones. The input trees and distance options must\n"
+"                         match. Row and column ranges may differ, so each\n"
+"                         shard of a split -pairwise run can be restarted\n"
+"                         from its own checkpoint.\n"
+"\n"
 "*******************************************************************************\n"
 "OTHER OPTIONS\n"
 "*******************************************************************************\n"
@@ -348,6 +550,28 @@ string USAGE =
 "            algorithm\n"
 "\n"
 "-q          Quiet; Do not output the input trees or approximation\n"
+"\n"
+"-parallel_bb    Split the exact search for each pair of trees into parallel\n"
+"                tasks. Requires an OpenMP build (make omp). Applies to each\n"
+"                cluster of the default search and to -bb, but not to\n"
+"                -parallel_clusters or multifurcating trees. The distances\n"
+"                are unchanged; MAF ties are broken by search order\n"
+"\n"
+"-parallel_clusters      Solve the clusters of each pair of trees in parallel.\n"
+"                        Requires an OpenMP build (make omp)\n"
+"\n"
+"-memoize_search         Keep the branch and bound search tree between\n"
+"                        iterations of the exact search, so the approximation\n"
+"                        bound is not rechecked. Off by default: hashing each\n"
+"                        search state usually costs more than it saves\n"
+"\n"
+"-memoize [x]    Remember the distance of solved clusters and tree pairs so\n"
+"                repeated subproblems are not searched again. Keeps at most\n"
+"                x solutions, discarding the least recently used\n"
+"                (default 100000)\n"
+"\n"
+"-count_branches Count the nodes of the branch and bound search tree and\n"
+"                print the total when done\n"
 "*******************************************************************************\n"
 "\n"
 "Example:\n"
@@ -376,6 +600,70 @@ string USAGE =
 
 "*******************************************************************************/\n";
 
+// the parse settings recorded in binary tree files
+BinaryTreesHeader binary_trees_settings() {
+	BinaryTreesHeader header = BinaryTreesHeader();
+	if (UNROOTED || SIMPLE_UNROOTED)
+		header.flags |= BINARY_TREES_ROOTED;
+	if (IGNORE_MULTI)
+		header.flags |= BINARY_TREES_IGNORE_MULTI;
+	header.required_support = REQUIRED_SUPPORT;
+	header.min_length = MIN_LENGTH;
+	return header;
+}
+
+// load a binary tree file written with the current parse settings
+bool load_binary_trees(BinaryTrees *binary, vector<CompactTree> *trees,
+		vector<string> *names, map<string, int> *label_map,
+		map<int, string> *reverse_label_map) {
+	string error = "";
+	if (!binary->load(LOAD_BINARY_FILE, trees, names, label_map,
+			reverse_label_map, &error)) {
+		cerr << "error: " << error << endl;
+		return false;
+	}
+	BinaryTreesHeader settings = binary_trees_settings();
+	if (binary->header.flags != settings.flags
+			|| binary->header.required_support != settings.required_support
+			|| binary->header.min_length != settings.min_length) {
+		cerr << "error: " << LOAD_BINARY_FILE
+			<< " was written with different -unrooted, -support or"
+			<< " -min_length options" << endl;
+		return false;
+	}
+	return true;
+}
+
+// the options that change -pairwise and -total distances
+#define CHECKPOINT_PAIRWISE 1
+#define CHECKPOINT_TOTAL 2
+CheckpointHeader checkpoint_settings(int mode) {
+	CheckpointHeader header = CheckpointHeader();
+	int flags[] = {mode == CHECKPOINT_PAIRWISE, mode == CHECKPOINT_TOTAL, RF,
+			APPROX, UNROOTED, SIMPLE_UNROOTED, SIMPLE_UNROOTED_RSPR,
+			ALL_UNROOTED, UNROOTED_MIN_APPROX, PAIRWISE_MAX};
+	for(int i = 0; i < sizeof(flags) / sizeof(int); i++) {
+		if (flags[i])
+			header.options |= 1 << i;
+	}
+	if (PAIRWISE_MAX)
+		header.options |= (long long)PAIRWISE_MAX_SPR << 32;
+	return header;
+}
+
+// open CHECKPOINT_FILE, resuming it with -resume
+bool open_checkpoint(PairCheckpoint *checkpoint, CheckpointHeader header) {
+	string error = "";
+	if (!checkpoint->open(CHECKPOINT_FILE, RESUME, header, &error)) {
+		cerr << "error: " << error << endl;
+		return false;
+	}
+	if (RESUME)
+		cerr << "resumed " << checkpoint->size() << " distances from "
+			<< CHECKPOINT_FILE << endl;
+	return true;
+}
+
 int main(int argc, char *argv[]) {
 	int max_args = argc-1;
 	while (argc > 1) {
@@ -556,11 +844,29 @@ int main(int argc, char *argv[]) {
 		else if (strcmp(arg, "-prefer_rho") == 0) {
 			PREFER_RHO = true;
 		}
-/*
+		else if (strcmp(arg, "-parallel_bb") == 0) {
+			PARALLEL_BB = true;
+		}
+		else if (strcmp(arg, "-parallel_clusters") == 0) {
+			PARALLEL_CLUSTERS = true;
+		}
+		else if (strcmp(arg, "-memoize_search") == 0) {
+			MEMOIZE_SEARCH = true;
+		}
+		else if (strcmp(arg, "-no_memoize_search") == 0) {
+			MEMOIZE_SEARCH = false;
+		}
 		else if (strcmp(arg, "-memoize") == 0) {
 			MEMOIZE = true;
+			if (max_args > argc) {
+				char *arg2 = argv[argc+1];
+				if (arg2[0] != '-')
+					MEMOIZE_CAPACITY = atoi(arg2);
+			}
+		}
+		else if (strcmp(arg, "-count_branches") == 0) {
+			COUNT_BRANCHES = true;
 		}
-*/
 		else if (strcmp(arg, "-all_mafs") == 0) {
 			ALL_MAFS= true;
 		}
@@ -600,6 +906,18 @@ int main(int argc, char *argv[]) {
 		else if (strcmp(arg, "-no-symmetric-pairwise") == 0) {
 			PAIRWISE_SYMMETRIC=false;
 		}
+		else if (strcmp(arg, "-fill-symmetric-pairwise") == 0) {
+			PAIRWISE_FILL=true;
+		}
+		else if (strcmp(arg, "-pairwise_estimate") == 0) {
+			PAIRWISE=true;
+			PAIRWISE_ESTIMATE=true;
+			if (max_args > argc) {
+				char *arg2 = argv[argc+1];
+				if (arg2[0] != '-')
+					PAIRWISE_ESTIMATE_SAMPLES = atoi(arg2);
+			}
+		}
 		else if (strcmp(arg, "-pairwise_max") == 0) {
 			PAIRWISE=true;
 			PAIRWISE_MAX=true;
@@ -762,6 +1080,75 @@ int main(int argc, char *argv[]) {
 		else if (strcmp(arg, "-sequence") == 0) {
 			SEQUENCE = true;
 		}
+		else if (strcmp(arg, "--dump-binary") == 0) {
+			if (max_args > argc)
+				DUMP_BINARY_FILE = argv[argc+1];
+		}
+		else if (strcmp(arg, "--load-binary") == 0) {
+			if (max_args > argc)
+				LOAD_BINARY_FILE = argv[argc+1];
+		}
+		else if (strcmp(arg, "-checkpoint") == 0) {
+			if (max_args > argc)
+				CHECKPOINT_FILE = argv[argc+1];
+		}
+		else if (strcmp(arg, "-resume") == 0) {
+			RESUME = true;
+		}
+		else if (strcmp(arg, "-shard") == 0) {
+			PAIRWISE = true;
+			QUIET = true;
+			if (max_args > argc)
+				sscanf(argv[argc+1], "%d/%d", &SHARD, &NUM_SHARDS);
+			if (NUM_SHARDS < 1 || SHARD < 1 || SHARD > NUM_SHARDS) {
+				cerr << "error: -shard requires i/N with 1 <= i <= N" << endl;
+				return 1;
+			}
+		}
+		else if (strcmp(arg, "-pairwise_binary") == 0) {
+			PAIRWISE = true;
+			QUIET = true;
+			if (max_args > argc)
+				PAIRWISE_BINARY_FILE = argv[argc+1];
+		}
+		else if (strcmp(arg, "-pairwise_tiered") == 0) {
+			PAIRWISE = true;
+			QUIET = true;
+			PAIRWISE_TIERED = true;
+			if (max_args > argc) {
+				char *arg2 = argv[argc+1];
+				if (arg2[0] != '-')
+					PAIRWISE_TIERED_MAX = atoi(arg2);
+			}
+		}
+		else if (strcmp(arg, "-pairwise_budget") == 0) {
+			if (max_args > argc)
+				PAIRWISE_BUDGET = atof(argv[argc+1]);
+		}
+		else if (strcmp(arg, "-pairwise_append") == 0) {
+			PAIRWISE = true;
+			QUIET = true;
+			if (max_args > argc)
+				PAIRWISE_APPEND_FILE = argv[argc+1];
+		}
+		else if (strcmp(arg, "-pairwise_sparse") == 0) {
+			PAIRWISE = true;
+			QUIET = true;
+			PAIRWISE_SPARSE = true;
+		}
+		else if (strcmp(arg, "--print-binary-matrix") == 0) {
+			if (max_args > argc)
+				PRINT_BINARY_MATRIX_FILE = argv[argc+1];
+		}
+		else if (strcmp(arg, "-merge_shards") == 0) {
+			MERGE_SHARD_FILES.clear();
+			for(int a = argc + 1; a <= max_args && argv[a][0] != '-'; a++)
+				MERGE_SHARD_FILES.push_back(argv[a]);
+			if (MERGE_SHARD_FILES.empty()) {
+				cerr << "error: -merge_shards requires shard files" << endl;
+				return 1;
+			}
+		}
 		else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-help") == 0) {
 			cout << USAGE;
 			return 0;
@@ -827,6 +1214,54 @@ int main(int argc, char *argv[]) {
 	// set random seed
 	srand(unsigned(time(0)));
 
+	// print a matrix written by -pairwise_binary as text
+	if (PRINT_BINARY_MATRIX_FILE != "") {
+		BinaryMatrix matrix;
+		string error = "";
+		if (!matrix.load(PRINT_BINARY_MATRIX_FILE, &error)) {
+			cerr << "error: " << error << endl;
+			return 1;
+		}
+		for(int i = matrix.header.row_start; i < matrix.header.row_end; i++) {
+			for(int j = matrix.header.col_start; j < matrix.header.col_end; j++) {
+				if (j > matrix.header.col_start)
+					cout << ",";
+				int d = matrix.distance(i, j);
+				if (d >= -1)
+					cout << d;
+			}
+			cout << "\n";
+		}
+		return 0;
+	}
+
+	// assemble the outputs of -shard runs
+	if (!MERGE_SHARD_FILES.empty()) {
+		string error = "";
+		if (!merge_pairwise_shards(MERGE_SHARD_FILES, PAIRWISE_APPEND_FILE,
+				&error)) {
+			cerr << "error: " << error << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	// preprocess the input trees into a binary file
+	if (DUMP_BINARY_FILE != "") {
+		vector<CompactTree> trees = vector<CompactTree>();
+		vector<string> names = vector<string>();
+		read_compact_trees(cin, UNROOTED || SIMPLE_UNROOTED, &trees, &names,
+				&label_map, &reverse_label_map);
+		if (!write_binary_trees(DUMP_BINARY_FILE, binary_trees_settings(),
+				trees, names, &reverse_label_map)) {
+			cerr << "error: could not write " << DUMP_BINARY_FILE << endl;
+			return 1;
+		}
+		cout << "wrote " << trees.size() << " trees to " << DUMP_BINARY_FILE
+			<< endl;
+		return 0;
+	}
+
 	// Normal operation
 	if (!UNROOTED && !UNROOTED_MIN_APPROX && !TOTAL && !PAIRWISE && !SEQUENCE) {
 		string T1_line = "";
@@ -1224,38 +1659,63 @@ int main(int argc, char *argv[]) {
 		string line = "";
 		vector<Node *> trees = vector<Node *>();
 		vector<string> names = vector<string>();
-		if (!getline(cin, line))
-			return 0;
-		if (UNROOTED || SIMPLE_UNROOTED)
-			line = root(line);
-		Node *T1 = build_tree(line);
-		if (!QUIET) {
-			cout << "T1: ";
-			T1->print_subtree();
+		Node *T1;
+		if (LOAD_BINARY_FILE != "") {
+			BinaryTrees binary;
+			vector<CompactTree> binary_trees = vector<CompactTree>();
+			vector<string> binary_names = vector<string>();
+			if (!load_binary_trees(&binary, &binary_trees, &binary_names,
+					&label_map, &reverse_label_map))
+				return 1;
+			if (binary_trees.empty())
+				return 0;
+			T1 = binary_trees[0].to_node();
+			for(int i = 1; i < binary_trees.size(); i++) {
+				trees.push_back(binary_trees[i].to_node());
+				names.push_back(binary_names[i]);
+			}
+			if (!QUIET) {
+				cout << "T1: ";
+				T1->numbers_to_labels(&reverse_label_map);
+				T1->print_subtree();
+				T1->labels_to_numbers(&label_map, &reverse_label_map);
+			}
 		}
-		T1->labels_to_numbers(&label_map, &reverse_label_map);
-		while (getline(cin, line)) {
-			size_t loc = line.find_first_of("(");
-			if (loc != string::npos) {
+		else {
+			if (!getline(cin, line))
+				return 0;
+			if (UNROOTED || SIMPLE_UNROOTED)
+				line = root(line);
+			T1 = build_tree(line);
+			if (!QUIET) {
+				cout << "T1: ";
+				T1->print_subtree();
+			}
+			T1->labels_to_numbers(&label_map, &reverse_label_map);
+			LineReader reader = LineReader(cin);
+			char *tree_line;
+			size_t length;
+			while (reader.next(&tree_line, &length)) {
 				string name = "";
-				if (loc != 0) {
-					name = line.substr(0,loc);
-					line.erase(0,loc);
+				Node *T2 = read_tree(tree_line, length,
+						UNROOTED || SIMPLE_UNROOTED, &name, &label_map,
+						&reverse_label_map);
+				if (T2 != NULL) {
+					names.push_back(name);
+					trees.push_back(T2);
 				}
-				if (UNROOTED || SIMPLE_UNROOTED)
-					line = root(line);
-				Node *T2 = build_tree(line);
-				if (!QUIET) {
-					cout << "T2: ";
-					T2->print_subtree();
-				}
-				T2->labels_to_numbers(&label_map, &reverse_label_map);
-				if (UNROOTED)
-					T2->preorder_number();
-				names.push_back(name);
-				trees.push_back(T2);
 			}
 		}
+		for(vector<Node *>::iterator T2 = trees.begin(); T2 != trees.end(); T2++) {
+			if (!QUIET) {
+				cout << "T2: ";
+				(*T2)->numbers_to_labels(&reverse_label_map);
+				(*T2)->print_subtree();
+				(*T2)->labels_to_numbers(&label_map, &reverse_label_map);
+			}
+			if (UNROOTED)
+				(*T2)->preorder_number();
+		}
 		if (!QUIET) {
 			cout << endl;
 		}
@@ -1264,7 +1724,7 @@ int main(int argc, char *argv[]) {
 			// reroot the gene trees based on the balanced accuracy of splits
 			T1->preorder_number();
 			int end = trees.size();
-			#pragma omp parallel for
+			#pragma omp parallel for copyin(PREFER_RHO)
 			for(int i = 0; i < end; i++) {
 				trees[i]->preorder_number();
 				Node *new_root;
@@ -1274,9 +1734,7 @@ int main(int argc, char *argv[]) {
 					new_root = find_best_root(T1, trees[i]);
 				if (new_root != NULL)
 					trees[i]->reroot(new_root);
-					trees[i]->set_depth(0);
-					trees[i]->fix_depths();
-					trees[i]->preorder_number();
+					trees[i]->renumber();
 				if (PRINT_ROOTED_TREES) {
 					trees[i]->numbers_to_labels(&reverse_label_map);
 					cout << "T" <<  i+2 << ": " << trees[i]->str_subtree() << endl;
@@ -1292,13 +1750,29 @@ int main(int argc, char *argv[]) {
 			rootings = vector<Node *>();
 			rootings.push_back(T1->lchild());
 		}
+		PairCheckpoint checkpoint;
+		if (CHECKPOINT_FILE != "") {
+			CheckpointHeader header = checkpoint_settings(CHECKPOINT_TOTAL);
+			header.num_trees = trees.size() + 1;
+			string tree = T1->str_subtree();
+			header.input = checkpoint_hash(tree.data(), tree.size(),
+					CHECKPOINT_HASH_START);
+			for(int i = 0; i < trees.size(); i++) {
+				tree = trees[i]->str_subtree();
+				header.input = checkpoint_hash(tree.data(), tree.size(),
+						header.input);
+			}
+			if (!open_checkpoint(&checkpoint, header))
+				return 1;
+			if (!RF && !APPROX)
+				TOTAL_CHECKPOINT = &checkpoint;
+		}
 		int best_distance = INT_MAX;
 		for(int i = 0; i < rootings.size(); i++) {
+			TOTAL_CHECKPOINT_ROW = i;
 			if (rootings[i] != T1)
 				T1->reroot(rootings[i]);
-			T1->set_depth(0);
-			T1->fix_depths();
-			T1->preorder_number();
+			T1->renumber();
 
 			int distance;
 
@@ -1338,14 +1812,23 @@ int main(int argc, char *argv[]) {
 		}
 		if (ALL_UNROOTED)
 			cout << "best distance=" << best_distance << endl;
+		if (TOTAL_CHECKPOINT != NULL) {
+			TOTAL_CHECKPOINT->flush(true);
+			TOTAL_CHECKPOINT = NULL;
+		}
 		T1->delete_tree();
 		for(vector<Node *>::iterator T2 = trees.begin(); T2 != trees.end(); T2++)
 			(*T2)->delete_tree();
 	}
 	else if (PAIRWISE) {
 		string line = "";
-		vector<Node *> trees = vector<Node *>();
+		// the input trees are only read so keep them compact
+		BinaryTrees binary;
+		vector<CompactTree> trees = vector<CompactTree>();
 		vector<string> names = vector<string>();
+		if (LOAD_BINARY_FILE != "" && !load_binary_trees(&binary, &trees,
+				&names, &label_map, &reverse_label_map))
+			return 1;
 //		if (!getline(cin, line))
 //			return 0;
 //		Node *T1 = build_tree(line);
@@ -1354,28 +1837,9 @@ int main(int argc, char *argv[]) {
 //			T1->print_subtree();
 //		}
 //		T1->labels_to_numbers(&label_map, &reverse_label_map);
-		while (getline(cin, line)) {
-			size_t loc = line.find_first_of("(");
-			if (loc != string::npos) {
-				string name = "";
-				if (loc != 0) {
-					name = line.substr(0,loc);
-					line.erase(0,loc);
-				}
-				if (UNROOTED || SIMPLE_UNROOTED)
-					line = root(line);
-				Node *T2 = build_tree(line);
-//				if (!QUIET) {
-//					cout << "T2: ";
-//					T2->print_subtree();
-//				}
-				T2->labels_to_numbers(&label_map, &reverse_label_map);
-				if (UNROOTED)
-					T2->preorder_number();
-				names.push_back(name);
-				trees.push_back(T2);
-			}
-		}
+		if (LOAD_BINARY_FILE == "")
+			read_compact_trees(cin, UNROOTED || SIMPLE_UNROOTED, &trees,
+					&names, &label_map, &reverse_label_map);
 //		if (!QUIET) {
 //			cout << endl;
 //		}
@@ -1396,43 +1860,119 @@ int main(int argc, char *argv[]) {
 			end_j = trees.size();
 		}
 
-		for(int i = start_i; i < end_i; i++) {
-			int j = start_j;
-			if (PAIRWISE_SYMMETRIC) {
-				for(j = start_j; j < i && j < end_j; j++) {
-					cout << ",";
-				}
-			}
-			if (RF) {
-				if (UNROOTED) {
-					rf_pairwise_distance_unrooted(trees[i], trees, j, end_j);
-				}
-				else {
-					rf_pairwise_distance(trees[i], trees, j, end_j);
-				}
+		PairwiseMatrix matrix = PairwiseMatrix(start_i, end_i, start_j, end_j,
+				PAIRWISE_SYMMETRIC, PAIRWISE_FILL);
+		PairDistance distance;
+		int arg;
+		if (RF) {
+			arg = 0;
+			if (UNROOTED)
+				distance = rf_pair_distance_unrooted;
+			else
+				distance = rf_pair_distance;
+		}
+		else {
+			if (PAIRWISE_MAX) {
+				arg = PAIRWISE_MAX_SPR;
+				if (UNROOTED)
+					distance = rSPR_pair_distance_unrooted_max;
+				else
+					distance = rSPR_pair_distance_max;
 			}
 			else {
-				if (UNROOTED) {
-					if (PAIRWISE_MAX) {
-						rSPR_pairwise_distance_unrooted(trees[i], trees, PAIRWISE_MAX_SPR, j, end_j);
-					}
-					else {
-						rSPR_pairwise_distance_unrooted(trees[i], trees, j, end_j, APPROX);
-					}
-				}
-				else {
-					if (PAIRWISE_MAX) {
-						rSPR_pairwise_distance(trees[i], trees, PAIRWISE_MAX_SPR, j, end_j);
-					}
-					else {
-						rSPR_pairwise_distance(trees[i], trees, j, end_j, APPROX);
-					}
-				}
+				arg = APPROX;
+				if (UNROOTED)
+					distance = rSPR_pair_distance_unrooted;
+				else
+					distance = rSPR_pair_distance;
 			}
 		}
-		// cleanup
-		for(vector<Node *>::iterator T2 = trees.begin(); T2 != trees.end(); T2++)
-			(*T2)->delete_tree();
+		// extend an earlier matrix of the first trees
+		if (PAIRWISE_APPEND_FILE != "") {
+			string error = "";
+			int num_old_trees = 0;
+			if (!read_pairwise_matrix(PAIRWISE_APPEND_FILE, matrix,
+					&num_old_trees, &error)) {
+				cerr << "error: " << error << endl;
+				return 1;
+			}
+			if (num_old_trees > trees.size()) {
+				cerr << "error: " << PAIRWISE_APPEND_FILE
+					<< " has more trees than the input" << endl;
+				return 1;
+			}
+		}
+		if (PAIRWISE_TIERED && (UNROOTED || RF || APPROX || PAIRWISE_MAX
+				|| SHARD > 0 || CHECKPOINT_FILE != "" || PAIRWISE_BINARY_FILE != "")) {
+			cerr << "error: -pairwise_tiered only supports rooted rSPR distances"
+				<< " with text or -pairwise_sparse output" << endl;
+			return 1;
+		}
+		// order the exact searches by their approximate distance
+		bool estimate = PAIRWISE_ESTIMATE
+				|| (!RF && !APPROX && !PAIRWISE_TIERED);
+		int max_k = PAIRWISE_MAX ? PAIRWISE_MAX_SPR : INT_MAX;
+		if (SHARD > 0) {
+			// every shard splits the same tiles of the whole matrix
+			vector<PairwiseTile> all_tiles = pairwise_tiles(trees, matrix,
+					estimate, UNROOTED, max_k);
+			matrix.select_shard(all_tiles, SHARD - 1, NUM_SHARDS);
+			matrix.print_cells = true;
+			if (!PAIRWISE_ESTIMATE)
+				cout << PairwiseShard(SHARD, NUM_SHARDS, matrix).str() << endl;
+		}
+		PairCheckpoint checkpoint;
+		// an estimate only reads the checkpoint
+		if (CHECKPOINT_FILE != "" && (RESUME || !PAIRWISE_ESTIMATE)) {
+			CheckpointHeader header = checkpoint_settings(CHECKPOINT_PAIRWISE);
+			header.num_trees = trees.size();
+			header.input = CHECKPOINT_HASH_START;
+			for(int i = 0; i < trees.size(); i++) {
+				int size = trees[i].size();
+				header.input = checkpoint_hash(&size, sizeof(int), header.input);
+				header.input = checkpoint_hash(trees[i].get_data(),
+						CompactTree::data_size(size) * sizeof(int), header.input);
+			}
+			if (!open_checkpoint(&checkpoint, header))
+				return 1;
+			matrix.resume(&checkpoint);
+		}
+		vector<PairwiseTile> tiles = pairwise_tiles(trees, matrix, estimate,
+				UNROOTED, max_k);
+		BinaryMatrixWriter binary_matrix;
+		if (SHARD == 0 && PAIRWISE_BINARY_FILE != "") {
+			// no distance is more than twice the number of leaves
+			int max_distance = 0;
+			for(int i = 0; i < trees.size(); i++)
+				max_distance = max(max_distance, 2 * trees[i].num_leaves());
+			if (PAIRWISE_MAX)
+				max_distance = min(max_distance, PAIRWISE_MAX_SPR);
+			BinaryMatrixHeader header = BinaryMatrixHeader(max_distance,
+					matrix.symmetric, matrix.row_start, matrix.row_end,
+					matrix.col_start, matrix.col_end);
+			if (!PAIRWISE_ESTIMATE && !binary_matrix.open(PAIRWISE_BINARY_FILE, header)) {
+				cerr << "error: could not write " << PAIRWISE_BINARY_FILE << endl;
+				return 1;
+			}
+			matrix.binary = &binary_matrix;
+		}
+		else if (SHARD == 0 && PAIRWISE_SPARSE) {
+			matrix.sparse = true;
+		}
+		if (PAIRWISE_ESTIMATE)
+			pairwise_estimate(trees, matrix, distance, arg,
+					PAIRWISE_ESTIMATE_SAMPLES);
+		else if (PAIRWISE_TIERED)
+			pairwise_tiered(trees, matrix, tiles, PAIRWISE_TIERED_MAX,
+					PAIRWISE_BUDGET);
+		else if (RF)
+			rf_pairwise_distance(trees, matrix, tiles, UNROOTED);
+		else
+			pairwise_distance(trees, matrix, tiles, distance, arg);
+		if (matrix.binary != NULL && !PAIRWISE_ESTIMATE && !binary_matrix.close()) {
+			cerr << "error: could not write " << PAIRWISE_BINARY_FILE << endl;
+			return 1;
+		}
 	}
 	else if (SEQUENCE) {
 
@@ -1608,6 +2148,8 @@ int main(int argc, char *argv[]) {
 		}
 
 	}
+	if (COUNT_BRANCHES)
+		cout << "branch nodes=" << BB_BRANCHES << endl;
 	return 0;
 }
 
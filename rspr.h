@@ -47,19 +47,31 @@ along with rspr.  If not, see <http://www.gnu.org/licenses/>.
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <climits>
+#include <cmath>
 #include <vector>
 #include <map>
 #include <set>
 #include <list>
 #include <algorithm>
+#include <chrono>
+#include <unordered_map>
 #include "Forest.h"
 #include "ClusterForest.h"
 #include "LCA.h"
 #include "ClusterInstance.h"
 #include "SiblingPair.h"
 #include "UndoMachine.h"
+#include "CompactTree.h"
+#include "Bipartitions.h"
+#include "LineReader.h"
+#include "Checkpoint.h"
+#include "BinaryMatrix.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -100,13 +112,17 @@ int rSPR_branch_and_bound_range(Forest *T1, Forest *T2, int end_k);
 int rSPR_branch_and_bound_range(Forest *T1, Forest *T2, int start_k,
 		int end_k);
 int rSPR_branch_and_bound_hlpr(Forest *T1, Forest *T2, int k,
-		set<SiblingPair> *sibling_pairs, list<Node *> *singletons, bool cut_b_only,
+		SiblingPairSet *sibling_pairs, list<Node *> *singletons, bool cut_b_only,
 		list<pair<Forest,Forest> > *AFs, list<Node *> *protected_stack,
 		int *num_ties);
 int rSPR_branch_and_bound_hlpr(Forest *T1, Forest *T2, int k,
-		set<SiblingPair> *sibling_pairs, list<Node *> *singletons, bool cut_b_only,
+		SiblingPairSet *sibling_pairs, list<Node *> *singletons, bool cut_b_only,
 		list<pair<Forest,Forest> > *AFs, list<Node *> *protected_stack,
 		int *num_ties, Node *prev_T1_a, Node *prev_T1_c);
+#ifdef _OPENMP
+int rSPR_branch_and_bound_parallel(Forest *T1, Forest *T2, int k,
+		list<pair<Forest,Forest> > *AFs);
+#endif
 int rSPR_total_approx_distance(Node *T1, vector<Node *> &gene_trees);
 int rSPR_total_approx_distance(Node *T1, vector<Node *> &gene_trees,
 		int threshold);
@@ -145,6 +161,14 @@ bool chain_match(Node *T1_node, Node *T2_node, Node *T2_node_end);
 Node *find_subtree_of_approx_distance(Node *n, Forest *F1, Forest *F2, int target_size);
 Node *find_best_root(Node *T1, Node *T2);
 double find_best_root_acc(Node *T1, Node *T2);
+int find_best_root_acc_count(Node *n, vector<int> &side, int total,
+		Node **lca);
+void find_best_root_acc_hlpr(Node *n, vector<int> &side, int group_1_total,
+		int group_2_total, double *best_root_b_acc, int *num_ties,
+		int *p_group_1_descendants, int *p_group_2_descendants);
+void find_best_root_acc_score(int group_1_descendants,
+		int group_2_descendants, int group_1_total, int group_2_total,
+		double *best_root_b_acc, int *num_ties);
 void find_best_root_hlpr(Node *T2, int pre_separator, int group_1_total,
 		int group_2_total, Node **best_root, double *best_root_b_acc);
 void find_best_root_hlpr(Node *n, int pre_separator, int group_1_total,
@@ -190,7 +214,12 @@ bool CUT_ALL_B = false;
 bool CUT_AC_SEPARATE_COMPONENTS = false;
 bool CUT_ONE_AB = false;
 bool CLUSTER_REDUCTION = false;
+// set for each pair, so each thread keeps its own
 bool PREFER_RHO = false;
+#pragma omp threadprivate(PREFER_RHO)
+// a cluster cut off by max_k adds the k it reached, not its approximation
+bool CUT_OFF_ABOVE_MAX = false;
+#pragma omp threadprivate(CUT_OFF_ABOVE_MAX)
 bool MAIN_CALL = true;
 bool MEMOIZE = false;
 bool MULTIFURCATING = false;
@@ -198,6 +227,8 @@ bool MULT_4_BRANCH = false;
 bool USE_CASE_7 = true;
 bool ALL_MAFS = false;
 int NUM_CLUSTERS = 0;
+bool COUNT_BRANCHES = false;
+long long BB_BRANCHES = 0;
 int MAX_CLUSTERS = -1;
 bool UNROOTED_MIN_APPROX = false;
 bool VERBOSE = false;
@@ -206,6 +237,9 @@ int MAX_SPR = 1000;
 int CLUSTER_MAX_SPR = MAX_SPR;
 int MIN_SPR = 0;
 bool FIND_RATE = false;
+// distances of -total gene trees, keyed by (TOTAL_CHECKPOINT_ROW, tree)
+PairCheckpoint *TOTAL_CHECKPOINT = NULL;
+int TOTAL_CHECKPOINT_ROW = 0;
 bool EDGE_PROTECTION = false;
 bool EDGE_PROTECTION_TWO_B = false;
 bool ABORT_AT_FIRST_SOLUTION = false;
@@ -226,21 +260,636 @@ bool check_all_pairs = true;
 bool PREFER_NONBRANCHING = false;
 int CLUSTER_TUNE = -1;
 int SIMPLE_UNROOTED_LEAF = 0;
+bool PARALLEL_BB = false;
+bool PARALLEL_CLUSTERS = false;
+bool MEMOIZE_SEARCH = false;
+int MAX_BRANCH_MEMO = 1 << 21;
+
+int MEMOIZE_CAPACITY = 100000;
+
+/* find_finished_groups
+ * Find the nodes of the component of a finished forest that holds each
+ * node below n. group[l] is the component holding label l and size[g]
+ * the number of leaves of component g. Sets *open to the component
+ * that continues above n, or -1, and roots[g] to the top of component
+ * g. Returns false if the components are not an agreement forest of n
+ */
+bool find_finished_groups(Node *n, vector<int> &group, vector<int> &size,
+		vector<Node *> *roots, unordered_map<Node *, int> *member,
+		int *open, int *count) {
+	*open = -1;
+	*count = 0;
+	if (n->is_leaf()) {
+		int number = n->get_label_number();
+		if (number >= group.size() || group[number] < 0)
+			return false;
+		*open = group[number];
+		*count = 1;
+	}
+	else {
+		if (!n->str().empty())
+			return false;
+		list<Node *>::iterator c;
+		for(c = n->get_children().begin(); c != n->get_children().end(); c++) {
+			int child_open;
+			int child_count;
+			if (!find_finished_groups(*c, group, size, roots, member,
+						&child_open, &child_count))
+				return false;
+			if (child_open < 0)
+				continue;
+			// components are disjoint
+			if (*open >= 0 && *open != child_open)
+				return false;
+			*open = child_open;
+			*count += child_count;
+		}
+		if (*open < 0)
+			return true;
+	}
+	(*member)[n] = *open;
+	if (*count == size[*open]) {
+		(*roots)[*open] = n;
+		*open = -1;
+	}
+	return true;
+}
+
+// the component g below n as written by Forest::str()
+void str_finished_component(Node *n, int g, unordered_map<Node *, int> &member,
+		string *s) {
+	if (n->is_leaf()) {
+		*s += n->str();
+		return;
+	}
+	vector<Node *> children = vector<Node *>();
+	list<Node *>::iterator c;
+	for(c = n->get_children().begin(); c != n->get_children().end(); c++) {
+		unordered_map<Node *, int>::iterator m = member.find(*c);
+		if (m != member.end() && m->second == g)
+			children.push_back(*c);
+	}
+	if (children.size() == 1) {
+		str_finished_component(children[0], g, member, s);
+		return;
+	}
+	*s += "(";
+	for(int i = 0; i < children.size(); i++) {
+		if (i > 0)
+			*s += ",";
+		str_finished_component(children[i], g, member, s);
+	}
+	*s += ")";
+}
 
+/* ProblemSolution
+ * A solved subproblem: the exact distance and, if the forests were kept,
+ * the finished forests. These are stored as the label numbers of each
+ * component of the finished T1, each followed by -1 (rho is just -1), and
+ * the component of T1 matching each component of T2. restore() builds
+ * the finished forests from the unsolved ones
+ */
 class ProblemSolution {
 public:
-string T1;
-string T2;
+vector<int> components;
+vector<int> T2_order;
 int k;
 
+ProblemSolution() {
+	k = -1;
+}
+ProblemSolution(int new_k) {
+	k = new_k;
+}
 ProblemSolution(Forest *t1, Forest *t2, int new_k) {
-	T1 = t1->str();
-	T2 = t2->str();
 	k = new_k;
+	vector<int> group = vector<int>();
+	int rho_group = -1;
+	for(int i = 0; i < t1->num_components(); i++) {
+		Node *component = t1->get_component(i);
+		if (component->is_rho()) {
+			rho_group = i;
+			components.push_back(-1);
+			continue;
+		}
+		vector<int> numbers = vector<int>();
+		component->find_label_numbers(&numbers);
+		if (numbers.empty()) {
+			components.clear();
+			return;
+		}
+		for(int j = 0; j < numbers.size(); j++) {
+			components.push_back(numbers[j]);
+			if (numbers[j] >= group.size())
+				group.resize(numbers[j] + 1, -1);
+			group[numbers[j]] = i;
+		}
+		components.push_back(-1);
+	}
+	for(int i = 0; i < t2->num_components(); i++) {
+		Node *component = t2->get_component(i);
+		int g = rho_group;
+		if (!component->is_rho()) {
+			int number = component->get_c_subtree_label_number();
+			g = (number < group.size() ? group[number] : -1);
+		}
+		if (g < 0) {
+			components.clear();
+			T2_order.clear();
+			return;
+		}
+		T2_order.push_back(g);
+	}
+}
+
+bool has_forests() {
+	return !components.empty();
+}
+
+/* the finished forest of F as a forest of single nodes named by their
+ * component, in the order of order. NULL if F does not match
+ */
+Forest *restore_forest(Forest *F, vector<int> &group, vector<int> &size,
+		vector<int> &order) {
+	vector<Node *> roots = vector<Node *>(size.size(), NULL);
+	unordered_map<Node *, int> member = unordered_map<Node *, int>();
+	for(int i = 0; i < F->num_components(); i++) {
+		Node *component = F->get_component(i);
+		if (component->is_rho())
+			continue;
+		int open;
+		int count;
+		if (!find_finished_groups(component, group, size, &roots, &member,
+					&open, &count) || open >= 0)
+			return NULL;
+	}
+	Forest *new_forest = new Forest();
+	for(int i = 0; i < order.size(); i++) {
+		int g = order[i];
+		if (size[g] == 0) {
+			new_forest->add_component(new Node("p"));
+			new_forest->set_rho(true);
+			continue;
+		}
+		if (roots[g] == NULL) {
+			delete new_forest;
+			return NULL;
+		}
+		string name = "";
+		str_finished_component(roots[g], g, member, &name);
+		new_forest->add_component(new Node(name));
+	}
+	return new_forest;
+}
+
+/* replace T1 and T2 by their finished forests. Returns false, leaving
+ * them unchanged, if they are not the forests this solution was found for
+ */
+bool restore(Forest *T1, Forest *T2) {
+	vector<int> group = vector<int>();
+	vector<int> size = vector<int>();
+	vector<int> order = vector<int>();
+	int g = 0;
+	size.push_back(0);
+	for(int i = 0; i < components.size(); i++) {
+		if (components[i] < 0) {
+			order.push_back(g++);
+			size.push_back(0);
+			continue;
+		}
+		if (components[i] >= group.size())
+			group.resize(components[i] + 1, -1);
+		group[components[i]] = g;
+	}
+	size.pop_back();
+	// count the leaves of the unsolved forest in each component
+	vector<Node *> leaves = vector<Node *>();
+	for(int i = 0; i < T1->num_components(); i++) {
+		vector<Node *> component_leaves = T1->get_component(i)->find_leaves();
+		leaves.insert(leaves.end(), component_leaves.begin(),
+				component_leaves.end());
+	}
+	for(int i = 0; i < leaves.size(); i++) {
+		if (leaves[i]->is_rho())
+			continue;
+		int number = leaves[i]->get_label_number();
+		if (number >= group.size() || group[number] < 0)
+			return false;
+		size[group[number]]++;
+	}
+	Forest *new_T1 = restore_forest(T1, group, size, order);
+	if (new_T1 == NULL)
+		return false;
+	Forest *new_T2 = restore_forest(T2, group, size, T2_order);
+	if (new_T2 == NULL) {
+		delete new_T1;
+		return false;
+	}
+	T1->swap(new_T1);
+	T2->swap(new_T2);
+	sync_twins(T1, T2);
+	delete new_T1;
+	delete new_T2;
+	return true;
+}
+	};
+
+/* 64 bit hash mixing (splitmix64) */
+inline unsigned long long hash_mix(unsigned long long h) {
+	h += 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+unsigned long long hash_string(const string &s, unsigned long long seed) {
+	unsigned long long h = seed ^ 0xcbf29ce484222325ULL;
+	for(int i = 0; i < s.size(); i++) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ULL;
+	}
+	return hash_mix(h);
+}
+
+/* structural hash of a subtree. The order of children is ignored as it
+ * does not change the distance. Leaves without a label number, such as
+ * the cluster placeholders, are counted in placeholders
+ */
+unsigned long long hash_subtree(Node *n, unsigned long long seed,
+		int *placeholders) {
+	if (n->is_leaf()) {
+		if (n->get_label_number() == INT_MAX && !n->is_rho())
+			(*placeholders)++;
+		return hash_string(n->str(), seed);
+	}
+	unsigned long long h = 0;
+	list<Node *>::iterator c;
+	for(c = n->get_children().begin(); c != n->get_children().end(); c++) {
+		h += hash_mix(hash_subtree(*c, seed, placeholders));
+	}
+	return hash_mix(h ^ seed);
+}
+
+// the first component is the root component, the others are unordered
+unsigned long long hash_forest(Forest *F, unsigned long long seed,
+		int *placeholders) {
+	unsigned long long h = 0;
+	for(int i = 1; i < F->num_components(); i++) {
+		h += hash_mix(hash_subtree(F->get_component(i), seed, placeholders));
+	}
+	if (F->num_components() > 0)
+		h ^= hash_subtree(F->get_component(0), ~seed, placeholders);
+	return hash_mix(h + seed);
+}
+
+/* ProblemKey
+ * 128 bit structural hash of a pair of forests. Placeholders all hash
+ * the same, so the key does not say which placeholders of T1 and T2
+ * match when a forest has more than one. Such keys are not valid()
+ */
+class ProblemKey {
+public:
+unsigned long long h1;
+unsigned long long h2;
+int placeholders;
+
+ProblemKey() {
+	h1 = 0;
+	h2 = 0;
+	placeholders = 0;
+}
+ProblemKey(Forest *T1, Forest *T2) {
+	int T1_placeholders = 0;
+	int T2_placeholders = 0;
+	h1 = hash_forest(T1, 0x51ed270b27a3c1d9ULL, &T1_placeholders);
+	h2 = hash_forest(T2, 0x2545f4914f6cdd1dULL, &T2_placeholders);
+	if (MULTIFURCATING)
+		h2 = hash_mix(h2);
+	placeholders = max(T1_placeholders, T2_placeholders);
+}
+bool valid() const {
+	return placeholders <= 1;
+}
+bool operator==(const ProblemKey &k) const {
+	return h1 == k.h1 && h2 == k.h2;
 }
 	};
 
-	map<string, ProblemSolution> memoized_clusters = map<string, ProblemSolution>();
+struct ProblemKeyHash {
+	size_t operator()(const ProblemKey &k) const {
+		return k.h1 ^ (k.h2 * 0x9e3779b97f4a7c15ULL);
+	}
+};
+
+/* SolutionTable
+ * Solved subproblems keyed by ProblemKey. Holds at most capacity
+ * entries, evicting the least recently used.
+ */
+class SolutionTable {
+	typedef list<pair<ProblemKey, ProblemSolution> > EntryList;
+	// most recently used first
+	EntryList entries;
+	unordered_map<ProblemKey, EntryList::iterator, ProblemKeyHash> index;
+
+public:
+	SolutionTable() {
+		entries = EntryList();
+		index = unordered_map<ProblemKey, EntryList::iterator, ProblemKeyHash>();
+	}
+
+	bool find(const ProblemKey &key, ProblemSolution *solution) {
+		unordered_map<ProblemKey, EntryList::iterator, ProblemKeyHash>::iterator i =
+			index.find(key);
+		if (i == index.end())
+			return false;
+		entries.splice(entries.begin(), entries, i->second);
+		*solution = i->second->second;
+		return true;
+	}
+
+	void insert(const ProblemKey &key, const ProblemSolution &solution) {
+		if (MEMOIZE_CAPACITY <= 0)
+			return;
+		unordered_map<ProblemKey, EntryList::iterator, ProblemKeyHash>::iterator i =
+			index.find(key);
+		if (i != index.end()) {
+			i->second->second = solution;
+			entries.splice(entries.begin(), entries, i->second);
+			return;
+		}
+		entries.push_front(make_pair(key, solution));
+		index[key] = entries.begin();
+		while (entries.size() > MEMOIZE_CAPACITY) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+
+	int size() {
+		return index.size();
+	}
+
+	void clear() {
+		entries.clear();
+		index.clear();
+	}
+};
+
+	SolutionTable memoized_clusters = SolutionTable();
+
+/* BranchReplay
+ * One task of the parallel branch and bound. The first path.size()
+ * branch points of the search are forced to the recorded branch
+ * (0 = cut a, 1 = cut b, 2 = cut c). Reaching the next branch point
+ * above split_depth records its three branches as new tasks instead of
+ * exploring them.
+ */
+const int BRANCH_ALL = -1;
+const int BRANCH_SPLIT = -2;
+
+class BranchReplay {
+public:
+	vector<int> path;
+	int depth;
+	int split_depth;
+	list<vector<int> > spawned;
+	bool *cancel;
+
+	BranchReplay(vector<int> &path, int split_depth, bool *cancel) {
+		this->path = path;
+		this->depth = 0;
+		this->split_depth = split_depth;
+		this->spawned = list<vector<int> >();
+		this->cancel = cancel;
+	}
+
+	// the branch to take at the next branch point
+	int next_branch() {
+		if (depth < path.size())
+			return path[depth++];
+		if (depth < split_depth) {
+			depth++;
+			for(int b = 0; b < 3; b++) {
+				spawned.push_back(path);
+				spawned.back().push_back(b);
+			}
+			return BRANCH_SPLIT;
+		}
+		return BRANCH_ALL;
+	}
+
+	bool cancelled() {
+		bool c;
+		#pragma omp atomic read
+		c = *cancel;
+		return c;
+	}
+
+	void cancel_all() {
+		#pragma omp atomic write
+		*cancel = true;
+	}
+};
+
+// replay state of the task running on this thread, if any
+BranchReplay *BB_REPLAY = NULL;
+#pragma omp threadprivate(BB_REPLAY)
+
+/* BranchDeadline
+ * A time limit for the branch and bound searches of a thread. Once it
+ * has passed, every search call fails at once, like a cancelled
+ * BranchReplay, so the searches unwind without a result. Clusters solved
+ * in parallel share the deadline of the calling thread
+ */
+class BranchDeadline {
+public:
+	chrono::steady_clock::time_point end;
+
+	BranchDeadline(double seconds) {
+		end = chrono::steady_clock::now()
+				+ chrono::duration_cast<chrono::steady_clock::duration>(
+				chrono::duration<double>(seconds));
+	}
+
+	bool expired() {
+		return chrono::steady_clock::now() >= end;
+	}
+};
+
+// time limit of the searches on this thread, if any
+BranchDeadline *BB_DEADLINE = NULL;
+#pragma omp threadprivate(BB_DEADLINE)
+
+inline bool branch_deadline_expired() {
+	return BB_DEADLINE != NULL && BB_DEADLINE->expired();
+}
+
+/* BranchMemo
+ * A node of the branch and bound search tree kept between the iterations
+ * over k. The checks that depend on k only get weaker as k grows, so a
+ * node whose subtree failed without hitting one of these checks fails
+ * for every k. The flag only holds for the search state it was set in,
+ * so each node keeps the key of that state and is reset when a later
+ * iteration reaches it with a different one. Passing the approximation
+ * bound is not remembered: the approximation does not restore the
+ * child order of multifurcating nodes, so skipping it changes the rest
+ * of the search.
+ */
+class BranchMemo {
+public:
+	BranchMemo *children[3];
+	bool dead;
+	bool has_state;
+	unsigned long long state;
+	// number of nodes in this search tree
+	int *size;
+
+	BranchMemo(int *size) {
+		for(int b = 0; b < 3; b++)
+			children[b] = NULL;
+		dead = false;
+		has_state = false;
+		state = 0;
+		this->size = size;
+		(*size)++;
+	}
+	~BranchMemo() {
+		clear_children();
+		(*size)--;
+	}
+
+	// the node for branch b, if there is room for it
+	BranchMemo *child(int b) {
+		if (children[b] == NULL && *size < MAX_BRANCH_MEMO)
+			children[b] = new BranchMemo(size);
+		return children[b];
+	}
+
+	void clear_children() {
+		for(int b = 0; b < 3; b++) {
+			if (children[b] != NULL) {
+				delete children[b];
+				children[b] = NULL;
+			}
+		}
+	}
+
+	void set_dead() {
+		dead = true;
+		clear_children();
+	}
+
+	// forget what was learned if this node now stands for another state
+	void visit(unsigned long long new_state) {
+		if (has_state && state == new_state)
+			return;
+		clear_children();
+		dead = false;
+		has_state = true;
+		state = new_state;
+	}
+};
+
+// search tree node of the next call of rSPR_branch_and_bound_hlpr
+BranchMemo *BB_MEMO = NULL;
+// set when a search fails because k is too small
+bool BB_BUDGET_LIMITED = false;
+#pragma omp threadprivate(BB_MEMO, BB_BUDGET_LIMITED)
+
+inline BranchMemo *branch_memo_child(BranchMemo *memo, int b) {
+	if (memo == NULL)
+		return NULL;
+	return memo->child(b);
+}
+
+/* BranchMemoKeys
+ * Nodes of the forests of a search state numbered in traversal order.
+ * The forests of each iteration are fresh copies, and the multifurcating
+ * search adds unnumbered nodes, so a node is known by its position rather
+ * than its address or preorder number
+ */
+class BranchMemoKeys {
+public:
+	unordered_map<Node *, unsigned long long> index;
+
+	void add(Forest *F, unsigned long long tag) {
+		vector<Node *> stack = vector<Node *>();
+		for(int i = 0; i < F->num_components(); i++) {
+			stack.push_back(F->get_component(i));
+			while (!stack.empty()) {
+				Node *n = stack.back();
+				stack.pop_back();
+				index[n] = tag | index.size();
+				list<Node *>::iterator c;
+				for(c = n->get_children().begin(); c != n->get_children().end(); c++)
+					stack.push_back(*c);
+			}
+		}
+	}
+
+	// position of n, or its preorder number if it is not in the forests
+	unsigned long long key(Node *n) {
+		if (n == NULL)
+			return 0;
+		unordered_map<Node *, unsigned long long>::iterator i = index.find(n);
+		if (i != index.end())
+			return i->second;
+		return (unsigned long long)(n->get_preorder_number() + 2) << 40;
+	}
+};
+
+/* hash of the forest nodes, their labels, twins and protection, in
+ * traversal order
+ */
+unsigned long long hash_search_forest(Forest *F, BranchMemoKeys &keys,
+		unsigned long long h) {
+	vector<Node *> stack = vector<Node *>();
+	for(int i = 0; i < F->num_components(); i++) {
+		h = hash_mix(h ^ (unsigned long long)i);
+		stack.push_back(F->get_component(i));
+		while (!stack.empty()) {
+			Node *n = stack.back();
+			stack.pop_back();
+			unsigned long long x = (unsigned long long)(n->get_preorder_number() + 2);
+			x ^= keys.key(n->get_twin()) * 0x9e3779b97f4a7c15ULL;
+			x += (unsigned long long)n->get_children().size() << 1;
+			x += n->is_protected();
+			h = hash_mix(h ^ x);
+			list<Node *>::iterator c;
+			for(c = n->get_children().begin(); c != n->get_children().end(); c++)
+				stack.push_back(*c);
+		}
+	}
+	return h;
+}
+
+/* key of the state a call of rSPR_branch_and_bound_hlpr starts from,
+ * everything except k
+ */
+unsigned long long branch_memo_state(Forest *T1, Forest *T2,
+		SiblingPairSet *sibling_pairs, list<Node *> *singletons,
+		list<Node *> *protected_stack, bool cut_b_only,
+		Node *prev_T1_a, Node *prev_T1_c) {
+	BranchMemoKeys keys = BranchMemoKeys();
+	keys.add(T1, 1ULL << 32);
+	keys.add(T2, 2ULL << 32);
+	unsigned long long h = hash_search_forest(T1, keys, 0x51ed270b27a3c1d9ULL);
+	h = hash_search_forest(T2, keys, h);
+	for (SiblingPairSet::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
+		h = hash_mix(h ^ keys.key((*i).a));
+		h = hash_mix(h ^ keys.key((*i).c));
+	}
+	h = hash_mix(h ^ 1);
+	list<Node *>::iterator n;
+	for(n = singletons->begin(); n != singletons->end(); n++)
+		h = hash_mix(h ^ keys.key(*n));
+	h = hash_mix(h ^ 2);
+	for(n = protected_stack->begin(); n != protected_stack->end(); n++)
+		h = hash_mix(h ^ keys.key(*n));
+	h = hash_mix(h ^ keys.key(prev_T1_a));
+	h = hash_mix(h ^ keys.key(prev_T1_c));
+	return hash_mix(h ^ cut_b_only ^ (T1->contains_rho() << 1));
+}
 
 /*******************************************************************************
 	RSPR WORSE_3_MULT_APPROX
@@ -1052,6 +1701,8 @@ int rSPR_branch_and_bound_mult_hlpr(Forest *T1, Forest *T2,
   if (k < 0) {
     return k;
   }
+  if (branch_deadline_expired())
+    return -1;
   Node* previous_group = sibling_groups->back();
   int best_k = -1;
   while(!singletons->empty() || !sibling_groups->empty()) {
@@ -2563,9 +3214,9 @@ while(!singletons->empty()) {
 		continue;
 	bool potential_new_sibling_pair = T1_a_parent->is_sibling_pair();
 	// cut the edge above T1_a
-	um.add_event(new CutParent(T1_a));
+	um.add_event(CutParent(T1_a));
 	T1_a->cut_parent();
-	um.add_event(new AddComponent(T1));
+	um.add_event(AddComponent(T1));
 	T1->add_component(T1_a);
 	//if (T1_a->get_sibling_pair_status() > 0)
 	//	T1_a->clear_sibling_pair(sibling_pairs);
@@ -2575,7 +3226,7 @@ while(!singletons->empty()) {
 	Node *node = T1_a_parent->contract();
 	if (node != NULL && potential_new_sibling_pair &&
 			node->is_sibling_pair()){
-		um.add_event(new AddToFrontSiblingPairs(sibling_pairs));
+		um.add_event(AddToFrontSiblingPairs(sibling_pairs));
 		sibling_pairs->push_front(node->rchild());
 		sibling_pairs->push_front(node->lchild());
 	}
@@ -2609,7 +3260,7 @@ if(!sibling_pairs->empty()) {
 //						cout << "invalid" << endl;
 //						sibling_pairs->erase(T1_c_i);
 //						sibling_pairs->erase(T1_a_i);
-//						um.add_event(new PopSiblingPair(T1_a, T1_c, sibling_pairs));
+//						um.add_event(PopSiblingPair(T1_a, T1_c, sibling_pairs));
 //						continue;
 //					}
 //					else {
@@ -2643,7 +3294,7 @@ if(!sibling_pairs->empty()) {
 	sibling_pairs->pop_back();
 	Node *T1_c = sibling_pairs->back();
 	sibling_pairs->pop_back();
-	um.add_event(new PopSiblingPair(T1_a, T1_c, sibling_pairs));
+	um.add_event(PopSiblingPair(T1_a, T1_c, sibling_pairs));
 
 	//if (T1_a->get_sibling_pair_status() == 0 ||
 	//		T1_c->get_sibling_pair_status() == 0) {
@@ -2685,18 +3336,18 @@ if(!sibling_pairs->empty()) {
 			T2->print_components();
 		#endif
 		Node *T2_ac = T2_a->parent();
-		um.add_event(new ContractSiblingPair(T1_ac));
+		um.add_event(ContractSiblingPair(T1_ac));
 		T1_ac->contract_sibling_pair_undoable();
-		um.add_event(new ContractSiblingPair(T2_ac, T2_a, T2_c, &um));
+		um.add_event(ContractSiblingPair(T2_ac, T2_a, T2_c, &um));
 		Node *T2_ac_new = T2_ac->contract_sibling_pair_undoable(T2_a, T2_c);
 		if (T2_ac_new != NULL && T2_ac_new != T2_ac) {
 			T2_ac = T2_ac_new;
-			um.add_event(new CreateNode(T2_ac));
-			um.add_event(new ContractSiblingPair(T2_ac));
+			um.add_event(CreateNode(T2_ac));
+			um.add_event(ContractSiblingPair(T2_ac));
 			T2_ac->contract_sibling_pair_undoable();
 		}
-		um.add_event(new SetTwin(T1_ac));
-		um.add_event(new SetTwin(T2_ac));
+		um.add_event(SetTwin(T1_ac));
+		um.add_event(SetTwin(T2_ac));
 		T1_ac->set_twin(T2_ac);
 		T2_ac->set_twin(T1_ac);
 		//T2_ac->fix_contracted_order();
@@ -2711,7 +3362,7 @@ if(!sibling_pairs->empty()) {
 			singletons->push_back(T2_ac);
 		// check if T1_ac is part of a sibling pair
 		if (T1_ac->parent() != NULL && T1_ac->parent()->is_sibling_pair()) {
-			um.add_event(new AddToSiblingPairs(sibling_pairs));
+			um.add_event(AddToSiblingPairs(sibling_pairs));
 			sibling_pairs->push_back(T1_ac->parent()->lchild());
 			sibling_pairs->push_back(T1_ac->parent()->rchild());
 		}
@@ -2770,7 +3421,7 @@ if(!sibling_pairs->empty()) {
 		if (APPROX_CUT_ONE_B && T2_a->parent() != NULL && T2_a->parent()->parent() != NULL && T2_a->parent()->parent() == T2_c->parent() && !multi_node
 						&& (!APPROX_EDGE_PROTECTION || !T2_b->is_protected())) {
 			cut_b_only = true;
-			um.add_event(new AddToSiblingPairs(sibling_pairs));
+			um.add_event(AddToSiblingPairs(sibling_pairs));
 			sibling_pairs->push_back(T1_c);
 			sibling_pairs->push_back(T1_a);
 		}
@@ -2873,7 +3524,7 @@ if(!sibling_pairs->empty()) {
 								|| !T2_b->is_protected()
 								|| T2_a->parent()->get_children().size() > 2)))) {
 //					|| cut_a_only)) {
-				um.add_event(new CutParent(T1_a));
+				um.add_event(CutParent(T1_a));
 				T1_a->cut_parent();
 				cut_a = true;
 
@@ -2890,7 +3541,7 @@ if(!sibling_pairs->empty()) {
 								|| !T2_c->get_sibling()->is_protected()
 								|| T2_c->parent()->get_children().size() > 2)))) {// &&
 //					|| cut_c_only)) {
-				um.add_event(new CutParent(T1_c));
+				um.add_event(CutParent(T1_c));
 				T1_c->cut_parent();
 				cut_c = true;
 
@@ -2903,7 +3554,7 @@ if(!sibling_pairs->empty()) {
 			// contract parents
 			// check for T1_ac sibling pair
 			if (node && node->is_sibling_pair()){
-				um.add_event(new AddToSiblingPairs(sibling_pairs));
+				um.add_event(AddToSiblingPairs(sibling_pairs));
 				sibling_pairs->push_back(node->lchild());
 				sibling_pairs->push_back(node->rchild());
 			}
@@ -2916,7 +3567,7 @@ if(!sibling_pairs->empty()) {
 		Node *T2_ab_parent = T2_ab->parent();
 		node = T2_ab;
 		if (cut_a) {
-			um.add_event(new CutParent(T2_a));
+			um.add_event(CutParent(T2_a));
 			T2_a->cut_parent();
 
 			//ContractEvent(&um, T2_ab);
@@ -2932,19 +3583,19 @@ if(!sibling_pairs->empty()) {
 //					|| cut_b_only)) {
 			if (multi_node) {
 				T2_b = T2_ab;
-				um.add_event(new CutParent(T2_ab));
+				um.add_event(CutParent(T2_ab));
 				T2_ab->cut_parent();
 				if (T2_a->parent() != NULL) {
-					um.add_event(new CutParent(T2_a));
+					um.add_event(CutParent(T2_a));
 					T2_a->cut_parent();
-					um.add_event(new AddChild(T2_a));
+					um.add_event(AddChild(T2_a));
 					T2_ab_parent->add_child(T2_a);
 				}
 				else
 					node = T2_ab_parent;
 			}
 			else {
-				um.add_event(new CutParent(T2_b));
+				um.add_event(CutParent(T2_b));
 				T2_b->cut_parent();
 				//ContractEvent(&um, node);
 				//node = node->contract();
@@ -2971,7 +3622,7 @@ if(!sibling_pairs->empty()) {
 		// ignore T2_c if it is a singleton
 		if (cut_c && T2_c != node && T2_c->parent() != NULL) {
 			Node *T2_c_parent = T2_c->parent();
-			um.add_event(new CutParent(T2_c));
+			um.add_event(CutParent(T2_c));
 			T2_c->cut_parent();
 			ContractEvent(&um, T2_c_parent);
 			node = T2_c_parent->contract();
@@ -2985,22 +3636,22 @@ if(!sibling_pairs->empty()) {
 
 		
 		if (cut_a) {
-			um.add_event(new AddComponent(T1));
+			um.add_event(AddComponent(T1));
 			T1->add_component(T1_a);
-			um.add_event(new AddComponent(T2));
+			um.add_event(AddComponent(T2));
 			T2->add_component(T2_a);
 		}
 		if (cut_c) {
-			um.add_event(new AddComponent(T1));
+			um.add_event(AddComponent(T1));
 			T1->add_component(T1_c);
 		}
 		if (cut_b) {
-			um.add_event(new AddComponent(T2));
+			um.add_event(AddComponent(T2));
 			T2->add_component(T2_b);
 		}
 		// problem if c is deleted
 		if (add_T2_c) {
-			um.add_event(new AddComponent(T2));
+			um.add_event(AddComponent(T2));
 			T2->add_component(T2_c);
 		}
 
@@ -3020,8 +3671,8 @@ if(!sibling_pairs->empty()) {
 // if the first component of the forests differ then we have cut p
 if (T1->get_component(0)->get_twin() != T2->get_component(0)) {
 	if (!T1->contains_rho()) {
-		um.add_event(new AddRho(T1));
-		um.add_event(new AddRho(T2));
+		um.add_event(AddRho(T1));
+		um.add_event(AddRho(T2));
 		T1->add_rho();
 		T2->add_rho();
 	}
@@ -3140,9 +3791,9 @@ while(!singletons->empty()) {
 		continue;
 	bool potential_new_sibling_pair = T1_a_parent->is_sibling_pair();
 	// cut the edge above T1_a
-	um.add_event(new CutParent(T1_a));
+	um.add_event(CutParent(T1_a));
 	T1_a->cut_parent();
-	um.add_event(new AddComponent(T1));
+	um.add_event(AddComponent(T1));
 	T1->add_component(T1_a);
 	//if (T1_a->get_sibling_pair_status() > 0)
 	//	T1_a->clear_sibling_pair(sibling_pairs);
@@ -3151,7 +3802,7 @@ while(!singletons->empty()) {
 	ContractEvent(&um, T1_a_parent);
 	Node *node = T1_a_parent->contract();
 	if (node != NULL && potential_new_sibling_pair && node->is_sibling_pair()){
-		um.add_event(new AddToFrontSiblingPairs(sibling_pairs));
+		um.add_event(AddToFrontSiblingPairs(sibling_pairs));
 		sibling_pairs->push_front(node->rchild());
 		sibling_pairs->push_front(node->lchild());
 	}
@@ -3168,7 +3819,7 @@ if(!sibling_pairs->empty()) {
 	sibling_pairs->pop_back();
 	Node *T1_c = sibling_pairs->back();
 	sibling_pairs->pop_back();
-	um.add_event(new PopSiblingPair(T1_a, T1_c, sibling_pairs));
+	um.add_event(PopSiblingPair(T1_a, T1_c, sibling_pairs));
 
 	//if (T1_a->get_sibling_pair_status() == 0 ||
 	//		T1_c->get_sibling_pair_status() == 0) {
@@ -3206,12 +3857,12 @@ if(!sibling_pairs->empty()) {
 			T2->print_components();
 		#endif
 		Node *T2_ac = T2_a->parent();
-		um.add_event(new ContractSiblingPair(T1_ac));
-		um.add_event(new ContractSiblingPair(T2_ac));
+		um.add_event(ContractSiblingPair(T1_ac));
+		um.add_event(ContractSiblingPair(T2_ac));
 		T1_ac->contract_sibling_pair_undoable();
 		T2_ac->contract_sibling_pair_undoable();
-		um.add_event(new SetTwin(T1_ac));
-		um.add_event(new SetTwin(T2_ac));
+		um.add_event(SetTwin(T1_ac));
+		um.add_event(SetTwin(T2_ac));
 		T1_ac->set_twin(T2_ac);
 		T2_ac->set_twin(T1_ac);
 		//T1->add_deleted_node(T1_a);
@@ -3224,7 +3875,7 @@ if(!sibling_pairs->empty()) {
 			singletons->push_back(T2_ac);
 		// check if T1_ac is part of a sibling pair
 		if (T1_ac->parent() != NULL && T1_ac->parent()->is_sibling_pair()) {
-			um.add_event(new AddToSiblingPairs(sibling_pairs));
+			um.add_event(AddToSiblingPairs(sibling_pairs));
 			sibling_pairs->push_back(T1_ac->parent()->lchild());
 			sibling_pairs->push_back(T1_ac->parent()->rchild());
 		}
@@ -3272,7 +3923,7 @@ if(!sibling_pairs->empty()) {
 		bool cut_b_only = false;
 		if (T2_a->parent() != NULL && T2_a->parent()->parent() != NULL && T2_a->parent()->parent() == T2_c->parent()) {
 			cut_b_only = true;
-			um.add_event(new AddToSiblingPairs(sibling_pairs));
+			um.add_event(AddToSiblingPairs(sibling_pairs));
 			sibling_pairs->push_back(T1_c);
 			sibling_pairs->push_back(T1_a);
 		}
@@ -3280,13 +3931,13 @@ if(!sibling_pairs->empty()) {
 		Node *node;
 
 		if (!cut_b_only) {
-			um.add_event(new CutParent(T1_a));
+			um.add_event(CutParent(T1_a));
 			T1_a->cut_parent();
 
 			ContractEvent(&um, T1_ac);
 			node = T1_ac->contract();
 
-			um.add_event(new CutParent(T1_c));
+			um.add_event(CutParent(T1_c));
 			T1_c->cut_parent();
 
 
@@ -3296,7 +3947,7 @@ if(!sibling_pairs->empty()) {
 			// contract parents
 			// check for T1_ac sibling pair
 			if (node && node->is_sibling_pair()){
-				um.add_event(new AddToSiblingPairs(sibling_pairs));
+				um.add_event(AddToSiblingPairs(sibling_pairs));
 				sibling_pairs->push_back(node->lchild());
 				sibling_pairs->push_back(node->rchild());
 			}
@@ -3309,7 +3960,7 @@ if(!sibling_pairs->empty()) {
 		Node *T2_ab_parent = T2_ab->parent();
 		node = T2_ab;
 		if (!cut_b_only) {
-			um.add_event(new CutParent(T2_a));
+			um.add_event(CutParent(T2_a));
 			T2_a->cut_parent();
 
 			//ContractEvent(&um, T2_ab);
@@ -3317,7 +3968,7 @@ if(!sibling_pairs->empty()) {
 		}
 		bool cut_b = false;
 		if (same_component && T2_ab_parent != NULL) {
-			um.add_event(new CutParent(T2_b));
+			um.add_event(CutParent(T2_b));
 			T2_b->cut_parent();
 			//ContractEvent(&um, node);
 			//node = node->contract();
@@ -3342,7 +3993,7 @@ if(!sibling_pairs->empty()) {
 		if (T2_c != node && T2_c->parent() != NULL && !cut_b_only) {
 
 			Node *T2_c_parent = T2_c->parent();
-			um.add_event(new CutParent(T2_c));
+			um.add_event(CutParent(T2_c));
 			T2_c->cut_parent();
 			ContractEvent(&um, T2_c_parent);
 			node = T2_c_parent->contract();
@@ -3356,22 +4007,22 @@ if(!sibling_pairs->empty()) {
 
 		
 		if (!cut_b_only) {
-			um.add_event(new AddComponent(T1));
+			um.add_event(AddComponent(T1));
 			T1->add_component(T1_a);
-			um.add_event(new AddComponent(T1));
+			um.add_event(AddComponent(T1));
 			T1->add_component(T1_c);
 			// put T2 cut parts into T2
-			um.add_event(new AddComponent(T2));
+			um.add_event(AddComponent(T2));
 			T2->add_component(T2_a);
 			// may have already been added
 		}
 		if (cut_b) {
-			um.add_event(new AddComponent(T2));
+			um.add_event(AddComponent(T2));
 			T2->add_component(T2_b);
 		}
 		// problem if c is deleted
 		if (add_T2_c) {
-			um.add_event(new AddComponent(T2));
+			um.add_event(AddComponent(T2));
 			T2->add_component(T2_c);
 		}
 
@@ -3387,8 +4038,8 @@ if(!sibling_pairs->empty()) {
 // if the first component of the forests differ then we have cut p
 if (T1->get_component(0)->get_twin() != T2->get_component(0)) {
 	if (!T1->contains_rho()) {
-		um.add_event(new AddRho(T1));
-		um.add_event(new AddRho(T2));
+		um.add_event(AddRho(T1));
+		um.add_event(AddRho(T2));
 		T1->add_rho();
 		T2->add_rho();
 	}
@@ -3437,38 +4088,34 @@ int rSPR_branch_and_bound(Forest *T1, Forest *T2) {
 
 
 int rSPR_branch_and_bound_range(Forest *T1, Forest *T2, int end_k) {
-	string problem_key;
-	map<string,ProblemSolution>::iterator i;
+	ProblemKey problem_key;
+	ProblemSolution solution;
+	bool solved = false;
 
+	bool memoize = false;
 	if (MEMOIZE) {
-problem_key = T1->str() + ":" + T2->str();
-i = memoized_clusters.find(problem_key);
-if (i != memoized_clusters.end()) {
-	//cout << "already solved: " << endl;
-	//cout << problem_key << endl;
-	//cout << i->second.T2 << endl;
-	//cout << "start" << endl;
-	Forest *new_T1 = build_finished_forest(i->second.T1);
-	//cout << "middle" << endl;
-	Forest *new_T2 = build_finished_forest(i->second.T2);
-	//cout << "end" << endl;
-	T1->swap(new_T1);
-	T2->swap(new_T2);
-	sync_twins(T1, T2);
-	delete new_T1;
-	delete new_T2;
-	return i->second.k;
-}
+problem_key = ProblemKey(T1, T2);
+memoize = problem_key.valid();
+	}
+	if (memoize) {
+#pragma omp critical(memoized_clusters)
+solved = memoized_clusters.find(problem_key, &solution);
+if (solved && solution.k > end_k)
+	return -1;
+if (solved && solution.has_forests() && solution.restore(T1, T2))
+	return solution.k;
 	}
 	Forest F1 = Forest(T1);
 	Forest F2 = Forest(T2);
 	int approx_spr = rSPR_worse_3_approx(&F1, &F2);
 	int min_spr = approx_spr / 3;
+	// only the distance is known so skip straight to it
+	if (solved && solution.k > min_spr)
+min_spr = solution.k;
 	int exact_spr = rSPR_branch_and_bound_range(T1, T2, min_spr, end_k);
-	if (MEMOIZE && exact_spr >= 0 && i == memoized_clusters.end()) {
-//string solution_key = T1->str() + ":" + T2->str();
-memoized_clusters.insert(make_pair(problem_key,
-		ProblemSolution(T1,T2,exact_spr)));
+	if (memoize && exact_spr >= 0) {
+#pragma omp critical(memoized_clusters)
+memoized_clusters.insert(problem_key, ProblemSolution(T1,T2,exact_spr));
 	}
 
 	return exact_spr;
@@ -3479,6 +4126,11 @@ int end_k) {
 	int exact_spr = -1;
 	bool in_main = MAIN_CALL;
 	MAIN_CALL = false;
+	// search tree shared by the iterations
+	int memo_size = 0;
+	BranchMemo *memo = NULL;
+	if (MEMOIZE_SEARCH && !CLUSTER_REDUCTION)
+		memo = new BranchMemo(&memo_size);
 	int k;
 	for(k = start_k; k <= end_k; k++) {
 if (in_main) {
@@ -3488,7 +4140,9 @@ if (in_main) {
 //Forest F1 = Forest(T1);
 //Forest F2 = Forest(T2);
 //exact_spr = rSPR_branch_and_bound(&F1, &F2, k);
+BB_MEMO = memo;
 exact_spr = rSPR_branch_and_bound(T1,T2, k);
+BB_MEMO = NULL;
 //if (exact_spr >= 0 || k == end_k) {
 if (exact_spr >= 0) {
 //			F1.swap(T1);
@@ -3496,6 +4150,8 @@ if (exact_spr >= 0) {
 	break;
 }
 	}
+	if (memo != NULL)
+delete memo;
 	if (in_main)
 cout << endl;
 	if (k > end_k)
@@ -3503,6 +4159,42 @@ k = -1;
 	return k;
 }
 
+/* rSPR_branch_and_bound_interval
+ * Narrow the interval [*lo,*hi] that holds the distance of T1 and T2 by
+ * running the clustered search with a limit of *lo and raising *lo to
+ * the bound it proves until a search finds the distance. Searches for
+ * k > max_k are stopped when seconds have passed, keeping the interval
+ * found so far. *hi must be the size of an agreement forest, so failing
+ * at *hi - 1 proves the distance is *hi
+ */
+void rSPR_branch_and_bound_interval(Node *T1, Node *T2, int *lo, int *hi,
+		int max_k, double seconds) {
+	BranchDeadline deadline = BranchDeadline(seconds);
+	while (*lo < *hi) {
+		bool timed = *lo > max_k;
+		if (timed) {
+			if (deadline.expired())
+				break;
+			BB_DEADLINE = &deadline;
+		}
+		// above *lo only when the search was cut off
+		CUT_OFF_ABOVE_MAX = true;
+		int k = rSPR_branch_and_bound_simple_clustering(T1, T2, false,
+				-1, *lo);
+		CUT_OFF_ABOVE_MAX = false;
+		BB_DEADLINE = NULL;
+		// a search stopped by the deadline proves nothing
+		if (timed && deadline.expired())
+			break;
+		if (k <= *lo) {
+			*hi = k;
+			*lo = k;
+			break;
+		}
+		*lo = min(k, *hi);
+	}
+}
+
 int rSPR_branch_and_bound(Forest *T1, Forest *T2, int k) {
 	return rSPR_branch_and_bound(T1, T2, k, NULL, NULL);
 }
@@ -3532,7 +4224,7 @@ return 0;
 		T2->get_component(0)->edge_preorder_interval();
 	}
 
-	set<SiblingPair> *sibling_pairs;
+	SiblingPairSet *sibling_pairs;
 	list<Node *> singletons;
 	list<pair<Forest,Forest> > AFs = list<pair<Forest,Forest> >();
 	sibling_pairs = find_sibling_pairs_set(T1);
@@ -3541,8 +4233,17 @@ return 0;
 	int num_ties = 2;
 
 
-	int final_k = 
-rSPR_branch_and_bound_hlpr(T1, T2, k, sibling_pairs, &singletons, false, &AFs, &protected_stack, &num_ties);
+	int final_k;
+#ifdef _OPENMP
+	// also reached for each cluster of the default search, unless the
+	// clusters are already solved in parallel
+	if (PARALLEL_BB && !CLUSTER_REDUCTION && !omp_in_parallel()
+			&& omp_get_max_threads() > 1)
+		final_k = rSPR_branch_and_bound_parallel(T1, T2, k, &AFs);
+	else
+#endif
+		final_k = rSPR_branch_and_bound_hlpr(T1, T2, k, sibling_pairs,
+				&singletons, false, &AFs, &protected_stack, &num_ties);
 
 //		cout << "foo" << endl;
 	// TODO: this is a cheap hack
@@ -3579,35 +4280,151 @@ final_k = k - final_k;
 	return final_k;
 }
 
-void add_sibling_pair(set<SiblingPair> *sibling_pairs, Node *a, Node *c, UndoMachine *um) {
+#ifdef _OPENMP
+// result of one finished task of the parallel branch and bound
+class BranchResult {
+public:
+	vector<int> path;
+	int k;
+	list<pair<Forest,Forest> > AFs;
+
+	BranchResult(vector<int> &path, int k) {
+		this->path = path;
+		this->k = k;
+		this->AFs = list<pair<Forest,Forest> >();
+	}
+	bool operator<(const BranchResult &r) const {
+		return path < r.path;
+	}
+};
+
+void rSPR_branch_and_bound_parallel_task(Forest *T1, Forest *T2, int k,
+		vector<int> path, int split_depth, bool *cancel,
+		list<BranchResult> *results) {
+	bool cancelled;
+	#pragma omp atomic read
+	cancelled = *cancel;
+	if (cancelled)
+		return;
+	Forest F1 = Forest(T1);
+	Forest F2 = Forest(T2);
+	sync_twins(&F1, &F2);
+	SiblingPairSet *sibling_pairs = find_sibling_pairs_set(&F1);
+	list<Node *> singletons = F2.find_singletons();
+	list<Node *> protected_stack = list<Node *>();
+	list<pair<Forest,Forest> > AFs = list<pair<Forest,Forest> >();
+	int num_ties = 2;
+
+	BranchReplay replay = BranchReplay(path, split_depth, cancel);
+	BB_REPLAY = &replay;
+	int result_k = rSPR_branch_and_bound_hlpr(&F1, &F2, k, sibling_pairs,
+			&singletons, false, &AFs, &protected_stack, &num_ties);
+	BB_REPLAY = NULL;
+	delete sibling_pairs;
+
+	if (!replay.spawned.empty()) {
+		for(list<vector<int> >::iterator i = replay.spawned.begin();
+				i != replay.spawned.end(); i++) {
+			vector<int> child = *i;
+			#pragma omp task firstprivate(child)
+			rSPR_branch_and_bound_parallel_task(T1, T2, k, child, split_depth,
+					cancel, results);
+		}
+		return;
+	}
+	if (result_k < 0 || AFs.empty())
+		return;
+	// the first solution is at the distance, as for ABORT_AT_FIRST_SOLUTION
+	if (!ALL_MAFS && (!PREFER_RHO || AFs.front().first.contains_rho()))
+		replay.cancel_all();
+	#pragma omp critical(parallel_bb_results)
+	{
+		results->push_back(BranchResult(path, result_k));
+		results->back().AFs.swap(AFs);
+	}
+}
+
+/* rSPR_branch_and_bound_parallel
+ * Solve one k of rSPR_branch_and_bound with the top branch points of the
+ * search tree split into OpenMP tasks. Each task copies T1 and T2 and
+ * replays its branch prefix with the serial helper, so T1 and T2 are
+ * not modified. The callers search k upward from a lower bound on the
+ * distance, so any solution for k is optimal and the first task to find
+ * one cancels the others (with PREFER_RHO, the first one containing
+ * rho). Ties are broken by search order rather than randomly.
+ * RETURN The remaining k as rSPR_branch_and_bound_hlpr, or -1
+ */
+int rSPR_branch_and_bound_parallel(Forest *T1, Forest *T2, int k,
+		list<pair<Forest,Forest> > *AFs) {
+	BB_MEMO = NULL;
+	// enough tasks to keep every thread busy
+	int split_depth = 1;
+	for(int tasks = 3; tasks < 16 * omp_get_max_threads(); tasks *= 3)
+		split_depth++;
+	bool cancel = false;
+	list<BranchResult> results = list<BranchResult>();
+	#pragma omp parallel copyin(PREFER_RHO)
+	{
+		#pragma omp single
+		{
+			rSPR_branch_and_bound_parallel_task(T1, T2, k, vector<int>(),
+					split_depth, &cancel, &results);
+		}
+	}
+
+	results.sort();
+	int best_k = -1;
+	list<BranchResult>::iterator best = results.end();
+	for(list<BranchResult>::iterator i = results.begin(); i != results.end();
+			i++) {
+		if (i->k > best_k || (i->k == best_k && PREFER_RHO
+					&& !best->AFs.front().first.contains_rho()
+					&& i->AFs.front().first.contains_rho())) {
+			best_k = i->k;
+			best = i;
+		}
+	}
+	if (ALL_MAFS) {
+		for(list<BranchResult>::iterator i = results.begin();
+				i != results.end(); i++)
+			AFs->splice(AFs->end(), i->AFs);
+	}
+	else if (best != results.end()) {
+		AFs->splice(AFs->end(), best->AFs, best->AFs.begin());
+	}
+	return best_k;
+}
+#endif
+
+void add_sibling_pair(SiblingPairSet *sibling_pairs, Node *a, Node *c, UndoMachine *um) {
 	SiblingPair sp = SiblingPair(a,c);
-	pair< set<SiblingPair>::iterator, bool> ins = 
+	pair<SiblingPairSet::iterator, bool> ins = 
 	sibling_pairs->insert(sp);
 	if (ins.second == false) {
-um->add_event(new RemoveSetSiblingPairs(sibling_pairs, *(ins.first)));
+um->add_event(RemoveSetSiblingPairs(sibling_pairs, *(ins.first)));
 sibling_pairs->erase(ins.first);
 ins = sibling_pairs->insert(sp);
 	}
-	um->add_event(new AddToSetSiblingPairs(sibling_pairs, *(ins.first)));
+	um->add_event(AddToSetSiblingPairs(sibling_pairs, *(ins.first)));
 }
 
-SiblingPair pop_sibling_pair(set<SiblingPair> *sibling_pairs, UndoMachine *um) {
-	set<SiblingPair>::iterator s = sibling_pairs->begin();
+SiblingPair pop_sibling_pair(SiblingPairSet *sibling_pairs, UndoMachine *um) {
+	SiblingPairSet::iterator s = sibling_pairs->begin();
 	SiblingPair spair = SiblingPair(*s); 
-	um->add_event(new RemoveSetSiblingPairs(sibling_pairs, spair));
+	um->add_event(RemoveSetSiblingPairs(sibling_pairs, spair));
 	sibling_pairs->erase(s);
 	return spair;
 }
 
-SiblingPair pop_sibling_pair(set<SiblingPair>::iterator s, set<SiblingPair> *sibling_pairs, UndoMachine *um) {
+SiblingPair pop_sibling_pair(SiblingPairSet::iterator s, SiblingPairSet *sibling_pairs, UndoMachine *um) {
 	SiblingPair spair = SiblingPair(*s); 
-	um->add_event(new RemoveSetSiblingPairs(sibling_pairs, spair));
+	um->add_event(RemoveSetSiblingPairs(sibling_pairs, spair));
 	sibling_pairs->erase(s);
 	return spair;
 }
 
 inline int rSPR_branch_and_bound_hlpr(Forest *T1, Forest *T2, int k,
-set<SiblingPair> *sibling_pairs, list<Node *> *singletons,
+SiblingPairSet *sibling_pairs, list<Node *> *singletons,
 bool cut_b_only, list<pair<Forest,Forest> > *AFs,
 list<Node *> *protected_stack, int *num_ties) {
 	return rSPR_branch_and_bound_hlpr(T1, T2, k, sibling_pairs,
@@ -3616,7 +4433,7 @@ list<Node *> *protected_stack, int *num_ties) {
 
 // rSPR_branch_and_bound recursive helper function
 int rSPR_branch_and_bound_hlpr(Forest *T1, Forest *T2, int k,
-set<SiblingPair> *sibling_pairs, list<Node *> *singletons,
+SiblingPairSet *sibling_pairs, list<Node *> *singletons,
 bool cut_b_only, list<pair<Forest,Forest> > *AFs,
 list<Node *> *protected_stack, int *num_ties, Node *prev_T1_a, Node *prev_T1_c) {
 	#ifdef DEBUG
@@ -3627,7 +4444,7 @@ list<Node *> *protected_stack, int *num_ties, Node *prev_T1_a, Node *prev_T1_c)
 	T2->print_components();
 	cout << "K=" << k << endl;
 	cout << "sibling pairs:";
-	for (set<SiblingPair>::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
+	for (SiblingPairSet::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
 cout << "  ";
 (*i).a->print_subtree_hlpr();
 cout << ",";
@@ -3641,6 +4458,26 @@ cout << "  ";
 	}
 	cout << endl;
 	#endif
+	if ((BB_REPLAY != NULL && BB_REPLAY->cancelled())
+			|| branch_deadline_expired()) {
+		singletons->clear();
+		BB_BUDGET_LIMITED = true;
+		return -1;
+	}
+	// this call's node of the search tree kept between iterations
+	BranchMemo *memo = BB_MEMO;
+	BB_MEMO = NULL;
+	if (memo != NULL)
+		memo->visit(branch_memo_state(T1, T2, sibling_pairs, singletons,
+				protected_stack, cut_b_only, prev_T1_a, prev_T1_c));
+	if (memo != NULL && memo->dead) {
+		singletons->clear();
+		return -1;
+	}
+	if (COUNT_BRANCHES) {
+		#pragma omp atomic
+		BB_BRANCHES++;
+	}
 	UndoMachine um = UndoMachine();
 	#ifdef DEBUG_LGT_EVENTS
 		cout << "T1111" << endl;
@@ -3673,8 +4510,8 @@ cout << "  ";
 			if (T2_a == T2->get_component(0)) {
 				// TODO: should we do this when it happens?
 				if (!T1->contains_rho()) {
-					um.add_event(new AddRho(T1));
-					um.add_event(new AddRho(T2));
+					um.add_event(AddRho(T1));
+					um.add_event(AddRho(T2));
 					T1->add_rho();
 					T2->add_rho();
 					k--;
@@ -3685,10 +4522,10 @@ cout << "  ";
 			}
 		
 			// cut the edge above T1_a
-			um.add_event(new CutParent(T1_a));
+			um.add_event(CutParent(T1_a));
 			T1_a->cut_parent();
 		
-			um.add_event(new AddComponent(T1));
+			um.add_event(AddComponent(T1));
 			T1->add_component(T1_a);
 			ContractEvent(&um, T1_a_parent);
 		
@@ -3710,7 +4547,7 @@ cout << "  ";
 		if(!sibling_pairs->empty()) {
 			Node *T1_a;
 			Node *T1_c;
-			set<SiblingPair>::iterator deepest_valid = sibling_pairs->end();
+			SiblingPairSet::iterator deepest_valid = sibling_pairs->end();
 			int deepest_depth = INT_MAX;
 			int deepest_depth_2 = INT_MAX;
 			Node *best_a = NULL;
@@ -3727,12 +4564,12 @@ cout << "  ";
 					&& (protected_stack->back()->is_contracted()
 					// this shouldn't happen
 						|| protected_stack->back()->get_twin()->parent() == NULL)) {
-				um.add_event(new ListPopBack(protected_stack));
+				um.add_event(ListPopBack(protected_stack));
 				protected_stack->pop_back();
 			}
 			if (LEAF_REDUCTION && !cut_b_only) {
 				bool found = false;
-				set<SiblingPair>::iterator sp_i = sibling_pairs->begin();
+				SiblingPairSet::iterator sp_i = sibling_pairs->begin();
 				// correct in case sibling pair involves previous
 				/*				if (sp_i != sibling_pairs->begin()) {
 					if (check_all_pairs)
@@ -3745,9 +4582,9 @@ cout << "  ";
 					T1_a = (*sp_i).a;
 					T1_c = (*sp_i).c;
 					if (T1_a->parent() == NULL || T1_a->parent() != T1_c->parent()) {
-						um.add_event(new RemoveSetSiblingPairs(sibling_pairs,
+						um.add_event(RemoveSetSiblingPairs(sibling_pairs,
 									SiblingPair(T1_a, T1_c)));
-						set<SiblingPair>::iterator rem = sp_i;
+						SiblingPairSet::iterator rem = sp_i;
 						sp_i++;
 						sibling_pairs->erase(rem);
 						continue;
@@ -3758,9 +4595,9 @@ cout << "  ";
 					if ((T2_a->parent() != NULL && T2_a->parent() == T2_c->parent())
 							|| (!cut_b_only && PREFER_NONBRANCHING
 									&& is_nonbranching(T1, T2, T1_a, T1_c, T2_a, T2_c))) {
-						um.add_event(new RemoveSetSiblingPairs(sibling_pairs,
+						um.add_event(RemoveSetSiblingPairs(sibling_pairs,
 									SiblingPair(T1_a, T1_c)));
-						set<SiblingPair>::iterator rem = sp_i;
+						SiblingPairSet::iterator rem = sp_i;
 						sp_i++;
 						sibling_pairs->erase(rem);
 						found = true;
@@ -3862,31 +4699,31 @@ cout << "  ";
 				if (!protected_stack->empty() &&
 						(T2_a == protected_stack->back()
 						 	|| T2_c == protected_stack->back())) {
-					um.add_event(new ListPopBack(protected_stack));
+					um.add_event(ListPopBack(protected_stack));
 					protected_stack->pop_back();
 				}
 				// CAN THIS HAPPEN TWICE?
 				if (!protected_stack->empty() &&
 						(T2_a == protected_stack->back()
 						 	|| T2_c == protected_stack->back())) {
-					um.add_event(new ListPopBack(protected_stack));
+					um.add_event(ListPopBack(protected_stack));
 					protected_stack->pop_back();
 				}
 
 
-				um.add_event(new ContractSiblingPair(T1_ac));
+				um.add_event(ContractSiblingPair(T1_ac));
 				T1_ac->contract_sibling_pair_undoable();
-				um.add_event(new ContractSiblingPair(T2_ac, T2_a, T2_c, &um));
+				um.add_event(ContractSiblingPair(T2_ac, T2_a, T2_c, &um));
 				Node *T2_ac_new = T2_ac->contract_sibling_pair_undoable(T2_a, T2_c);
 				if (T2_ac_new != NULL && T2_ac_new != T2_ac) {
 					T2_ac = T2_ac_new;
-					um.add_event(new CreateNode(T2_ac));
-					um.add_event(new ContractSiblingPair(T2_ac));
+					um.add_event(CreateNode(T2_ac));
+					um.add_event(ContractSiblingPair(T2_ac));
 					T2_ac->contract_sibling_pair_undoable();
 				}
 
-				um.add_event(new SetTwin(T1_ac));
-				um.add_event(new SetTwin(T2_ac));
+				um.add_event(SetTwin(T1_ac));
+				um.add_event(SetTwin(T2_ac));
 				T1_ac->set_twin(T2_ac);
 				T2_ac->set_twin(T1_ac);
 				//T1->add_deleted_node(T1_a);
@@ -3933,6 +4770,7 @@ cout << "  ";
 							&& ((T2_c->parent() != NULL && T2_a->parent() != NULL)|| !T2->contains_rho())) {
 						singletons->clear();
 						um.undo_all();
+						BB_BUDGET_LIMITED = true;
 						return k-1;
 					}
 				}
@@ -4061,7 +4899,7 @@ cout << "  ";
 						cut_b_only=false;
 						cob=false;
 						if (!T2_a->is_protected()) {
-							um.add_event(new ProtectEdge(T2_a));
+							um.add_event(ProtectEdge(T2_a));
 							T2_a->protect_edge();
 						}
 					}
@@ -4086,7 +4924,7 @@ cout << "  ";
 					cut_b_only=false;
 					cob=false;
 					if (!T2_a->is_protected()) {
-						um.add_event(new ProtectEdge(T2_a));
+						um.add_event(ProtectEdge(T2_a));
 						T2_a->protect_edge();
 					}
 				}
@@ -4130,7 +4968,7 @@ cout << "  ";
 					T2->print_components();
 					cout << "\tK=" << k << endl;
 					cout << "\tsibling pairs:";
-					for (set<SiblingPair>::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
+					for (SiblingPairSet::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
 						cout << "  ";
 						(*i).a->print_subtree_hlpr();
 						cout << ",";
@@ -4176,7 +5014,7 @@ cout << "  ";
 					spairs = new list<Node *>();
 					spairs->push_back(T1_c);
 					spairs->push_back(T1_a);
-					for (set<SiblingPair>::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
+					for (SiblingPairSet::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
 						spairs->push_back((*i).a);
 						spairs->push_back((*i).c);
 					}
@@ -4195,6 +5033,7 @@ cout << "  ";
 							cout << "approx failed" << endl;
 						#endif
 						um.undo_all();
+						BB_BUDGET_LIMITED = true;
 						return -1;
 					}
 					um.undo_to(undo_state);
@@ -4258,6 +5097,7 @@ cout << "  ";
 //				cout << "k=" << k << endl;
 //				cout << "cp=" << cluster_points->size() << endl;
 				if (!cluster_points->empty()) {
+					#pragma omp atomic
 					NUM_CLUSTERS++;
 					sibling_pairs->clear();
 #ifdef DEBUG_CLUSTERS
@@ -4384,6 +5224,7 @@ cout << "  ";
 					// HACK to allow only initial clusters
 					// TODO: use UndoMachine in this clustering section
 					// and update this clustering to not require copying
+					#pragma omp atomic
 					NUM_CLUSTERS++;
 				}
 				delete cluster_points;
@@ -4397,6 +5238,22 @@ cout << "  ";
 					&T1_a_copy, &T1_c_copy, &T2_a_copy, &T2_c_copy);
 					*/
 
+				// parallel search: follow the task's branch prefix or
+				// hand the branches of this node to new tasks
+				int forced_branch = BRANCH_ALL;
+				if (BB_REPLAY != NULL) {
+					forced_branch = BB_REPLAY->next_branch();
+					if (forced_branch == BRANCH_SPLIT) {
+						um.undo_all();
+						singletons->clear();
+						BB_BUDGET_LIMITED = true;
+						return -1;
+					}
+				}
+
+				// whether a branch failed because k was too small
+				bool budget_limited = false;
+
 				Node *node;
 				Node *T2_ab = T2_a->parent();
 
@@ -4418,7 +5275,8 @@ cout << "  ";
 				// cut T2_a
 //				if (cut_b_only == false && T2_a->is_protected())
 //					cout << "protected k=" << k << endl;
-				if (cut_b_only == false && cut_c_only == false &&
+				if ((forced_branch == BRANCH_ALL || forced_branch == 0) &&
+						cut_b_only == false && cut_c_only == false &&
 						!T2_a->is_protected()
 						&& (T2_a->parent()->parent() != NULL
 								|| (T2_a->parent() == T2->get_component(0)
@@ -4427,14 +5285,14 @@ cout << "  ";
 								|| T2_a->parent()->get_children().size() > 2)) {// &&
 //						(!T2_a->parent()->is_protected() ||
 //							T2_a->parent()->get_children().size() > 2)) { }
-					um.add_event(new CutParent(T2_a));
+					um.add_event(CutParent(T2_a));
 					T2_a->cut_parent();
 					ContractEvent(&um, T2_ab);
 					node = T2_ab->contract();
 					if (node != NULL && node->is_singleton() &&
 							node != T2->get_component(0))
 						singletons->push_back(node);
-					um.add_event(new AddComponent(T2));
+					um.add_event(AddComponent(T2));
 					T2->add_component(T2_a);
 					singletons->push_back(T2_a);
 
@@ -4445,7 +5303,7 @@ cout << "  ";
 					if (EDGE_PROTECTION_TWO_B && T2_c->is_protected() && !cut_a_only){
 						if (path_length == 4) {
 							if (!multi_b1 && !multi_b2 && !T2_b->is_protected()) {
-								um.add_event(new ProtectEdge(T2_b));
+								um.add_event(ProtectEdge(T2_b));
 								T2_b->protect_edge();
 							}
 							if (!multi_b2 && !multi_b1) {
@@ -4453,12 +5311,14 @@ cout << "  ";
 								if (balanced)
 									T2_b2 = T2_d;
 								if (!T2_b2->is_protected()) {
-									um.add_event(new ProtectEdge(T2_b2));
+									um.add_event(ProtectEdge(T2_b2));
 									T2_b2->protect_edge();
 								}
 						}
 						}
 					}
+					BB_MEMO = branch_memo_child(memo, 0);
+					BB_BUDGET_LIMITED = false;
 					if (cut_a_only) {
 						answer_a =
 							rSPR_branch_and_bound_hlpr(T1, T2, k-1, sibling_pairs,
@@ -4469,6 +5329,7 @@ cout << "  ";
 							rSPR_branch_and_bound_hlpr(T1, T2, k-1, sibling_pairs,
 									singletons, false, AFs, protected_stack, num_ties);
 					}
+					budget_limited |= BB_BUDGET_LIMITED;
 				}
 				best_k = answer_a;
 				best_T1 = T1;
@@ -4538,18 +5399,12 @@ cout << "  ";
 				if (multi_node && cob) {
 					vector<Node *> B_1 = T2_a->parent()->find_leaves();
 					LCA T1_LCA = LCA(T1->get_component(0));
-					Node *B_1_lca = NULL;
+					vector<Node *> B_1_twins = vector<Node *>();
 					for(int i = 0; i < B_1.size(); i++) {
-						if (B_1[i] == T2_a) {
-							continue;
-						}
-						if (B_1_lca == NULL) {
-							B_1_lca = B_1[i]->get_twin();
-						}
-						else {
-							B_1_lca = T1_LCA.get_lca(B_1_lca, B_1[i]->get_twin());
-						}
+						if (B_1[i] != T2_a)
+							B_1_twins.push_back(B_1[i]->get_twin());
 					}
+					Node *B_1_lca = T1_LCA.get_lca(B_1_twins);
 					Node *T1_a_ancestor = T1_a;
 					while(T1_a_ancestor != NULL && T1_a_ancestor != B_1_lca) {
 						T1_a_ancestor = T1_a_ancestor->parent();
@@ -4563,7 +5418,8 @@ cout << "  ";
 				}
 
 				// cut T2_b
-				if ((!CUT_AC_SEPARATE_COMPONENTS || same_component)
+				if ((forced_branch == BRANCH_ALL || forced_branch == 1) &&
+						(!CUT_AC_SEPARATE_COMPONENTS || same_component)
 //						&& ((!T2_b->parent()->is_protected()
 								&& (((multi_node || !T2_b->is_protected())))
 						&& (!ABORT_AT_FIRST_SOLUTION || best_k < 0
@@ -4574,43 +5430,43 @@ cout << "  ";
 								|| (T2_a->parent() == T2->get_component(0)
 										&& !T2->contains_rho()))) {
 					if (multi_node) {
-						um.add_event(new ChangeEdgePreInterval(T2_a));
+						um.add_event(ChangeEdgePreInterval(T2_a));
 						T2_a->copy_edge_pre_interval(T2_ab);
-						um.add_event(new CutParent(T2_a));
+						um.add_event(CutParent(T2_a));
 						T2_a->cut_parent();
-						um.add_event(new ChangeEdgePreInterval(T2_ab));
+						um.add_event(ChangeEdgePreInterval(T2_ab));
 						T2_ab->set_edge_pre_start(-1);
 						T2_ab->set_edge_pre_end(-1);
 						Node *T2_ab_parent = T2_ab->parent();
 						if (T2_ab_parent != NULL) {
-							um.add_event(new CutParent(T2_ab));
+							um.add_event(CutParent(T2_ab));
 							T2_ab->cut_parent();
-							um.add_event(new AddChild(T2_a));
+							um.add_event(AddChild(T2_a));
 							T2_ab_parent->add_child(T2_a);
-							um.add_event(new AddComponent(T2));
+							um.add_event(AddComponent(T2));
 							T2->add_component(T2_ab);
 						}
 						else {
 							if (T2->get_component(0) == T2_ab) {
-								um.add_event(new AddComponentToFront(T2));
+								um.add_event(AddComponentToFront(T2));
 								T2->add_component(0, T2_a);
 							}
 							else {
-								um.add_event(new AddComponent(T2));
+								um.add_event(AddComponent(T2));
 								T2->add_component(T2_a);
 								singletons->push_back(T2_a);
 							}
 						}
 					}
 					else {
-						um.add_event(new CutParent(T2_b));
+						um.add_event(CutParent(T2_b));
 						T2_b->cut_parent();
 						ContractEvent(&um, T2_ab);
 						node = T2_ab->contract();
 						if (node != NULL && node->is_singleton()
 								&& node != T2->get_component(0))
 								singletons->push_back(node);
-						um.add_event(new AddComponent(T2));
+						um.add_event(AddComponent(T2));
 						T2->add_component(T2_b);
 						if (T2_b->is_leaf())
 							singletons->push_back(T2_b);
@@ -4622,17 +5478,19 @@ cout << "  ";
 
 					if (cut_a_or_merge_ac) {
 						if (!T2_a->is_protected()) {
-							um.add_event(new ProtectEdge(T2_a));
+							um.add_event(ProtectEdge(T2_a));
 							T2_a->protect_edge();
-							um.add_event(new ListPushBack(protected_stack));
+							um.add_event(ListPushBack(protected_stack));
 							protected_stack->push_back(T2_a);
 						}
 						if (!T2_c->is_protected()) {
-							um.add_event(new ProtectEdge(T2_c));
+							um.add_event(ProtectEdge(T2_c));
 							T2_c->protect_edge();
 						}
 					}
 
+					BB_MEMO = branch_memo_child(memo, 1);
+					BB_BUDGET_LIMITED = false;
 					if (CUT_ALL_B) {
 						answer_b =
 							rSPR_branch_and_bound_hlpr(T1, T2, k-1,
@@ -4645,6 +5503,7 @@ cout << "  ";
 									sibling_pairs, singletons, false, AFs, protected_stack,
 									num_ties, T1_a, T1_c);
 					}
+					budget_limited |= BB_BUDGET_LIMITED;
 				}
 				if (answer_b > best_k
 						|| (answer_b == best_k
@@ -4678,7 +5537,8 @@ cout << "  ";
 				*/
 //				if (T2_c->is_protected())
 //					cout << "protected k=" << k << endl;
-				if (!T2_c->is_protected() &&
+				if ((forced_branch == BRANCH_ALL || forced_branch == 2) &&
+						!T2_c->is_protected() &&
 						!cut_a_or_merge_ac &&
 	//					(T2_c->parent() == NULL || !T2_c->parent()->is_protected() ||
 	//						T2_c->parent()->get_children().size() > 2) &&
@@ -4698,14 +5558,14 @@ cout << "  ";
 
 					if (T2_c->parent() != NULL) {
 						Node *T2_c_parent = T2_c->parent();
-						um.add_event(new CutParent(T2_c));
+						um.add_event(CutParent(T2_c));
 						T2_c->cut_parent();
 						ContractEvent(&um, T2_c_parent);
 						node = T2_c_parent->contract();
 						if (node != NULL && node->is_singleton()
 								&& node != T2->get_component(0))
 							singletons->push_back(node);
-						um.add_event(new AddComponent(T2));
+						um.add_event(AddComponent(T2));
 						T2->add_component(T2_c);
 					}
 					else {
@@ -4714,11 +5574,11 @@ cout << "  ";
 					}
 					if (EDGE_PROTECTION && !cut_c_only) {
 						if (!T2_a->is_protected()) {
-							um.add_event(new ProtectEdge(T2_a));
+							um.add_event(ProtectEdge(T2_a));
 							T2_a->protect_edge();
 //							if (DEEPEST_PROTECTED_ORDER && !cut_c_only) {
 							if (DEEPEST_PROTECTED_ORDER) {
-								um.add_event(new ListPushBack(protected_stack));
+								um.add_event(ListPushBack(protected_stack));
 								protected_stack->push_back(T2_a);
 							}
 							// TODO: add to protected list
@@ -4729,7 +5589,7 @@ cout << "  ";
 						if (EDGE_PROTECTION_TWO_B) {
 							if (path_length == 4) {
 								if (!multi_b1 && !multi_b2 && !T2_b->is_protected()) {
-									um.add_event(new ProtectEdge(T2_b));
+									um.add_event(ProtectEdge(T2_b));
 									T2_b->protect_edge();
 								}
 								if (!multi_b2 && !multi_b1) {
@@ -4737,7 +5597,7 @@ cout << "  ";
 									if (balanced)
 										T2_b2 = T2_d;
 									if (!T2_b2->is_protected()) {
-										um.add_event(new ProtectEdge(T2_b2));
+										um.add_event(ProtectEdge(T2_b2));
 										T2_b2->protect_edge();
 									}
 								}
@@ -4747,6 +5607,8 @@ cout << "  ";
 							T2_a->set_max_merge_depth(lca_depth);
 					}
 						singletons->push_back(T2_c);
+						BB_MEMO = branch_memo_child(memo, 2);
+						BB_BUDGET_LIMITED = false;
 						if (cut_c_only) {
 							answer_c =
 								rSPR_branch_and_bound_hlpr(T1, T2, k-1, sibling_pairs,
@@ -4757,6 +5619,7 @@ cout << "  ";
 								rSPR_branch_and_bound_hlpr(T1, T2, k-1, sibling_pairs,
 										singletons, false, AFs, protected_stack, num_ties);
 						}
+						budget_limited |= BB_BUDGET_LIMITED;
 						if (answer_c > best_k
 									|| (answer_c == best_k
 									&& PREFER_RHO
@@ -4786,7 +5649,7 @@ cout << "  ";
 				cout << "T2: ";
 				T2->print_components();
 					cout << "sibling pairs:";
-					for (set<SiblingPair>::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
+					for (SiblingPairSet::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
 						cout << "  ";
 						(*i).a->print_subtree_hlpr();
 						cout << ",";
@@ -4799,6 +5662,9 @@ cout << "  ";
 #else
 		 um.undo_all();
 #endif
+				if (memo != NULL && best_k < 0 && !budget_limited)
+					memo->set_dead();
+				BB_BUDGET_LIMITED = budget_limited;
 				singletons->clear();
 				return best_k;
 			}
@@ -4833,7 +5699,7 @@ cout << "  ";
 				cout << "T2: ";
 				T2->print_components();
 					cout << "sibling pairs:";
-					for (set<SiblingPair>::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
+					for (SiblingPairSet::iterator i = sibling_pairs->begin(); i != sibling_pairs->end(); i++) {
 						cout << "  ";
 						(*i).a->print_subtree_hlpr();
 						cout << ",";
@@ -4847,6 +5713,8 @@ cout << "  ";
 		 um.undo_all();
 #endif
 
+	if (k < 0)
+		BB_BUDGET_LIMITED = true;
 	return k;
 }
 
@@ -4858,46 +5726,444 @@ int rSPR_branch_and_bound_simple_clustering(Node *T1, Node *T2, bool verbose, ma
 	return rSPR_branch_and_bound_simple_clustering(T1,T2, verbose, label_map, reverse_label_map, min_k, max_k, NULL, NULL);
 }
 
-int rSPR_branch_and_bound_simple_clustering(Node *T1, Node *T2, bool verbose, map<string, int> *label_map, map<int, string> *reverse_label_map, int min_k, int max_k, Forest **out_F1, Forest **out_F2) {
-	bool do_cluster = true;
-	if (max_k > MAX_SPR)
-		max_k = MAX_SPR;
-	else if (max_k == -1)
-		max_k = INT_MAX;
-
-	if (T2->get_preorder_number() == -1) {
-	  T2->preorder_number();
+/* reserve_cluster_k
+ * Raise the k that a cluster holds in total_k from *reserved to k if the
+ * total stays within max_k. Clusters solved in parallel reserve each k
+ * before searching it, so together they cannot spend more than max_k
+ */
+bool reserve_cluster_k(int *total_k, int *reserved, int k, int max_k) {
+	bool reserve;
+	#pragma omp critical(cluster_budget)
+	{
+		reserve = *total_k - *reserved + k <= max_k;
+		if (reserve) {
+			*total_k += k - *reserved;
+			*reserved = k;
+		}
 	}
+	return reserve;
+}
 
-	ClusterForest F1 = ClusterForest(T1);
-	ClusterForest F2 = ClusterForest(T2);
-	Forest F3 = Forest(F1);
-	Forest F4 = Forest(F2);
+// replace the k reserved by a cluster with its final distance
+void settle_cluster_k(int *total_k, int reserved, int k) {
+	#pragma omp critical(cluster_budget)
+	*total_k += k - reserved;
+}
 
+/* rSPR_branch_and_bound_cluster
+ * Solve cluster i of a simple clustering and join the solution back into
+ * F1 and F2. The distance of the cluster is added to total_k
+ */
+void rSPR_branch_and_bound_cluster(ClusterForest *F1, ClusterForest *F2,
+		int i, int num_clusters, bool verbose, ostream &out, int min_k,
+		int max_k, int *total_k) {
+	if (i == num_clusters - 1) {
+		PREFER_RHO = false;
+	}
+	int exact_spr = -1;
+	int k;
+	Node *c1, *c2;
+	// other clusters may be joining in parallel
+	#pragma omp critical(cluster_join)
+	{
+		c1 = F1->get_component(i);
+		c2 = F2->get_component(i);
+	}
+	//vector<Node *> comps = vector<Node *>();
+	//comps.push_back(F1->get_component(i));
+	Forest f1 = Forest(c1);
+	//Forest f1 = Forest(comps);
+	//comps.clear();
+
+	//comps.push_back(F1->get_component(i));
+	Forest f2 = Forest(c2);
+	//Forest f2 = Forest(comps);
+	//comps.clear();
+	Forest f1a = Forest(f1);
+	Forest f2a = Forest(f2);
+	Forest *f1_cluster;
+	Forest *f2_cluster;
 
-//	bool old_rho = PREFER_RHO;
-	PREFER_RHO = true;
 	if (verbose) {
-		cout << "T1: ";
-		F1.print_components();
-		cout << "T2: ";
-		F2.print_components();
+		out << "C" << i << "_1: ";
+		f1.print_components(out);
+		out << "C" << i << "_2: ";
+		f2.print_components(out);
 	}
-	int full_approx_spr;
+	int approx_spr;
 	if (MULTIFURCATING) {
-	  full_approx_spr = rSPR_worse_3_mult_approx(&F3, &F4);
+	  approx_spr = rSPR_worse_3_mult_approx(&f1a, &f2a);
 	}
 	else {
-	  full_approx_spr = rSPR_worse_3_approx(&F3, &F4);
-	}
-	if (full_approx_spr < CLUSTER_TUNE) {
-		do_cluster = false;
+	  approx_spr = rSPR_worse_3_approx(&f1a, &f2a);
 	}
 	if (verbose) {
+		out << "cluster approx drSPR=" << f2a.num_components()-1 << endl;
+		//out << "cluster approx drSPR=" << approx_spr << endl;
 
-		cout << "approx F1: ";
-		F3.print_components();
-		cout << "approx F2: ";
+		out << endl;
+	}
+
+	int solved_k;
+	#pragma omp critical(cluster_budget)
+	solved_k = *total_k;
+	// k of this cluster held in total_k
+	int reserved_k = 0;
+	int min_spr = approx_spr / 3;
+	if (min_spr < MIN_SPR - solved_k)
+		min_spr = MIN_SPR - solved_k;
+	int total_split_k = 0;
+
+	bool done_cluster = false;
+	bool done_split = false;
+
+	double tree_fraction = INITIAL_TREE_FRACTION;
+
+	if (min_spr < min_k)
+		min_spr = min_k;
+
+	// clusters repeat across trees, reuse their distance
+	ProblemKey cluster_key;
+	bool cluster_memoize = false;
+	bool cluster_solved = false;
+	if (MEMOIZE && !SPLIT_APPROX) {
+		cluster_key = ProblemKey(&f1, &f2);
+		cluster_memoize = cluster_key.valid();
+	}
+	if (cluster_memoize) {
+		ProblemSolution solution;
+		#pragma omp critical(memoized_clusters)
+		cluster_solved = memoized_clusters.find(cluster_key, &solution);
+		if (cluster_solved && solution.k > min_spr)
+			min_spr = solution.k;
+	}
+
+	while(!done_cluster) {
+		done_cluster = true;
+
+		// search tree shared by the iterations
+		int memo_size = 0;
+		BranchMemo *memo = NULL;
+		if (MEMOIZE_SEARCH && !CLUSTER_REDUCTION)
+			memo = new BranchMemo(&memo_size);
+		for(k = min_spr - total_split_k; true; k++) {
+			if (k < 0)
+				k = 0;
+			if (SPLIT_APPROX && !done_split && k >= SPLIT_APPROX_THRESHOLD) {
+				done_cluster = false;
+				break;
+			}
+			Forest f1t = Forest(f1);
+//				Forest f1t = f1;
+			Forest f2t = Forest(f2);
+//				Forest f2t = f2;
+			
+			#ifdef DEBUG_LGT_EVENTS
+				f2t.print_protected_edge_list();
+			#endif
+
+			f1t.unsync();
+			f2t.unsync();
+			exact_spr = -1;
+			if (verbose) {
+				out << k << " ";
+  				out.flush();
+			}
+			bool in_budget = k <= CLUSTER_MAX_SPR && !branch_deadline_expired()
+					&& reserve_cluster_k(total_k, &reserved_k, k, max_k);
+			if (in_budget) {
+				if (f1t.get_component(0)->get_name() == DEAD_COMPONENT) {
+					f1t.add_rho();
+					f2t.add_rho();
+				}
+				if (MULTIFURCATING) {
+				  exact_spr = rSPR_branch_and_bound_mult(&f1t, &f2t, k);
+				}
+				else {
+				  BB_MEMO = memo;
+				  exact_spr = rSPR_branch_and_bound(&f1t, &f2t, k);
+				  BB_MEMO = NULL;
+				}
+			}
+			if (exact_spr >= 0 || !in_budget) {
+				if (k > CLUSTER_MAX_SPR) {
+					f1t.swap(&f1a);
+					f2t.swap(&f2a);
+					out << "foo" << endl;
+				}
+				if (exact_spr >= 0) {
+					exact_spr += total_split_k;
+					if (verbose) {
+  					out << endl;
+  					out << "F" << i << "_1: ";
+  					f1t.print_components(out);
+  					out << "F" << i << "_2: ";
+  					f2t.print_components(out);
+  					out << "cluster exact drSPR=" << exact_spr << endl;
+  					out << endl;
+					}
+					if (cluster_memoize && !cluster_solved) {
+						#pragma omp critical(memoized_clusters)
+						memoized_clusters.insert(cluster_key,
+								ProblemSolution(exact_spr));
+					}
+					settle_cluster_k(total_k, reserved_k, exact_spr);
+				}
+				else {
+					// TODO: don't just the MAX_SPR here
+					// incorporate extra information
+					// toggle?
+					if (verbose) {
+						out << "cluster exact drSPR=?  " << "k=" << k << " too large"
+							<< endl;
+						out << "\n";
+					}
+					if (false && k > CLUSTER_MAX_SPR) {
+						// TODO: this should be an approx of the remaining forest
+//							total_k += approx_spr;
+					}
+					else if (CLAMP) {
+						#pragma omp critical(cluster_budget)
+						*total_k = max_k;
+					}
+					else {
+						Forest f1a = Forest(f1);
+						Forest f2a = Forest(f2);
+						
+						int approx_spr;
+						if (MULTIFURCATING) {
+						  approx_spr = rSPR_worse_3_mult_approx(&f1a, &f2a);
+						}
+						else{
+						  approx_spr = rSPR_worse_3_approx(&f1a, &f2a);
+						}
+							//total_k += min_spr;
+							// every smaller k failed, so the total is
+							// above max_k when a cluster is cut off
+							int lower_spr = approx_spr / 3;
+							if (CUT_OFF_ABOVE_MAX && !SPLIT_APPROX
+									&& k > lower_spr)
+								lower_spr = k;
+							settle_cluster_k(total_k, reserved_k, lower_spr);
+					}
+				}
+				#pragma omp critical(cluster_join)
+				if ( i < num_clusters - 1) {
+					F1->join_cluster(i,&f1t);
+					F2->join_cluster(i,&f2t);
+				}
+				else {
+					F1->join_cluster(&f1t);
+					F2->join_cluster(&f2t);
+				}
+				break;
+			}
+		}
+		if (memo != NULL)
+			delete memo;
+		done_split = done_cluster;
+		int num_splits = 0;
+		while (SPLIT_APPROX && !done_split) {
+			//IN_SPLIT_APPROX = true;
+			Node *original_split_node = find_subtree_of_approx_distance(
+					f1.get_component(0), &f1, &f2, SPLIT_APPROX_THRESHOLD*2);
+			if (original_split_node == f1.get_component(0) &&
+					num_splits > 0)
+				done_split = true;
+			else {
+				Forest f1a = Forest(f1);
+				Forest f2a = Forest(f2);
+				Node *a_split_node =
+				f1a.find_by_prenum(original_split_node->get_preorder_number());
+				f1a.get_component(0)->disallow_siblings_subtree();
+					a_split_node->allow_siblings_subtree();
+//					if (a_split_node->lchild() != NULL)
+//						a_split_node->lchild()->allow_siblings_subtree();
+//					if (a_split_node->rchild() != NULL)
+//						a_split_node->rchild()->allow_siblings_subtree();
+				// something odd going on here
+				int start = rSPR_worse_3_approx(a_split_node, &f1a, &f2a);
+				if (start == INT_MAX)
+					start = 0;
+				start /= 3;
+				int end = f1.get_component(0)->size();
+				for(k = start; true; k++) {
+					// TODO: figure out the bug here
+					if (k > end) {
+						k = 0;
+						done_split = true;
+						break;
+					}
+			/*	if (k > SPLIT_APPROX_THRESHOLD) {
+					k = 0;
+					tree_fraction *= 0.75;
+					if (verbose)
+						out << "tree_fraction: " << tree_fraction << endl;
+					continue;
+				}*/
+					Forest f1s = Forest(f1);
+					Forest f2s = Forest(f2);
+					if (!sync_twins(&f1s, &f2s)) {
+						k = 0;
+						done_split = true;
+						break;
+					}
+					if (verbose) {
+						out << k << " ";
+	  				out.flush();
+					}
+					Node *split_node = f1s.find_by_prenum(original_split_node->get_preorder_number());
+					f1s.get_component(0)->disallow_siblings_subtree();
+						split_node->allow_siblings_subtree();
+//						if (split_node->lchild() != NULL)
+//							split_node->lchild()->allow_siblings_subtree();
+//						if (split_node->rchild() != NULL)
+//							split_node->rchild()->allow_siblings_subtree();
+						//f1s.get_component(0)->find_subtree_of_size(tree_fraction);
+						SiblingPairSet *sibling_pairs =
+							find_sibling_pairs_set(split_node);
+						list<Node *> singletons = f2s.find_singletons();
+						list<pair<Forest,Forest> > AFs = list<pair<Forest,Forest> >();
+						list<Node *> protected_stack = list<Node *>();
+
+						int num_ties = 2;
+
+						int split_k = rSPR_branch_and_bound_hlpr(&f1s, &f2s, k,
+								sibling_pairs, &singletons, false, &AFs,
+								&protected_stack, &num_ties);
+						delete sibling_pairs;
+						if (!AFs.empty()) {
+							AFs.front().first.swap(&f1);
+							AFs.front().second.swap(&f2);
+							f2.unprotect_edges();
+							f1.get_component(0)->allow_siblings_subtree();
+							AFs.clear();
+							total_split_k += k - split_k;
+	//						if (k < SPLIT_APPROX_THRESHOLD * 0.75) {
+	//							tree_fraction *= 2;
+	//							if (tree_fraction > INITIAL_TREE_FRACTION)
+	//								tree_fraction = INITIAL_TREE_FRACTION;
+	//						}
+							if (verbose)
+								out << "split_k: " << k << endl;
+							break;
+						}
+				}
+			}
+			//IN_SPLIT_APPROX = false;
+			num_splits++;
+		}
+
+		// TODO: approx again? seperate approxes ?
+	}
+}
+
+#ifdef _OPENMP
+/* solve the clusters below cluster i as tasks, then cluster i itself.
+ * Verbose output of each cluster is kept in output
+ */
+void rSPR_branch_and_bound_cluster_task(ClusterForest *F1, ClusterForest *F2,
+		int i, int num_clusters, vector<vector<int> > *children, bool verbose,
+		vector<string> *output, int min_k, int max_k, int *total_k) {
+	for(int j = 0; j < (*children)[i].size(); j++) {
+		int child = (*children)[i][j];
+		#pragma omp task firstprivate(child)
+		rSPR_branch_and_bound_cluster_task(F1, F2, child, num_clusters,
+				children, verbose, output, min_k, max_k, total_k);
+	}
+	#pragma omp taskwait
+	stringstream out;
+	rSPR_branch_and_bound_cluster(F1, F2, i, num_clusters, verbose, out,
+			min_k, max_k, total_k);
+	(*output)[i] = out.str();
+}
+
+/* rSPR_branch_and_bound_parallel_clusters
+ * Solve the clusters of a simple clustering in parallel. A cluster is
+ * solved once the clusters nested in it have been joined back, and all
+ * clusters share the k budget in total_k. The last cluster contains all
+ * others so it is solved alone afterwards
+ */
+void rSPR_branch_and_bound_parallel_clusters(ClusterForest *F1,
+		ClusterForest *F2, int num_clusters, bool verbose, int min_k, int max_k,
+		int *total_k) {
+	// find the cluster containing each cluster node
+	vector<vector<int> > children = vector<vector<int> >(num_clusters);
+	for(int i = 1; i < num_clusters - 1; i++) {
+		Node *root = F1->get_cluster_node(i);
+		while(root->parent() != NULL)
+			root = root->parent();
+		int parent = num_clusters - 1;
+		for(int j = i + 1; j < num_clusters; j++) {
+			if (F1->get_component(j) == root) {
+				parent = j;
+				break;
+			}
+		}
+		children[parent].push_back(i);
+	}
+	vector<string> output = vector<string>(num_clusters);
+	#pragma omp parallel copyin(PREFER_RHO, CUT_OFF_ABOVE_MAX, BB_DEADLINE)
+	{
+		#pragma omp single
+		{
+			int last = num_clusters - 1;
+			for(int j = 0; j < children[last].size(); j++) {
+				int child = children[last][j];
+				#pragma omp task firstprivate(child)
+				rSPR_branch_and_bound_cluster_task(F1, F2, child, num_clusters,
+						&children, verbose, &output, min_k, max_k, total_k);
+			}
+		}
+	}
+	for(int i = 1; i < num_clusters - 1; i++) {
+		cout << output[i];
+	}
+	rSPR_branch_and_bound_cluster(F1, F2, num_clusters - 1, num_clusters,
+			verbose, cout, min_k, max_k, total_k);
+}
+#endif
+
+int rSPR_branch_and_bound_simple_clustering(Node *T1, Node *T2, bool verbose, map<string, int> *label_map, map<int, string> *reverse_label_map, int min_k, int max_k, Forest **out_F1, Forest **out_F2) {
+	bool do_cluster = true;
+	if (max_k > MAX_SPR)
+		max_k = MAX_SPR;
+	else if (max_k == -1)
+		max_k = INT_MAX;
+
+	if (T2->get_preorder_number() == -1) {
+	  T2->preorder_number();
+	}
+
+	ClusterForest F1 = ClusterForest(T1);
+	ClusterForest F2 = ClusterForest(T2);
+	Forest F3 = Forest(F1);
+	Forest F4 = Forest(F2);
+
+
+//	bool old_rho = PREFER_RHO;
+	PREFER_RHO = true;
+	if (verbose) {
+		cout << "T1: ";
+		F1.print_components();
+		cout << "T2: ";
+		F2.print_components();
+	}
+	int full_approx_spr;
+	if (MULTIFURCATING) {
+	  full_approx_spr = rSPR_worse_3_mult_approx(&F3, &F4);
+	}
+	else {
+	  full_approx_spr = rSPR_worse_3_approx(&F3, &F4);
+	}
+	if (full_approx_spr < CLUSTER_TUNE) {
+		do_cluster = false;
+	}
+	if (verbose) {
+
+		cout << "approx F1: ";
+		F3.print_components();
+		cout << "approx F2: ";
 		F4.print_components();
 		// what the AF shows
 		cout << "approx drSPR=" << F4.num_components()-1 << endl;
@@ -5000,258 +6266,22 @@ int rSPR_branch_and_bound_simple_clustering(Node *T1, Node *T2, bool verbose, ma
 	F1.add_component(F1.get_component(0));
 	F2.add_component(F2.get_component(0));
 
-	int k;
 	int num_clusters = F1.num_components();
 	int total_k = 0;
 
+#ifdef _OPENMP
+	if (PARALLEL_CLUSTERS && num_clusters > 2 && !omp_in_parallel()
+			&& omp_get_max_threads() > 1) {
+		rSPR_branch_and_bound_parallel_clusters(&F1, &F2, num_clusters,
+				verbose, min_k, max_k, &total_k);
+		if (CLAMP && total_k > max_k)
+			total_k = max_k;
+	}
+	else
+#endif
 	for(int i = 1; i < num_clusters; i++) {
-		if (i == num_clusters - 1) {
-			PREFER_RHO = false;
-		}
-		int exact_spr = -1;
-		//vector<Node *> comps = vector<Node *>();
-		//comps.push_back(F1.get_component(i));
-		Forest f1 = Forest(F1.get_component(i));
-		//Forest f1 = Forest(comps);
-		//comps.clear();
-
-		//comps.push_back(F1.get_component(i));
-		Forest f2 = Forest(F2.get_component(i));
-		//Forest f2 = Forest(comps);
-		//comps.clear();
-		Forest f1a = Forest(f1);
-		Forest f2a = Forest(f2);
-		Forest *f1_cluster;
-		Forest *f2_cluster;
-
-		if (verbose) {
-			cout << "C" << i << "_1: ";
-			f1.print_components();
-			cout << "C" << i << "_2: ";
-			f2.print_components();
-		}
-		int approx_spr;
-		if (MULTIFURCATING) {
-		  approx_spr = rSPR_worse_3_mult_approx(&f1a, &f2a);
-		}
-		else {
-		  approx_spr = rSPR_worse_3_approx(&f1a, &f2a);
-		}
-		if (verbose) {
-			cout << "cluster approx drSPR=" << f2a.num_components()-1 << endl;
-			//cout << "cluster approx drSPR=" << approx_spr << endl;
-
-			cout << endl;
-		}
-
-		int min_spr = approx_spr / 3;
-		if (min_spr < MIN_SPR - total_k)
-			min_spr = MIN_SPR - total_k;
-		int total_split_k = 0;
-
-		bool done_cluster = false;
-		bool done_split = false;
-
-		double tree_fraction = INITIAL_TREE_FRACTION;
-
-		if (min_spr < min_k)
-			min_spr = min_k;
-
-		while(!done_cluster) {
-			done_cluster = true;
-
-			for(k = min_spr - total_split_k; true; k++) {
-				if (k < 0)
-					k = 0;
-				if (SPLIT_APPROX && !done_split && k >= SPLIT_APPROX_THRESHOLD) {
-					done_cluster = false;
-					break;
-				}
-				Forest f1t = Forest(f1);
-//				Forest f1t = f1;
-				Forest f2t = Forest(f2);
-//				Forest f2t = f2;
-				
-				#ifdef DEBUG_LGT_EVENTS
-					f2t.print_protected_edge_list();
-				#endif
-
-				f1t.unsync();
-				f2t.unsync();
-				exact_spr = -1;
-				if (verbose) {
-					cout << k << " ";
-  				cout.flush();
-				}
-				if (k + total_k <= max_k && k <= CLUSTER_MAX_SPR) {
-					if (f1t.get_component(0)->get_name() == DEAD_COMPONENT) {
-						f1t.add_rho();
-						f2t.add_rho();
-					}
-					if (MULTIFURCATING) {
-					  exact_spr = rSPR_branch_and_bound_mult(&f1t, &f2t, k);
-					}
-					else {
-					  exact_spr = rSPR_branch_and_bound(&f1t, &f2t, k);
-					}
-				}
-				if (exact_spr >= 0 || k + total_k > max_k ||
-						k > CLUSTER_MAX_SPR) {
-					if (k > CLUSTER_MAX_SPR) {
-						f1t.swap(&f1a);
-						f2t.swap(&f2a);
-						cout << "foo" << endl;
-					}
-					if (exact_spr >= 0) {
-						exact_spr += total_split_k;
-						if (verbose) {
-	  					cout << endl;
-	  					cout << "F" << i << "_1: ";
-	  					f1t.print_components();
-	  					cout << "F" << i << "_2: ";
-	  					f2t.print_components();
-	  					cout << "cluster exact drSPR=" << exact_spr << endl;
-	  					cout << endl;
-						}
-						total_k += exact_spr;
-					}
-					else {
-						// TODO: don't just the MAX_SPR here
-						// incorporate extra information
-						// toggle?
-						if (verbose) {
-							cout << "cluster exact drSPR=?  " << "k=" << k << " too large"
-								<< endl;
-							cout << "\n";
-						}
-						if (false && k > CLUSTER_MAX_SPR) {
-							// TODO: this should be an approx of the remaining forest
-//							total_k += approx_spr;
-						}
-						else if (CLAMP) {
-							total_k = max_k;
-						}
-						else {
-							Forest f1a = Forest(f1);
-							Forest f2a = Forest(f2);
-							
-							int approx_spr;
-							if (MULTIFURCATING) {
-							  approx_spr = rSPR_worse_3_mult_approx(&f1a, &f2a);
-							}
-							else{
-							  approx_spr = rSPR_worse_3_approx(&f1a, &f2a);
-							}
-								//total_k += min_spr;
-								total_k += approx_spr / 3;
-						}
-					}
-					if ( i < num_clusters - 1) {
-						F1.join_cluster(i,&f1t);
-						F2.join_cluster(i,&f2t);
-					}
-					else {
-						F1.join_cluster(&f1t);
-						F2.join_cluster(&f2t);
-					}
-					break;
-				}
-			}
-			done_split = done_cluster;
-			int num_splits = 0;
-			while (SPLIT_APPROX && !done_split) {
-				//IN_SPLIT_APPROX = true;
-				Node *original_split_node = find_subtree_of_approx_distance(
-						f1.get_component(0), &f1, &f2, SPLIT_APPROX_THRESHOLD*2);
-				if (original_split_node == f1.get_component(0) &&
-						num_splits > 0)
-					done_split = true;
-				else {
-					Forest f1a = Forest(f1);
-					Forest f2a = Forest(f2);
-					Node *a_split_node =
-					f1a.find_by_prenum(original_split_node->get_preorder_number());
-					f1a.get_component(0)->disallow_siblings_subtree();
-						a_split_node->allow_siblings_subtree();
-//					if (a_split_node->lchild() != NULL)
-//						a_split_node->lchild()->allow_siblings_subtree();
-//					if (a_split_node->rchild() != NULL)
-//						a_split_node->rchild()->allow_siblings_subtree();
-					// something odd going on here
-					int start = rSPR_worse_3_approx(a_split_node, &f1a, &f2a);
-					if (start == INT_MAX)
-						start = 0;
-					start /= 3;
-					int end = f1.get_component(0)->size();
-					for(k = start; true; k++) {
-						// TODO: figure out the bug here
-						if (k > end) {
-							k = 0;
-							done_split = true;
-							break;
-						}
-				/*	if (k > SPLIT_APPROX_THRESHOLD) {
-						k = 0;
-						tree_fraction *= 0.75;
-						if (verbose)
-							cout << "tree_fraction: " << tree_fraction << endl;
-						continue;
-					}*/
-						Forest f1s = Forest(f1);
-						Forest f2s = Forest(f2);
-						if (!sync_twins(&f1s, &f2s)) {
-							k = 0;
-							done_split = true;
-							break;
-						}
-						if (verbose) {
-							cout << k << " ";
-		  				cout.flush();
-						}
-						Node *split_node = f1s.find_by_prenum(original_split_node->get_preorder_number());
-						f1s.get_component(0)->disallow_siblings_subtree();
-							split_node->allow_siblings_subtree();
-//						if (split_node->lchild() != NULL)
-//							split_node->lchild()->allow_siblings_subtree();
-//						if (split_node->rchild() != NULL)
-//							split_node->rchild()->allow_siblings_subtree();
-							//f1s.get_component(0)->find_subtree_of_size(tree_fraction);
-							set<SiblingPair > *sibling_pairs =
-								find_sibling_pairs_set(split_node);
-							list<Node *> singletons = f2s.find_singletons();
-							list<pair<Forest,Forest> > AFs = list<pair<Forest,Forest> >();
-							list<Node *> protected_stack = list<Node *>();
-
-							int num_ties = 2;
-
-							int split_k = rSPR_branch_and_bound_hlpr(&f1s, &f2s, k,
-									sibling_pairs, &singletons, false, &AFs,
-									&protected_stack, &num_ties);
-							delete sibling_pairs;
-							if (!AFs.empty()) {
-								AFs.front().first.swap(&f1);
-								AFs.front().second.swap(&f2);
-								f2.unprotect_edges();
-								f1.get_component(0)->allow_siblings_subtree();
-								AFs.clear();
-								total_split_k += k - split_k;
-		//						if (k < SPLIT_APPROX_THRESHOLD * 0.75) {
-		//							tree_fraction *= 2;
-		//							if (tree_fraction > INITIAL_TREE_FRACTION)
-		//								tree_fraction = INITIAL_TREE_FRACTION;
-		//						}
-								if (verbose)
-									cout << "split_k: " << k << endl;
-								break;
-							}
-					}
-				}
-				//IN_SPLIT_APPROX = false;
-				num_splits++;
-			}
-	
-			// TODO: approx again? seperate approxes ?
-		}
+		rSPR_branch_and_bound_cluster(&F1, &F2, i, num_clusters, verbose, cout,
+				min_k, max_k, &total_k);
 	}
 
 		if (F1.contains_rho()) {
@@ -5709,6 +6739,25 @@ bool chain_match(Node *T1_node, Node *T2_node, Node *T2_node_end) {
 	return false;
 }
 
+/* total_checkpoint_find
+ * Find the distance of gene tree i in TOTAL_CHECKPOINT, if any, so the
+ * total distance functions can skip it
+ */
+bool total_checkpoint_find(int i, int *k) {
+	return TOTAL_CHECKPOINT != NULL
+			&& TOTAL_CHECKPOINT->find(TOTAL_CHECKPOINT_ROW, i, k);
+}
+
+void total_checkpoint_add(int i, int k) {
+	if (TOTAL_CHECKPOINT == NULL)
+		return;
+	#pragma omp critical(total_checkpoint)
+	{
+		TOTAL_CHECKPOINT->add(TOTAL_CHECKPOINT_ROW, i, k);
+		TOTAL_CHECKPOINT->flush(false);
+	}
+}
+
 int rSPR_total_distance(Node *T1, vector<Node *> &gene_trees) {
 	return rSPR_total_distance(T1, gene_trees, NULL);
 }
@@ -5719,28 +6768,39 @@ int rSPR_total_distance(Node *T1, vector<Node *> &gene_trees,
 	MAIN_CALL = false;
 	int end = gene_trees.size();
 //	T1->preorder_number();
-	#pragma omp parallel for reduction(+ : total) firstprivate(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
 //	for(int j = 0; j < 10; j++)
 //	cout << "T1: " << T1->str_subtree() << endl;
 	for(int i = 0; i < end; i++) {
+		int k;
+		bool resumed = total_checkpoint_find(i, &k);
 			//		cout << i << endl;
 	  cout << "Trying tree #" << i << " : " << gene_trees[i]->str_subtree() << endl;
-	  int k = rSPR_branch_and_bound_simple_clustering(T1, gene_trees[i], VERBOSE);
-
-	  MULTIFURCATING = true;
-		//MULT_4_BRANCH = true;
-		int mult_k = rSPR_branch_and_bound_simple_clustering(T1, gene_trees[i], VERBOSE);
-		MULTIFURCATING = false;
-		//MULT_4_BRANCH = false;
-		
-		if (k != mult_k) {
-		  cout << "BINARY DOES NOT MATCH MULT" << endl;
-		  cout << "T1: " << T1->str_subtree() << endl;;
-		  cout << "BINARY k = " << k << " mult_k = " << mult_k << endl;
-		  break;
-		  }
+		if (resumed) {
+			// not recomputed, so not checked against the multifurcating k
+			cout << "\tRESUMED: k = " << k << endl;
+		}
 		else {
-		  cout << "\tMATCHES: k = " << k << endl;
+		  k = rSPR_branch_and_bound_simple_clustering(T1, gene_trees[i], VERBOSE);
+
+		  MULTIFURCATING = true;
+			//MULT_4_BRANCH = true;
+			int mult_k = rSPR_branch_and_bound_simple_clustering(T1, gene_trees[i], VERBOSE);
+			MULTIFURCATING = false;
+			//MULT_4_BRANCH = false;
+			
+			if (k != mult_k) {
+			  cout << "BINARY DOES NOT MATCH MULT" << endl;
+			  cout << "T1: " << T1->str_subtree() << endl;;
+			  cout << "BINARY k = " << k << " mult_k = " << mult_k << endl;
+#ifndef _OPENMP
+			  break;
+#endif
+			  }
+			else {
+			  cout << "\tMATCHES: k = " << k << endl;
+			}
+			total_checkpoint_add(i, k);
 		}
 		
 		//cout << "\t: k = " << k << endl;
@@ -5768,159 +6828,1096 @@ int rSPR_total_distance(Node *T1, vector<Node *> &gene_trees,
 	return total;
 }
 
-void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees) {
-	rSPR_pairwise_distance(T1, gene_trees, 0, gene_trees.size());
-}
+/* PairDistance
+ * distance between two trees for the pairwise matrix. arg is the approx
+ * flag or the maximum distance, depending on the function
+ */
+typedef int (*PairDistance)(Node *T1, Node *T2, int arg);
 
-void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, bool APPROX) {
-	rSPR_pairwise_distance(T1, gene_trees, 0, gene_trees.size(), APPROX);
+int rSPR_pair_distance(Node *T1, Node *T2, int approx) {
+	if (approx) {
+		Forest F1 = Forest(T1);
+		Forest F2 = Forest(T2);
+		return rSPR_worse_3_approx_distance_only(&F1, &F2)/3;
+	}
+	return rSPR_branch_and_bound_simple_clustering(T1, T2);
 }
 
-void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int start, int end) {
-	rSPR_pairwise_distance(T1, gene_trees, start, end, false);
+int rSPR_pair_distance_max(Node *T1, Node *T2, int max_spr) {
+	Forest F1 = Forest(T1);
+	Forest F2 = Forest(T2);
+	return rSPR_branch_and_bound_range(&F1, &F2, 0, max_spr);
 }
 
-void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int start, int end, bool approx) {
-	MAIN_CALL = false;
-//	T1->preorder_number();
-	vector<int> distances = vector<int>(end-start);
-	#pragma omp parallel for shared(distances) firstprivate(PREFER_RHO)
-	for(int i = start; i < end; i++) {
-		int k;
-		if (approx) {
-			Forest F1 = Forest(T1);
-			Forest F2 = Forest(gene_trees[i]);
-			k = rSPR_worse_3_approx_distance_only(&F1, &F2)/3;
-		}
-		else {
-			k = rSPR_branch_and_bound_simple_clustering(T1, gene_trees[i]);
-		}
-		distances[i-start] = k;
+/* sorted_subtree
+ * A string of the subtree at n that does not depend on the order of
+ * children. The strings of n and its descendants are stored in subtrees
+ */
+string sorted_subtree(Node *n, map<Node *, string> *subtrees) {
+	string s;
+	if (n->is_leaf()) {
+		s = n->get_name();
 	}
+	else {
+		vector<string> children = vector<string>();
+		list<Node *>::iterator c;
+		for(c = n->get_children().begin(); c != n->get_children().end(); c++)
+			children.push_back(sorted_subtree(*c, subtrees));
+		sort(children.begin(), children.end());
+		s = "(";
+		for(int i = 0; i < children.size(); i++) {
+			if (i > 0)
+				s += ",";
+			s += children[i];
+		}
+		s += ")";
+	}
+	(*subtrees)[n] = s;
+	return s;
+}
 
-	cout << distances[0];
-	for(int i = 1; i < end-start; i++) {
-		cout << "," << distances[i];
+void rooting_edges_hlpr(Node *n, Node *root, set<string> &T1_subtrees,
+		map<Node *, string> &T2_subtrees,
+		vector<pair<Node *, Node *> > *edges) {
+	list<Node *>::iterator c;
+	for(c = n->get_children().begin(); c != n->get_children().end(); c++) {
+		// the two edges below the root are one edge of T2
+		if (n != root || n->get_children().size() != 2)
+			edges->push_back(make_pair(*c, n));
+		else if (c == n->get_children().begin())
+			edges->push_back(make_pair(*c, n->rchild()));
+		if (!MULTIFURCATING
+				&& T1_subtrees.count(T2_subtrees[*c]) > 0)
+			continue;
+		rooting_edges_hlpr(*c, root, T1_subtrees, T2_subtrees, edges);
 	}
-	cout << "\n";
 }
 
+/* rooting_edges
+ * The (node, neighbour) edges of T2 to root it on, one for each class of
+ * rootings. A rooting inside a pendant subtree S of T2 that is also a
+ * pendant subtree of T1 is never better than the rooting at the top of
+ * S: any agreement forest of it has a component inside S, and replacing
+ * the components inside S by S itself gives an agreement forest of the
+ * rooting at the top of S. So rootings inside such subtrees are all
+ * represented by the rooting above them
+ */
+vector<pair<Node *, Node *> > rooting_edges(Node *T1, Node *T2) {
+	T2->fixroot();
+	map<Node *, string> T1_map = map<Node *, string>();
+	map<Node *, string> T2_subtrees = map<Node *, string>();
+	sorted_subtree(T1, &T1_map);
+	sorted_subtree(T2, &T2_subtrees);
+	set<string> T1_subtrees = set<string>();
+	for(map<Node *, string>::iterator i = T1_map.begin(); i != T1_map.end();
+			i++)
+		T1_subtrees.insert(i->second);
+	vector<pair<Node *, Node *> > edges = vector<pair<Node *, Node *> >();
+	rooting_edges_hlpr(T2, T2, T1_subtrees, T2_subtrees, &edges);
+	return edges;
+}
 
-void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int max_spr) {
-	rSPR_pairwise_distance(T1, gene_trees, max_spr, 0, (int)gene_trees.size());
+// root T, which has been rooted by earlier calls, on edge
+void reroot_edge(Node *T, pair<Node *, Node *> &edge) {
+	if (edge.first->parent() == edge.second)
+		T->reroot(edge.first);
+	else
+		T->reroot(edge.second);
+	T->renumber();
 }
 
-void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int max_spr, int start, int end) {
-	MAIN_CALL = false;
-//	T1->preorder_number();
-	vector<int> distances = vector<int>(end-start);
-	#pragma omp parallel for shared(distances) firstprivate(PREFER_RHO)
-	for(int i = start; i < end; i++) {
+/* rooting_bounds
+ * Bound the distance of T1 and each rooting of T2 on edges with the
+ * 3-approximation. Returns (lower bound, edge) pairs in increasing order
+ * of lower bound and lowers best_k to the smallest approximate agreement
+ * forest
+ */
+vector<pair<int, int> > rooting_bounds(Node *T1, Node *T2,
+		vector<pair<Node *, Node *> > &edges, int *best_k) {
+	vector<pair<int, int> > rootings = vector<pair<int, int> >();
+	for(int j = 0; j < edges.size(); j++) {
+		reroot_edge(T2, edges[j]);
 		Forest F1 = Forest(T1);
-		Forest F2 = Forest(gene_trees[i]);
-		int k = rSPR_branch_and_bound_range(&F1, &F2, 0, max_spr);
-		distances[i-start] = k;
+		Forest F2 = Forest(T2);
+		int approx = rSPR_worse_3_approx(&F1, &F2);
+		rootings.push_back(make_pair(approx / 3, j));
+		if (F2.num_components() - 1 < *best_k)
+			*best_k = F2.num_components() - 1;
+	}
+	stable_sort(rootings.begin(), rootings.end());
+	return rootings;
+}
+
+/* rSPR_pair_distance_unrooted
+ * minimum over the rootings of T2. Rootings are solved in order of their
+ * lower bounds, each only below the best distance so far, and the rest
+ * are skipped once their lower bound reaches it
+ */
+int rSPR_pair_distance_unrooted(Node *T1, Node *T2, int approx) {
+	int best_k = INT_MAX;
+	Node *T2_copy = new Node(*T2);
+	if (approx) {
+		vector<Node *> descendants = 
+				T2_copy->find_descendants();
+		for(int j = 0; j < descendants.size(); j++) {
+			T2_copy->reroot(descendants[j]);
+			T2_copy->renumber();
+			Forest F1 = Forest(T1);
+			Forest F2 = Forest(T2_copy);
+			int k = rSPR_worse_3_approx(&F1, &F2) / 3;
+			if (k < best_k) {
+				best_k = k;
+			}
+		}
+		T2_copy->delete_tree();
+		return best_k;
+	}
+	vector<pair<Node *, Node *> > edges = rooting_edges(T1, T2_copy);
+	vector<pair<int, int> > rootings =
+			rooting_bounds(T1, T2_copy, edges, &best_k);
+	for(int r = 0; r < rootings.size(); r++) {
+		if (rootings[r].first >= best_k)
+			break;
+		reroot_edge(T2_copy, edges[rootings[r].second]);
+		// above best_k - 1 only when the search was cut off
+		CUT_OFF_ABOVE_MAX = true;
+		int k = rSPR_branch_and_bound_simple_clustering(T1, T2_copy, false,
+				-1, best_k - 1);
+		CUT_OFF_ABOVE_MAX = false;
+		if (k < best_k) {
+			best_k = k;
+		}
 	}
+	T2_copy->delete_tree();
+	return best_k;
+}
 
-	cout << distances[0];
-	for(int i = 1; i < end-start; i++) {
-		cout << "," << distances[i];
+int rSPR_pair_distance_unrooted_max(Node *T1, Node *T2, int max_spr) {
+	int best_k = (max_spr < INT_MAX ? max_spr + 1 : INT_MAX);
+	Node *T2_copy = new Node(*T2);
+	vector<pair<Node *, Node *> > edges = rooting_edges(T1, T2_copy);
+	vector<pair<int, int> > rootings =
+			rooting_bounds(T1, T2_copy, edges, &best_k);
+	for(int r = 0; r < rootings.size(); r++) {
+		if (rootings[r].first >= best_k)
+			break;
+		reroot_edge(T2_copy, edges[rootings[r].second]);
+		Forest F1 = Forest(T1);
+		Forest F2 = Forest(T2_copy);
+		int k = rSPR_branch_and_bound_range(&F1, &F2, rootings[r].first,
+				best_k - 1);
+		if (k >= 0) {
+			best_k = k;
+		}
 	}
-	cout << "\n";
+	T2_copy->delete_tree();
+	if (best_k > max_spr)
+		return -1;
+	return best_k;
 }
 
-void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
-	rSPR_pairwise_distance_unrooted(T1, gene_trees, 0, gene_trees.size());
+int rf_pair_distance(Node *T1, Node *T2, int) {
+	return rf_distance(T1, T2);
 }
 
-void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, bool approx) {
-	rSPR_pairwise_distance_unrooted(T1, gene_trees, 0, gene_trees.size(), approx);
+int rf_pair_distance_unrooted(Node *T1, Node *T2, int) {
+	int best_k = INT_MAX;
+	Node T2_copy = Node(*T2);
+	vector<Node *> descendants = 
+			T2_copy.find_descendants();
+	for(int j = 0; j < descendants.size(); j++) {
+		T2_copy.reroot(descendants[j]);
+		T2_copy.renumber();
+		int k = rf_distance(T1, &T2_copy);
+		if (k < best_k) {
+			best_k = k;
+		}
+	}
+	return best_k;
 }
 
-void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int start, int end) {
-	rSPR_pairwise_distance_unrooted(T1, gene_trees, 0, gene_trees.size(), false);
+void print_distances(vector<int> &distances) {
+	cout << distances[0];
+	for(int i = 1; i < distances.size(); i++) {
+		cout << "," << distances[i];
+	}
+	cout << "\n";
 }
 
-void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int start, int end, bool approx) {
+// one row of the pairwise matrix: T1 against gene_trees[start,end)
+void pairwise_distance(Node *T1, vector<Node *> &gene_trees, int start,
+		int end, PairDistance distance, int arg) {
 	MAIN_CALL = false;
-	T1->preorder_number();
 	vector<int> distances = vector<int>(end-start);
-	#pragma omp parallel for shared(distances) firstprivate(PREFER_RHO)
+	#pragma omp parallel for shared(distances) copyin(PREFER_RHO)
 	for(int i = start; i < end; i++) {
-		int best_k = INT_MAX;
-		Node *T2_copy = new Node(*(gene_trees[i]));
-		vector<Node *> descendants = 
-				T2_copy->find_descendants();
-		for(int j = 0; j < descendants.size(); j++) {
-			T2_copy->reroot(descendants[j]);
-			T2_copy->set_depth(0);
-			T2_copy->fix_depths();
-			T2_copy->preorder_number();
-	//				cout << i << "," << j << endl;
-	//				cout << T1->str_subtree() << endl;
-	//				cout << gene_trees[i]->str_subtree() << endl;
-			int k;
-			if (approx) {
-				Forest F1 = Forest(T1);
-				Forest F2 = Forest(T2_copy);
-				k = rSPR_worse_3_approx(&F1, &F2) / 3;
+		distances[i-start] = distance(T1, gene_trees[i], arg);
+	}
+	print_distances(distances);
+}
+
+#define PAIRWISE_TILE 8
+
+/* PairwiseTile
+ * A block of cells of the pairwise matrix, computed by one task
+ */
+class PairwiseTile {
+	public:
+	int row_start;
+	int row_end;
+	int col_start;
+	int col_end;
+	double cost;
+
+	PairwiseTile(int row_start, int row_end, int col_start, int col_end) {
+		this->row_start = row_start;
+		this->row_end = row_end;
+		this->col_start = col_start;
+		this->col_end = col_end;
+		this->cost = 0;
+	}
+
+	// most expensive first
+	bool operator<(const PairwiseTile &t) const {
+		return cost > t.cost;
+	}
+};
+
+// the state of a cell of a PairwiseMatrix. Known cells come from an
+// earlier matrix that is being extended
+enum PairwiseCell {CELL_PENDING, CELL_RESUMED, CELL_KNOWN, CELL_OTHER_SHARD};
+
+/* PairwiseMatrix
+ * Rows [row_start,row_end) and columns [col_start,col_end) of a pairwise
+ * distance matrix. If symmetric, cells left of the diagonal are not
+ * computed, and fill prints them from the mirrored cell when it is in the
+ * requested range. Rows are output in order as soon as they are complete,
+ * as text, to a binary file, or with sparse as the i,j,d lines of their
+ * cells with a distance (other than the diagonal). With print_cells each
+ * finished cell is printed as i,j,d instead
+ */
+class PairwiseMatrix {
+	public:
+	int row_start;
+	int row_end;
+	int col_start;
+	int col_end;
+	bool symmetric;
+	bool fill;
+	vector<int> distances;
+	vector<double> costs;	// estimated cost of each cell, if known
+	vector<int> row_remaining;	// cells still to compute
+	int next_row;	// first row not yet printed
+	vector<char> cells;	// PairwiseCell of each cell
+	vector<int> upper;	// upper bounds, when distance is a lower bound
+	PairCheckpoint *checkpoint;	// records finished cells, if not NULL
+	bool print_cells;
+	bool sparse;
+	BinaryMatrixWriter *binary;	// writes the rows, if not NULL
+
+	PairwiseMatrix(int row_start, int row_end, int col_start, int col_end,
+			bool symmetric, bool fill) {
+		this->row_start = row_start;
+		this->row_end = max(row_start, row_end);
+		this->col_start = col_start;
+		this->col_end = max(col_start, col_end);
+		this->symmetric = symmetric;
+		this->fill = fill;
+		distances = vector<int>((this->row_end - row_start)
+				* (this->col_end - col_start), -1);
+		row_remaining = vector<int>(this->row_end - row_start, 0);
+		next_row = row_start;
+		cells = vector<char>(distances.size(), CELL_PENDING);
+		checkpoint = NULL;
+		print_cells = false;
+		sparse = false;
+		binary = NULL;
+	}
+
+	inline int index(int i, int j) {
+		return (i - row_start) * (col_end - col_start) + (j - col_start);
+	}
+
+	inline bool computed(int i, int j) {
+		return i >= row_start && i < row_end && j >= col_start && j < col_end
+				&& (!symmetric || j >= i) && cells[index(i, j)] != CELL_OTHER_SHARD;
+	}
+
+	// computed cells that were not found in the checkpoint
+	inline bool pending(int i, int j) {
+		return computed(i, j) && cells[index(i, j)] == CELL_PENDING;
+	}
+
+	inline void set_known(int i, int j, int d) {
+		distance(i, j) = d;
+		cells[index(i, j)] = CELL_KNOWN;
+	}
+
+	inline int &distance(int i, int j) {
+		return distances[index(i, j)];
+	}
+
+	inline double &cost(int i, int j) {
+		return costs[index(i, j)];
+	}
+
+	/* resume
+	 * Take the distances of the computed cells that are in checkpoint and
+	 * record the cells that are finished from now on. Call before tiles()
+	 */
+	void resume(PairCheckpoint *checkpoint) {
+		this->checkpoint = checkpoint;
+		for(int i = row_start; i < row_end; i++) {
+			for(int j = col_start; j < col_end; j++) {
+				if (computed(i, j) && checkpoint->find(i, j, &distance(i, j)))
+					cells[index(i, j)] = CELL_RESUMED;
 			}
-			else {
-				k = rSPR_branch_and_bound_simple_clustering(T1, T2_copy, false);
+		}
+	}
+
+	/* select_shard
+	 * Keep only the tiles of shard (0 to num_shards - 1). tiles must be the
+	 * tiles of the whole matrix, most expensive first, so that each process
+	 * of a sharded run makes the same choice. Each tile goes to the shard
+	 * with the least total cost so far
+	 */
+	void select_shard(vector<PairwiseTile> &tiles, int shard, int num_shards) {
+		vector<double> load = vector<double>(num_shards, 0);
+		for(int t = 0; t < tiles.size(); t++) {
+			int best = 0;
+			for(int s = 1; s < num_shards; s++) {
+				if (load[s] < load[best])
+					best = s;
 			}
-			if (k < best_k) {
-				best_k = k;
+			load[best] += tiles[t].cost;
+			if (best == shard)
+				continue;
+			for(int i = tiles[t].row_start; i < tiles[t].row_end; i++) {
+				for(int j = tiles[t].col_start; j < tiles[t].col_end; j++) {
+					if (pending(i, j))
+						cells[index(i, j)] = CELL_OTHER_SHARD;
+				}
 			}
 		}
-		distances[i-start] = best_k;
-		T2_copy->delete_tree();
+		// tiles() counts the remaining cells again
+		row_remaining = vector<int>(row_end - row_start, 0);
+	}
+
+	// split the pending cells into tiles
+	vector<PairwiseTile> tiles() {
+		vector<PairwiseTile> tiles = vector<PairwiseTile>();
+		for(int i = row_start; i < row_end; i += PAIRWISE_TILE) {
+			for(int j = col_start; j < col_end; j += PAIRWISE_TILE) {
+				PairwiseTile tile = PairwiseTile(i, min(i + PAIRWISE_TILE, row_end),
+						j, min(j + PAIRWISE_TILE, col_end));
+				int cells = 0;
+				for(int r = tile.row_start; r < tile.row_end; r++) {
+					for(int c = tile.col_start; c < tile.col_end; c++) {
+						if (pending(r, c)) {
+							row_remaining[r - row_start]++;
+							cells++;
+						}
+					}
+				}
+				if (cells > 0)
+					tiles.push_back(tile);
+			}
+		}
+		return tiles;
 	}
 
-	cout << distances[0];
-	for(int i = 1; i < end-start; i++) {
-		cout << "," << distances[i];
+	// record a finished tile and print the rows that are now complete
+	void finish_tile(const PairwiseTile &tile) {
+		for(int r = tile.row_start; r < tile.row_end; r++) {
+			for(int c = tile.col_start; c < tile.col_end; c++) {
+				if (pending(r, c)) {
+					row_remaining[r - row_start]--;
+					if (checkpoint != NULL)
+						checkpoint->add(r, c, distance(r, c));
+					if (print_cells)
+						cout << r << "," << c << "," << distance(r, c) << "\n";
+				}
+			}
+		}
+		if (checkpoint != NULL)
+			checkpoint->flush(false);
+		print_complete_rows();
 	}
-	cout << "\n";
+
+	// print the cells taken from the checkpoint, with print_cells
+	void print_resumed_cells() {
+		for(int i = row_start; i < row_end; i++) {
+			for(int j = col_start; j < col_end; j++) {
+				if (computed(i, j) && cells[index(i, j)] == CELL_RESUMED)
+					cout << i << "," << j << "," << distance(i, j) << "\n";
+			}
+		}
+	}
+
+	void print_complete_rows() {
+		if (print_cells)
+			return;
+		while (next_row < row_end && row_remaining[next_row - row_start] == 0) {
+			output_row(next_row);
+			next_row++;
+		}
+	}
+
+	void output_row(int i) {
+		if (binary != NULL)
+			write_binary_row(i);
+		else if (sparse)
+			print_sparse_row(i);
+		else
+			print_row(i);
+	}
+
+	void write_binary_row(int i) {
+		vector<int> row = vector<int>();
+		for(int j = binary->header.row_begin(i); j < col_end; j++)
+			row.push_back(computed(i, j) ? distance(i, j) : -2);
+		binary->write_row(i, row.empty() ? NULL : &row[0]);
+	}
+
+	void print_sparse_row(int i) {
+		for(int j = col_start; j < col_end; j++) {
+			if (j != i && computed(i, j) && distance(i, j) >= 0) {
+				cout << i << "," << j << ",";
+				print_cell(i, j);
+				cout << "\n";
+			}
+		}
+	}
+
+	void print_row(int i) {
+		for(int j = col_start; j < col_end; j++) {
+			if (j > col_start)
+				cout << ",";
+			if (computed(i, j))
+				print_cell(i, j);
+			else if (fill && computed(j, i))
+				print_cell(j, i);
+		}
+		cout << "\n";
+	}
+
+	// the distance of a cell, or [lo,hi] if it is only bounded
+	void print_cell(int i, int j) {
+		if (!upper.empty() && upper[index(i, j)] > distance(i, j))
+			cout << "[" << distance(i, j) << "," << upper[index(i, j)] << "]";
+		else
+			cout << distance(i, j);
+	}
+};
+
+/* pair_cost
+ * Estimated relative time to find the exact distance of a pair of trees
+ * with n nodes from its 3-approximation. The search grows as about
+ * 2.42^k n and the approximation is at most 3k. Unrooted comparisons
+ * repeat the search for each of the rootings of the second tree
+ */
+double pair_cost(int n, int approx, bool unrooted, int max_k) {
+	double k = approx / 3.0;
+	if (k > max_k)
+		k = max_k;
+	double cost = n * pow(2.42, k);
+	if (unrooted)
+		cost *= n;
+	return cost;
 }
 
-void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int max_spr) {
-	rSPR_pairwise_distance_unrooted(T1, gene_trees, max_spr, 0, (int)gene_trees.size());
+/* TileColumns
+ * The Node trees of the columns of a tile, built from their CompactTrees
+ * when first used and shared by the rows of the tile. The pair distances
+ * copy T2 before changing it, so a column tree can be reused
+ */
+class TileColumns {
+	private:
+	vector<CompactTree> &trees;
+	int col_start;
+	vector<Node *> columns;
+	// the trees are owned, so not copied
+	TileColumns(const TileColumns &);
+
+	public:
+	TileColumns(vector<CompactTree> &trees, PairwiseTile &tile)
+			: trees(trees) {
+		col_start = tile.col_start;
+		columns = vector<Node *>(tile.col_end - tile.col_start, NULL);
+	}
+	~TileColumns() {
+		for(int j = 0; j < columns.size(); j++) {
+			if (columns[j] != NULL)
+				columns[j]->delete_tree();
+		}
+	}
+	Node *get(int j) {
+		Node *&T2 = columns[j - col_start];
+		if (T2 == NULL)
+			T2 = trees[j].to_node();
+		return T2;
+	}
+};
+
+/* estimate_pairwise_costs
+ * Find the cost of each cell of matrix from its approximate distance,
+ * in parallel, and add them to the cost of their tiles. Costs found by
+ * an earlier call are reused
+ */
+void estimate_pairwise_costs(vector<CompactTree> &trees,
+		PairwiseMatrix &matrix, vector<PairwiseTile> &tiles, bool unrooted,
+		int max_k) {
+	if (matrix.costs.empty())
+		matrix.costs = vector<double>(matrix.distances.size(), 0);
+	int num_tiles = tiles.size();
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int t = 0; t < num_tiles; t++) {
+		PairwiseTile &tile = tiles[t];
+		TileColumns columns(trees, tile);
+		for(int i = tile.row_start; i < tile.row_end; i++) {
+			Node *T1 = trees[i].to_node();
+			T1->preorder_number();
+			for(int j = tile.col_start; j < tile.col_end; j++) {
+				if (!matrix.pending(i, j))
+					continue;
+				if (matrix.cost(i, j) == 0) {
+					Forest F1 = Forest(T1);
+					Forest F2 = Forest(columns.get(j));
+					int approx = rSPR_worse_3_approx_distance_only(&F1, &F2);
+					matrix.cost(i, j) = pair_cost(trees[i].size(), approx, unrooted,
+							max_k);
+				}
+				tile.cost += matrix.cost(i, j);
+			}
+			T1->delete_tree();
+		}
+	}
 }
 
-void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int max_spr, int start, int end) {
+/* pairwise_tiles
+ * The tiles of matrix, most expensive first. If estimate, the cost of a
+ * tile comes from the approximate distances of its cells (see
+ * estimate_pairwise_costs), otherwise from the sizes of its trees
+ */
+vector<PairwiseTile> pairwise_tiles(vector<CompactTree> &trees,
+		PairwiseMatrix &matrix, bool estimate, bool unrooted, int max_k) {
+	vector<PairwiseTile> tiles = matrix.tiles();
+	if (estimate) {
+		estimate_pairwise_costs(trees, matrix, tiles, unrooted, max_k);
+	}
+	else {
+		for(int t = 0; t < tiles.size(); t++) {
+			PairwiseTile &tile = tiles[t];
+			for(int i = tile.row_start; i < tile.row_end; i++) {
+				for(int j = tile.col_start; j < tile.col_end; j++) {
+					if (matrix.pending(i, j))
+						tile.cost += (double)trees[i].size() * trees[j].size();
+				}
+			}
+		}
+	}
+	stable_sort(tiles.begin(), tiles.end());
+	return tiles;
+}
+
+/* pairwise_distance
+ * Compute and print part of the pairwise matrix of trees kept as
+ * CompactTrees. The cells are split into tiles that are scheduled
+ * together across threads, most expensive first. Node trees are built
+ * once per row and column of a tile
+ */
+void pairwise_distance(vector<CompactTree> &trees, PairwiseMatrix &matrix,
+		vector<PairwiseTile> &tiles, PairDistance distance, int arg) {
 	MAIN_CALL = false;
-	T1->preorder_number();
-	vector<int> distances = vector<int>(end-start);
-	#pragma omp parallel for shared(distances) firstprivate(PREFER_RHO)
+	int num_tiles = tiles.size();
+	#pragma omp parallel for schedule(dynamic, 1) copyin(PREFER_RHO)
+	for(int t = 0; t < num_tiles; t++) {
+		PairwiseTile &tile = tiles[t];
+		TileColumns columns(trees, tile);
+		for(int i = tile.row_start; i < tile.row_end; i++) {
+			Node *T1 = trees[i].to_node();
+			T1->preorder_number();
+			for(int j = tile.col_start; j < tile.col_end; j++) {
+				if (!matrix.pending(i, j))
+					continue;
+				matrix.distance(i, j) = distance(T1, columns.get(j), arg);
+			}
+			T1->delete_tree();
+		}
+		#pragma omp critical(pairwise_matrix)
+		matrix.finish_tile(tile);
+	}
+	// rows with nothing to compute
+	matrix.print_complete_rows();
+	if (matrix.print_cells)
+		matrix.print_resumed_cells();
+	if (matrix.checkpoint != NULL)
+		matrix.checkpoint->flush(true);
+}
+
+/* rf_pairwise_distance
+ * Compute and print part of the pairwise RF matrix of trees kept as
+ * CompactTrees. The clusters of each tree are hashed once, so a cell is
+ * a merge of two sorted split lists, or one pass over the second tree
+ * if unrooted. Pairs with different leaves, or an unrooted second tree
+ * without a binary root, are compared as Node trees instead
+ */
+void rf_pairwise_distance(vector<CompactTree> &trees, PairwiseMatrix &matrix,
+		vector<PairwiseTile> &tiles, bool unrooted) {
+	int start = min(matrix.row_start, matrix.col_start);
+	int end = max(matrix.row_end, matrix.col_end);
+	vector<SplitSet> split_sets = vector<SplitSet>(end);
+	#pragma omp parallel for schedule(dynamic)
 	for(int i = start; i < end; i++) {
-		int best_k = -1;
-		Node *T2_copy = new Node(*(gene_trees[i]));
-		vector<Node *> descendants = 
-				T2_copy->find_descendants();
-		for(int j = 0; j < descendants.size(); j++) {
-			T2_copy->reroot(descendants[j]);
-			T2_copy->set_depth(0);
-			T2_copy->fix_depths();
-			T2_copy->preorder_number();
-	//				cout << i << "," << j << endl;
-	//				cout << T1->str_subtree() << endl;
-	//				cout << gene_trees[i]->str_subtree() << endl;
-			Forest F1 = Forest(T1);
-			Forest F2 = Forest(T2_copy);
-			int k = rSPR_branch_and_bound_range(&F1, &F2, 0, max_spr);
-			if ((best_k == -1) || (k < best_k && k >= 0)) {
-				best_k = k;
+		if ((i >= matrix.row_start && i < matrix.row_end)
+				|| (i >= matrix.col_start && i < matrix.col_end))
+			split_sets[i] = SplitSet(trees[i], unrooted);
+	}
+	PairDistance distance = unrooted ? rf_pair_distance_unrooted
+			: rf_pair_distance;
+	int num_tiles = tiles.size();
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int t = 0; t < num_tiles; t++) {
+		PairwiseTile &tile = tiles[t];
+		TileColumns columns(trees, tile);
+		for(int i = tile.row_start; i < tile.row_end; i++) {
+			Node *T1 = NULL;
+			for(int j = tile.col_start; j < tile.col_end; j++) {
+				if (!matrix.pending(i, j))
+					continue;
+				SplitSet &S1 = split_sets[i];
+				SplitSet &S2 = split_sets[j];
+				if (S1.same_leaves(S2) && !unrooted) {
+					matrix.distance(i, j) = rf_distance(S1, S2);
+				}
+				else if (S1.same_leaves(S2) && S2.unrooted) {
+					matrix.distance(i, j) = rf_distance_unrooted(S1, S2);
+				}
+				else {
+					if (T1 == NULL) {
+						T1 = trees[i].to_node();
+						T1->preorder_number();
+					}
+					matrix.distance(i, j) = distance(T1, columns.get(j), 0);
+				}
 			}
+			if (T1 != NULL)
+				T1->delete_tree();
 		}
-		distances[i-start] = best_k;
-		T2_copy->delete_tree();
+		#pragma omp critical(pairwise_matrix)
+		matrix.finish_tile(tile);
 	}
+	matrix.print_complete_rows();
+	if (matrix.print_cells)
+		matrix.print_resumed_cells();
+	if (matrix.checkpoint != NULL)
+		matrix.checkpoint->flush(true);
+}
 
-	cout << distances[0];
-	for(int i = 1; i < end-start; i++) {
-		cout << "," << distances[i];
+/* pairwise_tiered
+ * Compute and print part of the pairwise matrix of trees in two tiers.
+ * First each cell is bounded by its 3-approximation: a third of the
+ * approximate distance below and the size of the approximate agreement
+ * forest above. Then, most expensive tiles first, the exact
+ * search narrows the bounds of each cell until they meet. It is finished
+ * for cells that may have a distance of at most max_k and otherwise
+ * stops seconds after it started on the cell. Unresolved cells are
+ * printed as [lo,hi]
+ */
+void pairwise_tiered(vector<CompactTree> &trees, PairwiseMatrix &matrix,
+		vector<PairwiseTile> &tiles, int max_k, double seconds) {
+	MAIN_CALL = false;
+	matrix.upper = vector<int>(matrix.distances.size(), 0);
+	int num_tiles = tiles.size();
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int t = 0; t < num_tiles; t++) {
+		PairwiseTile &tile = tiles[t];
+		TileColumns columns(trees, tile);
+		tile.cost = 0;
+		for(int i = tile.row_start; i < tile.row_end; i++) {
+			Node *T1 = trees[i].to_node();
+			T1->preorder_number();
+			for(int j = tile.col_start; j < tile.col_end; j++) {
+				if (!matrix.pending(i, j))
+					continue;
+				Forest F1 = Forest(T1);
+				Forest F2 = Forest(columns.get(j));
+				int approx = rSPR_worse_3_approx(&F1, &F2);
+				int lo = (approx + 2) / 3;
+				int hi = max(lo, F2.num_components() - 1);
+				matrix.distance(i, j) = lo;
+				matrix.upper[matrix.index(i, j)] = hi;
+				if (lo < hi)
+					tile.cost += pair_cost(trees[i].size(), approx, false, INT_MAX);
+			}
+			T1->delete_tree();
+		}
+	}
+	stable_sort(tiles.begin(), tiles.end());
+	#pragma omp parallel for schedule(dynamic, 1) copyin(PREFER_RHO)
+	for(int t = 0; t < num_tiles; t++) {
+		PairwiseTile &tile = tiles[t];
+		TileColumns columns(trees, tile);
+		for(int i = tile.row_start; i < tile.row_end; i++) {
+			Node *T1 = NULL;
+			for(int j = tile.col_start; j < tile.col_end; j++) {
+				int *hi = &matrix.upper[matrix.index(i, j)];
+				if (!matrix.pending(i, j) || matrix.distance(i, j) >= *hi)
+					continue;
+				if (T1 == NULL) {
+					T1 = trees[i].to_node();
+					T1->preorder_number();
+				}
+				Node *T2 = columns.get(j);
+				// pairs within max_k are solved as by -pairwise
+				if (*hi - 1 <= max_k) {
+					matrix.distance(i, j) =
+							rSPR_branch_and_bound_simple_clustering(T1, T2);
+					*hi = matrix.distance(i, j);
+				}
+				else {
+					rSPR_branch_and_bound_interval(T1, T2,
+							&matrix.distance(i, j), hi, max_k, seconds);
+				}
+			}
+			if (T1 != NULL)
+				T1->delete_tree();
+		}
+		#pragma omp critical(pairwise_matrix)
+		matrix.finish_tile(tile);
 	}
-	cout << "\n";
+	matrix.print_complete_rows();
+}
+
+/* pairwise_estimate
+ * Print the estimated cost of the cells of matrix instead of computing
+ * them. If samples > 0, that many cells spread over the range of costs
+ * are solved and timed on one thread to convert the cost to seconds
+ */
+void pairwise_estimate(vector<CompactTree> &trees, PairwiseMatrix &matrix,
+		PairDistance distance, int arg, int samples) {
+	vector<pair<double, pair<int, int> > > cells =
+			vector<pair<double, pair<int, int> > >();
+	double total_cost = 0;
+	for(int i = matrix.row_start; i < matrix.row_end; i++) {
+		for(int j = matrix.col_start; j < matrix.col_end; j++) {
+			if (matrix.pending(i, j)) {
+				cells.push_back(make_pair(matrix.cost(i, j), make_pair(i, j)));
+				total_cost += matrix.cost(i, j);
+			}
+		}
+	}
+	cout << "pairs=" << cells.size() << endl;
+	cout << "estimated cost=" << total_cost << endl;
+	if (samples <= 0 || cells.empty())
+		return;
+	if (samples > cells.size())
+		samples = cells.size();
+	sort(cells.begin(), cells.end());
+	MAIN_CALL = false;
+	double sample_cost = 0;
+	double sample_time = 0;
+	for(int s = 0; s < samples; s++) {
+		int c = (samples == 1 ? cells.size() / 2
+				: (long)s * (cells.size() - 1) / (samples - 1));
+		int i = cells[c].second.first;
+		int j = cells[c].second.second;
+		Node *T1 = trees[i].to_node();
+		T1->preorder_number();
+		Node *T2 = trees[j].to_node();
+		double start = clock()/(double)CLOCKS_PER_SEC;
+		distance(T1, T2, arg);
+		sample_time += clock()/(double)CLOCKS_PER_SEC - start;
+		sample_cost += cells[c].first;
+		T1->delete_tree();
+		T2->delete_tree();
+	}
+	cout << "sampled pairs=" << samples << endl;
+	cout << "estimated seconds=" << total_cost * sample_time / sample_cost
+		<< " (one thread)" << endl;
+}
+
+/* read_pairwise_matrix
+ * Take the known distances of the first trees of matrix from file, an
+ * earlier -pairwise matrix written by -pairwise_binary or as text with or
+ * without its lower left triangle. Sets num_trees to the number of trees
+ * in the file. Returns false and sets error if the file can not be used
+ */
+bool read_pairwise_matrix(const string &file, PairwiseMatrix &matrix,
+		int *num_trees, string *error) {
+	ifstream in(file.c_str(), ios::binary);
+	if (!in) {
+		*error = "could not open " + file;
+		return false;
+	}
+	char magic[8] = "";
+	in.read(magic, sizeof(magic));
+	if (in && memcmp(magic, BINARY_MATRIX_MAGIC, sizeof(magic)) == 0) {
+		in.close();
+		BinaryMatrix binary;
+		if (!binary.load(file, error))
+			return false;
+		*num_trees = binary.header.row_end;
+		if (binary.header.row_start != 0 || binary.header.col_start != 0
+				|| binary.header.col_end != *num_trees) {
+			*error = file + " is not a whole matrix";
+			return false;
+		}
+		for(int i = matrix.row_start; i < min(matrix.row_end, *num_trees); i++) {
+			for(int j = matrix.col_start; j < min(matrix.col_end, *num_trees); j++) {
+				int d = binary.distance(i, j);
+				if (matrix.computed(i, j) && d >= -1)
+					matrix.set_known(i, j, d);
+			}
+		}
+		return true;
+	}
+	in.clear();
+	in.seekg(0);
+	LineReader reader = LineReader(in);
+	char *line;
+	size_t length;
+	int i = 0;
+	while (reader.next(&line, &length)) {
+		int j = 0;
+		char *token = line;
+		for(size_t c = 0; c <= length; c++) {
+			if (c < length && line[c] != ',')
+				continue;
+			line[c] = '\0';
+			if (*token != '\0') {
+				char *end;
+				long d = strtol(token, &end, 10);
+				while (isspace(*end))
+					end++;
+				if (end == token || *end != '\0' || d < -1 || d > INT_MAX) {
+					stringstream message;
+					message << file << " has a bad cell at row " << i
+							<< ", column " << j << ": " << token;
+					*error = message.str();
+					return false;
+				}
+				if (matrix.computed(i, j))
+					matrix.set_known(i, j, d);
+				else if (matrix.computed(j, i))
+					matrix.set_known(j, i, d);
+			}
+			token = &line[c + 1];
+			j++;
+		}
+		if (i > 0 && j != *num_trees) {
+			*error = file + " is not a square matrix";
+			return false;
+		}
+		*num_trees = j;
+		i++;
+	}
+	if (i == 0)
+		*num_trees = 0;
+	if (i != *num_trees) {
+		*error = file + " is not a square matrix";
+		return false;
+	}
+	return true;
+}
+
+/* PairwiseShard
+ * The header line of the output of one shard of a pairwise matrix
+ */
+class PairwiseShard {
+	public:
+	int shard;	// 1 to num_shards
+	int num_shards;
+	int row_start;
+	int row_end;
+	int col_start;
+	int col_end;
+	int symmetric;
+
+	PairwiseShard() {
+		shard = num_shards = 0;
+		row_start = row_end = col_start = col_end = 0;
+		symmetric = 0;
+	}
+
+	PairwiseShard(int shard, int num_shards, PairwiseMatrix &matrix) {
+		this->shard = shard;
+		this->num_shards = num_shards;
+		row_start = matrix.row_start;
+		row_end = matrix.row_end;
+		col_start = matrix.col_start;
+		col_end = matrix.col_end;
+		symmetric = matrix.symmetric;
+	}
+
+	string str() {
+		stringstream ss;
+		ss << "# shard " << shard << "/" << num_shards << " rows " << row_start
+			<< " " << row_end << " columns " << col_start << " " << col_end
+			<< " symmetric " << symmetric;
+		return ss.str();
+	}
+
+	bool parse(const char *line) {
+		return sscanf(line, "# shard %d/%d rows %d %d columns %d %d symmetric %d",
+				&shard, &num_shards, &row_start, &row_end, &col_start, &col_end,
+				&symmetric) == 7;
+	}
+
+	// the same matrix, possibly from another shard
+	bool same_matrix(const PairwiseShard &s) {
+		return num_shards == s.num_shards && row_start == s.row_start
+				&& row_end == s.row_end && col_start == s.col_start
+				&& col_end == s.col_end && symmetric == s.symmetric;
+	}
+};
+
+/* merge_pairwise_shards
+ * Print the matrix whose shards were written to files by -shard runs,
+ * with the symmetric cells filled. If the shards extended an earlier
+ * matrix, its cells are read from append_file. Returns false and sets
+ * error if the files are not all of the complete shards of one matrix
+ */
+bool merge_pairwise_shards(vector<string> &files, const string &append_file,
+		string *error) {
+	PairwiseShard first = PairwiseShard();
+	PairwiseMatrix *matrix = NULL;
+	vector<char> seen = vector<char>();
+	vector<char> shard_seen = vector<char>();
+	for(int f = 0; f < files.size(); f++) {
+		ifstream in(files[f].c_str());
+		LineReader reader = LineReader(in);
+		char *line;
+		size_t length;
+		PairwiseShard shard = PairwiseShard();
+		if (!in || !reader.next(&line, &length) || !shard.parse(line)
+				|| shard.num_shards < 1 || shard.shard < 1
+				|| shard.shard > shard.num_shards) {
+			*error = files[f] + " is not the output of a -shard run";
+			break;
+		}
+		if (matrix == NULL) {
+			first = shard;
+			matrix = new PairwiseMatrix(shard.row_start, shard.row_end,
+					shard.col_start, shard.col_end, shard.symmetric, true);
+			seen = vector<char>(matrix->distances.size(), false);
+			shard_seen = vector<char>(shard.num_shards, false);
+			int num_trees;
+			if (append_file != ""
+					&& !read_pairwise_matrix(append_file, *matrix, &num_trees, error))
+				break;
+			for(int c = 0; c < seen.size(); c++)
+				seen[c] = matrix->cells[c] == CELL_KNOWN;
+		}
+		else if (!first.same_matrix(shard)) {
+			*error = files[f] + " is a shard of a different matrix";
+			break;
+		}
+		if (shard_seen[shard.shard - 1]) {
+			*error = files[f] + " repeats a shard";
+			break;
+		}
+		shard_seen[shard.shard - 1] = true;
+		while (reader.next(&line, &length)) {
+			int i, j, d;
+			if (length == 0)
+				continue;
+			if (sscanf(line, "%d,%d,%d", &i, &j, &d) != 3
+					|| !matrix->computed(i, j) || seen[matrix->index(i, j)]) {
+				*error = files[f] + " has an invalid line: " + line;
+				break;
+			}
+			seen[matrix->index(i, j)] = true;
+			matrix->distance(i, j) = d;
+		}
+		if (*error != "")
+			break;
+	}
+	if (*error == "" && matrix == NULL)
+		*error = "no shard files";
+	if (*error == "") {
+		for(int s = 0; s < shard_seen.size(); s++) {
+			if (!shard_seen[s]) {
+				stringstream ss;
+				ss << "shard " << s + 1 << "/" << first.num_shards << " is missing";
+				*error = ss.str();
+				break;
+			}
+		}
+	}
+	int missing = 0;
+	for(int i = first.row_start; *error == "" && i < first.row_end; i++) {
+		for(int j = first.col_start; j < first.col_end; j++) {
+			if (matrix->computed(i, j) && !seen[matrix->index(i, j)])
+				missing++;
+		}
+	}
+	if (missing > 0) {
+		stringstream ss;
+		ss << missing << " cells are missing from the shards";
+		*error = ss.str();
+	}
+	if (*error == "") {
+		for(int i = first.row_start; i < first.row_end; i++)
+			matrix->print_row(i);
+	}
+	if (matrix != NULL)
+		delete matrix;
+	return *error == "";
+}
+
+void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees) {
+	rSPR_pairwise_distance(T1, gene_trees, 0, gene_trees.size());
+}
+
+void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, bool APPROX) {
+	rSPR_pairwise_distance(T1, gene_trees, 0, gene_trees.size(), APPROX);
+}
+
+void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int start, int end) {
+	rSPR_pairwise_distance(T1, gene_trees, start, end, false);
+}
+
+void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int start, int end, bool approx) {
+	pairwise_distance(T1, gene_trees, start, end, rSPR_pair_distance, approx);
+}
+
+
+void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int max_spr) {
+	rSPR_pairwise_distance(T1, gene_trees, max_spr, 0, (int)gene_trees.size());
+}
+
+void rSPR_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int max_spr, int start, int end) {
+	pairwise_distance(T1, gene_trees, start, end, rSPR_pair_distance_max,
+			max_spr);
+}
+
+void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
+	rSPR_pairwise_distance_unrooted(T1, gene_trees, 0, gene_trees.size());
+}
+
+void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, bool approx) {
+	rSPR_pairwise_distance_unrooted(T1, gene_trees, 0, gene_trees.size(), approx);
+}
+
+void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int start, int end) {
+	rSPR_pairwise_distance_unrooted(T1, gene_trees, 0, gene_trees.size(), false);
+}
+
+void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int start, int end, bool approx) {
+	T1->preorder_number();
+	pairwise_distance(T1, gene_trees, start, end, rSPR_pair_distance_unrooted,
+			approx);
+}
+
+void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int max_spr) {
+	rSPR_pairwise_distance_unrooted(T1, gene_trees, max_spr, 0, (int)gene_trees.size());
+}
+
+void rSPR_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int max_spr, int start, int end) {
+	T1->preorder_number();
+	pairwise_distance(T1, gene_trees, start, end,
+			rSPR_pair_distance_unrooted_max, max_spr);
 }
 
 int rSPR_total_distance_precomputed(Node *T1, vector<Node *> &gene_trees,
@@ -5929,7 +7926,7 @@ int rSPR_total_distance_precomputed(Node *T1, vector<Node *> &gene_trees,
 	MAIN_CALL = false;
 	int end = gene_trees.size();
 //	T1->preorder_number();
-	#pragma omp parallel for reduction(+ : total) firstprivate(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
 	for(int i = 0; i < end; i++) {
 		// check that the SPR move affects the projection of T1
 		Forest F1 = Forest(T1);
@@ -5958,7 +7955,7 @@ int rSPR_total_distance_precomputed(Node *T1, vector<Node *> &gene_trees,
 int rf_total_distance(Node *T1, vector<Node *> &gene_trees) {
 	int total = 0;
 	int end = gene_trees.size();
-	#pragma omp parallel for reduction(+ : total) firstprivate(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
 	for(int i = 0; i < end; i++) {
 			//		cout << i << endl;
 		int k = rf_distance(T1, gene_trees[i]);
@@ -5970,7 +7967,7 @@ int rf_total_distance(Node *T1, vector<Node *> &gene_trees) {
 int rf_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
 	int total = 0;
 	int end = gene_trees.size();
-	#pragma omp parallel for reduction(+ : total) firstprivate(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
 	for(int i = 0; i < end; i++) {
 		int best_k = INT_MAX;
 		Node T2_copy = Node(*(gene_trees[i]));
@@ -5978,9 +7975,7 @@ int rf_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
 				T2_copy.find_descendants();
 		for(int j = 0; j < descendants.size(); j++) {
 			T2_copy.reroot(descendants[j]);
-			T2_copy.set_depth(0);
-			T2_copy.fix_depths();
-			T2_copy.preorder_number();
+			T2_copy.renumber();
 			int k = rf_distance(T1, &T2_copy);
 			if (k < best_k) {
 				best_k = k;
@@ -5998,20 +7993,7 @@ void rf_pairwise_distance(Node *T1, vector<Node *> &gene_trees) {
 }
 
 void rf_pairwise_distance(Node *T1, vector<Node *> &gene_trees, int start, int end) {
-	MAIN_CALL = false;
-//	T1->preorder_number();
-	vector<int> distances = vector<int>(end-start);
-	#pragma omp parallel for shared(distances) firstprivate(PREFER_RHO)
-	for(int i = start; i < end; i++) {
-		int k = rf_distance(T1, gene_trees[i]);
-		distances[i-start] = k;
-	}
-
-	cout << distances[0];
-	for(int i = 1; i < end-start; i++) {
-		cout << "," << distances[i];
-	}
-	cout << "\n";
+	pairwise_distance(T1, gene_trees, start, end, rf_pair_distance, 0);
 }
 
 void rf_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
@@ -6019,36 +8001,8 @@ void rf_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
 }
 
 void rf_pairwise_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int start, int end) {
-	MAIN_CALL = false;
 	T1->preorder_number();
-	vector<int> distances = vector<int>(end-start);
-	#pragma omp parallel for shared(distances) firstprivate(PREFER_RHO)
-	for(int i = start; i < end; i++) {
-		int best_k = INT_MAX;
-		Node T2_copy = Node(*(gene_trees[i]));
-		vector<Node *> descendants = 
-				T2_copy.find_descendants();
-		for(int j = 0; j < descendants.size(); j++) {
-			T2_copy.reroot(descendants[j]);
-			T2_copy.set_depth(0);
-			T2_copy.fix_depths();
-			T2_copy.preorder_number();
-	//				cout << i << "," << j << endl;
-	//				cout << T1->str_subtree() << endl;
-	//				cout << gene_trees[i]->str_subtree() << endl;
-			int k = rf_distance(T1, &T2_copy);
-			if (k < best_k) {
-				best_k = k;
-			}
-		}
-		distances[i-start] = best_k;
-	}
-
-	cout << distances[0];
-	for(int i = 1; i < end-start; i++) {
-		cout << "," << distances[i];
-	}
-	cout << "\n";
+	pairwise_distance(T1, gene_trees, start, end, rf_pair_distance_unrooted, 0);
 }
 
 int rSPR_total_distance(Node *T1, vector<Node *> &gene_trees, int threshold) {
@@ -6056,7 +8010,7 @@ int rSPR_total_distance(Node *T1, vector<Node *> &gene_trees, int threshold) {
 	MAIN_CALL = false;
 	int end = gene_trees.size();
 	T1->preorder_number();
-	#pragma omp parallel for reduction(+ : total) firstprivate(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)  // firstprivate(IN_SPLIT_APPROX)
 	for(int i = 0; i < end; i++) {
 		int k = rSPR_branch_and_bound_simple_clustering(T1, gene_trees[i], VERBOSE);
 //		k *= mylog2(gene_trees[i]->size());
@@ -6071,7 +8025,7 @@ int rSPR_total_distance(Node *T1, vector<Node *> &gene_trees, int threshold) {
 /*Joel's part*/
 int rSPR_total_distance(Forest *T1, vector<Node *> &gene_trees){
 	int total = 0;
-	#pragma omp parallel for reduction(+ : total) firstprivate(PREFER_RHO)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)
 	for(int i = 0; i < gene_trees.size(); i++) {
 		Forest T2 = Forest(gene_trees[i]);
 		total += rSPR_branch_and_bound_simple_clustering(&T2, T1, VERBOSE);
@@ -6081,7 +8035,7 @@ int rSPR_total_distance(Forest *T1, vector<Node *> &gene_trees){
 
 int rSPR_total_approx_distance(Forest *T1, vector<Node *> &gene_trees) {
 	int total = 0;
-	#pragma omp parallel for reduction(+ : total)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)
 	for(int i = 0; i < gene_trees.size(); i++) {
 		Forest F1 = Forest(T1);
 		Forest F2 = Forest(gene_trees[i]);
@@ -6108,8 +8062,15 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 	int total = 0;
 	MAIN_CALL = false;
 	T1->preorder_number();
-	#pragma omp parallel for reduction(+ : total) firstprivate(PREFER_RHO) firstprivate(MAX_SPR) firstprivate(MIN_SPR)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO) firstprivate(MAX_SPR) firstprivate(MIN_SPR)
 	for(int i = 0; i < gene_trees.size(); i++) {
+		int resumed_distance;
+		if (total_checkpoint_find(i, &resumed_distance)) {
+			total += resumed_distance;
+			if (original_scores != NULL)
+				(*original_scores)[i] = resumed_distance;
+			continue;
+		}
 //		cout << "T1: " << T1->str_subtree() << endl;
 //		cout << "T2: " << gene_trees[i]->str_subtree() << endl;
 		Forest f1 = Forest(T1);
@@ -6120,9 +8081,7 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 			continue;
 		if (f2.get_component(0)->get_children().size() > 2) {
 			f2.get_component(0)->fixroot();
-			f2.get_component(0)->set_depth(0);
-			f2.get_component(0)->fix_depths();
-			f2.get_component(0)->preorder_number();
+			f2.get_component(0)->renumber();
 		}
 		//f1.print_components();
 		//f2.print_components();
@@ -6135,14 +8094,12 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 		if (!UNROOTED_MIN_APPROX) {
 //			for(int k = 0; !done; k++) {
 			int best_min_spr = INT_MAX;
-			vector<Node *> descendants = 
-				f2.get_component(0)->find_descendants();
+			vector<pair<Node *, Node *> > edges =
+				rooting_edges(f1.get_component(0), f2.get_component(0));
 /*
 			for(int j = 0; j < descendants.size(); j++) {
 				f2.get_component(0)->reroot(descendants[j]);
-				f2.get_component(0)->set_depth(0);
-				f2.get_component(0)->fix_depths();
-				f2.get_component(0)->preorder_number();
+				f2.get_component(0)->renumber();
 				Forest F1 = Forest(f1);
 				Forest F2 = Forest(f2);
 				int distance = rSPR_worse_3_approx(&F1, &F2)/3;
@@ -6164,15 +8121,11 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 ////					cout << endl;
 //				vector<Node *> descendants = 
 //				f2.get_component(0)->find_descendants();
-				for(int j = 0; j < descendants.size(); j++) {
+				for(int j = 0; j < edges.size(); j++) {
 //					cout << "J=" << j << endl;
 //					cout << i << "," << k << "," << j << endl;
-//					cout << "rooting at: " << descendants[j]->str_subtree() << endl;
 					//f2.get_component(0)->reroot(original_lc);
-					f2.get_component(0)->reroot(descendants[j]);
-					f2.get_component(0)->set_depth(0);
-					f2.get_component(0)->fix_depths();
-					f2.get_component(0)->preorder_number();
+					reroot_edge(f2.get_component(0), edges[j]);
 ////					f2.print_components();
 ////					cout << endl;
 	//			cout << T1->str_subtree() << endl;
@@ -6203,13 +8156,8 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 			MAX_SPR=old_max;
 			MIN_SPR=0;
 			if (!done) {
-				vector<Node *> descendants = 
-					f2.get_component(0)->find_descendants();
-				for(int j = 0; j < descendants.size(); j++) {
-					f2.get_component(0)->reroot(descendants[j]);
-					f2.get_component(0)->set_depth(0);
-					f2.get_component(0)->fix_depths();
-					f2.get_component(0)->preorder_number();
+				for(int j = 0; j < edges.size(); j++) {
+					reroot_edge(f2.get_component(0), edges[j]);
 	//				cout << i << "," << j << endl;
 	//				cout << T1->str_subtree() << endl;
 	//				cout << gene_trees[i]->str_subtree() << endl;
@@ -6225,6 +8173,7 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 			total += best_distance;
 			if (original_scores != NULL)
 				(*original_scores)[i] = best_distance;
+			total_checkpoint_add(i, best_distance);
 	//		cout << "total: " << total << endl;
 		}
 		else {
@@ -6246,9 +8195,7 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 			}
 			for(int j = 0; j < descendants.size(); j++) {
 				f2.get_component(0)->reroot(descendants[j]);
-					f2.get_component(0)->set_depth(0);
-					f2.get_component(0)->fix_depths();
-					f2.get_component(0)->preorder_number();
+					f2.get_component(0)->renumber();
 				//Forest F1 = Forest(f1);
 				//Forest F2 = Forest(f2);
 				int distance = rSPR_worse_3_approx_distance_only(&f1, &f2)/3;
@@ -6267,17 +8214,16 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 				}
 			}
 			f2.get_component(0)->reroot(best_rooting);
-					f2.get_component(0)->set_depth(0);
-					f2.get_component(0)->fix_depths();
-					f2.get_component(0)->preorder_number();
+					f2.get_component(0)->renumber();
 			int k;
 			if (best_approx > 20)
 				k = rSPR_branch_and_bound_simple_clustering(f1.get_component(0), f2.get_component(0), VERBOSE);
 			else
 					k = rSPR_branch_and_bound_range(&f1, &f2, best_approx/3, best_approx);
 			total += k;
-		if (original_scores != NULL)
-			(*original_scores)[i] = k;
+			if (original_scores != NULL)
+				(*original_scores)[i] = k;
+			total_checkpoint_add(i, k);
 		}
 //		if (total > threshold)
 //			break;
@@ -6288,7 +8234,7 @@ int rSPR_total_distance_unrooted(Node *T1, vector<Node *> &gene_trees, int thres
 int rSPR_total_approx_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
 	int total = 0;
 	MAIN_CALL = false;
-	#pragma omp parallel for reduction(+: total)
+	#pragma omp parallel for reduction(+: total) copyin(PREFER_RHO)
 	for(int i = 0; i < gene_trees.size(); i++) {
 		Forest f1 = Forest(T1);
 		Forest f2 = Forest(gene_trees[i]);
@@ -6296,9 +8242,7 @@ int rSPR_total_approx_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
 			continue;
 		if (f2.get_component(0)->get_children().size() > 2) {
 			f2.get_component(0)->fixroot();
-			f2.get_component(0)->set_depth(0);
-			f2.get_component(0)->fix_depths();
-			f2.get_component(0)->preorder_number();
+			f2.get_component(0)->renumber();
 		}
 		int size = f2.get_component(0)->size();
 		int best_distance = INT_MAX;
@@ -6306,9 +8250,7 @@ int rSPR_total_approx_distance_unrooted(Node *T1, vector<Node *> &gene_trees) {
 			f2.get_component(0)->find_descendants();
 		for(int j = 0; j < descendants.size(); j++) {
 			f2.get_component(0)->reroot(descendants[j]);
-					f2.get_component(0)->set_depth(0);
-					f2.get_component(0)->fix_depths();
-					f2.get_component(0)->preorder_number();
+					f2.get_component(0)->renumber();
 			Forest F1 = Forest(f1);
 			Forest F2 = Forest(f2);
 
@@ -6331,7 +8273,7 @@ int rSPR_total_approx_distance(Node *T1, vector<Node *> &gene_trees,
 		int threshold) {
 	int total = 0;
 	MAIN_CALL = false;
-	#pragma omp parallel for reduction(+ : total)
+	#pragma omp parallel for reduction(+ : total) copyin(PREFER_RHO)
 	for(int i = 0; i < gene_trees.size(); i++) {
 		Forest F1 = Forest(T1);
 		Forest F2 = Forest(gene_trees[i]);
@@ -6458,15 +8400,188 @@ Node *find_best_root(Node *T1, Node *T2) {
 	return new_root;
 }
 
+/* find_best_root_acc
+ * The balanced accuracy of the root that find_best_root picks in T2 for
+ * the split at the root of T1, or -1 if they share less than two leaves.
+ * Counts the shared leaves below each node instead of syncing copies of
+ * both trees. The nodes of T2 are scored in the order of the synced copy,
+ * so ties draw rand() as before
+ */
 double find_best_root_acc(Node *T1, Node *T2) {
 	double best_root_b_acc = -1;
-	Forest f1 = Forest(T1);
-	Forest f2 = Forest(T2);
-	sync_twins(&f1, &f2);
-	find_best_root(f1.get_component(0), f2.get_component(0), &best_root_b_acc);
+	// side[label] is 0 for labels not in both trees, otherwise the group
+	// of the leaf in T1
+	vector<int> side = vector<int>();
+	vector<Node *> T1_leaves = T1->find_leaves();
+	vector<Node *> T2_leaves = T2->find_leaves();
+	for(int i = 0; i < T1_leaves.size(); i++) {
+		int number = T1_leaves[i]->get_label_number();
+		if (T1_leaves[i]->is_rho() || number == INT_MAX)
+			continue;
+		if (number >= side.size())
+			side.resize(number + 1, 0);
+		side[number] = -1;
+	}
+	int total = 0;
+	for(int i = 0; i < T2_leaves.size(); i++) {
+		int number = T2_leaves[i]->get_label_number();
+		if (T2_leaves[i]->is_rho() || number >= side.size() ||
+				side[number] != -1)
+			continue;
+		side[number] = 1;
+		total++;
+	}
+	for(int i = 0; i < side.size(); i++) {
+		if (side[i] == -1)
+			side[i] = 0;
+	}
+	// sync_twins fails
+	if (total < 2)
+		return best_root_b_acc;
+
+	// the root of T1 after removing the other leaves and its children
+	Node *T1_root = NULL;
+	find_best_root_acc_count(T1, side, total, &T1_root);
+	vector<Node *> T1_children = vector<Node *>();
+	vector<int> T1_counts = vector<int>();
+	list<Node *>::iterator c;
+	for(c = T1_root->get_children().begin();
+			c != T1_root->get_children().end(); c++) {
+		int count = find_best_root_acc_count(*c, side, total, NULL);
+		if (count > 0) {
+			T1_children.push_back(*c);
+			T1_counts.push_back(count);
+		}
+	}
+	// leaves before the last child are in group 1, as with pre_separator
+	int group_1_total = T1_counts.front();
+	int group_2_total = T1_counts.back();
+	vector<Node *> group_2 = T1_children.back()->find_leaves();
+	for(int i = 0; i < group_2.size(); i++) {
+		int number = group_2[i]->get_label_number();
+		if (number < side.size() && side[number] > 0)
+			side[number] = 2;
+	}
+
+	Node *T2_root = NULL;
+	find_best_root_acc_count(T2, side, total, &T2_root);
+	vector<Node *> T2_children = vector<Node *>();
+	for(c = T2_root->get_children().begin();
+			c != T2_root->get_children().end(); c++) {
+		if (find_best_root_acc_count(*c, side, total, NULL) > 0)
+			T2_children.push_back(*c);
+	}
+	int num_ties = 2;
+	int group_1_descendants = 0;
+	int group_2_descendants = 0;
+	find_best_root_acc_hlpr(T2_children.front(), side, group_1_total,
+			group_2_total, &best_root_b_acc, &num_ties,
+			&group_1_descendants, &group_2_descendants);
+	if (T2_children.size() > 2) {
+		// fixroot moves the other children below a new node in reverse
+		// order
+		group_1_descendants = 0;
+		group_2_descendants = 0;
+		for(int i = T2_children.size() - 1; i > 0; i--) {
+			find_best_root_acc_hlpr(T2_children[i], side, group_1_total,
+					group_2_total, &best_root_b_acc, &num_ties,
+					&group_1_descendants, &group_2_descendants);
+		}
+		find_best_root_acc_score(group_1_descendants, group_2_descendants,
+				group_1_total, group_2_total, &best_root_b_acc, &num_ties);
+	}
+	else {
+		find_best_root_acc_hlpr(T2_children.back(), side, group_1_total,
+				group_2_total, &best_root_b_acc, &num_ties,
+				&group_1_descendants, &group_2_descendants);
+	}
 	return best_root_b_acc;
 }
 
+// the number of leaves below n with a side, and the lowest node with all
+// total of them
+int find_best_root_acc_count(Node *n, vector<int> &side, int total,
+		Node **lca) {
+	int count = 0;
+	if (n->is_leaf()) {
+		int number = n->get_label_number();
+		if (number < side.size() && side[number] > 0)
+			count = 1;
+	}
+	else {
+		list<Node *>::iterator c;
+		for(c = n->get_children().begin(); c != n->get_children().end(); c++)
+			count += find_best_root_acc_count(*c, side, total, lca);
+	}
+	if (lca != NULL && *lca == NULL && count == total)
+		*lca = n;
+	return count;
+}
+
+// find_best_root_hlpr for the nodes that sync_twins keeps
+void find_best_root_acc_hlpr(Node *n, vector<int> &side, int group_1_total,
+		int group_2_total, double *best_root_b_acc, int *num_ties,
+		int *p_group_1_descendants, int *p_group_2_descendants) {
+	int group_1_descendants = 0;
+	int group_2_descendants = 0;
+	bool kept = false;
+	if (n->is_leaf()) {
+		int number = n->get_label_number();
+		if (number >= side.size() || side[number] == 0)
+			return;
+		if (side[number] == 1)
+			group_1_descendants++;
+		else
+			group_2_descendants++;
+		kept = true;
+	}
+	else {
+		// children without shared leaves are removed and nodes left with
+		// one child are contracted
+		int num_children = 0;
+		list<Node *>::iterator c;
+		for(c = n->get_children().begin(); c != n->get_children().end(); c++) {
+			int descendants = group_1_descendants + group_2_descendants;
+			find_best_root_acc_hlpr(*c, side, group_1_total,
+					group_2_total, best_root_b_acc, num_ties,
+					&group_1_descendants, &group_2_descendants);
+			if (group_1_descendants + group_2_descendants > descendants)
+				num_children++;
+		}
+		kept = (num_children >= 2);
+	}
+	if (kept)
+		find_best_root_acc_score(group_1_descendants, group_2_descendants,
+				group_1_total, group_2_total, best_root_b_acc, num_ties);
+	*p_group_1_descendants += group_1_descendants;
+	*p_group_2_descendants += group_2_descendants;
+}
+
+// the balanced accuracy of a node, as in find_best_root_hlpr
+void find_best_root_acc_score(int group_1_descendants,
+		int group_2_descendants, int group_1_total, int group_2_total,
+		double *best_root_b_acc, int *num_ties) {
+	double tpos = group_1_descendants;
+	double fpos = group_2_descendants;
+	double fneg = (group_1_total - group_1_descendants);
+	double tneg = (group_2_total - group_2_descendants);
+	double b_acc =  tpos / (tpos + fneg)
+			+ tneg / (tneg + fpos);
+	double b_acc_opp = fpos / (fpos + tneg)
+			+ fneg / (fneg + tpos);
+	if (b_acc_opp > b_acc)
+		b_acc = b_acc_opp;
+	if (b_acc > *best_root_b_acc) {
+		*best_root_b_acc = b_acc;
+		*num_ties = 2;
+	}
+	else if(b_acc == *best_root_b_acc) {
+		int r = rand();
+		if (r < RAND_MAX/ *num_ties)
+			*best_root_b_acc = b_acc;
+	}
+}
+
 void find_best_root_hlpr(Node *T2, int pre_separator, int group_1_total,
 		int group_2_total, Node **best_root, double *best_root_b_acc) {
 	list<Node*>::iterator c;
@@ -6596,9 +8711,7 @@ Node *find_best_root_rspr(Node *T1, Node *T2) {
 		Node *root = roots[i];
 		t2->reroot(root);
 //		cout << "\t" << t2->str_subtree() << endl;
-		t2->set_depth(0);
-		t2->fix_depths();
-		t2->preorder_number();
+		t2->renumber();
 		int distance = rSPR_branch_and_bound_simple_clustering(t1, t2);
 //		int distance = rf_distance(t1, t2);
 		if (distance < best_distance) {
@@ -6716,9 +8829,7 @@ bool outgroup_reroot(Node *n, vector<int> &num_in, vector<int> &num_out) {
 	if (num_in[n->get_preorder_number()] == 0) {
 		if (!n->is_leaf()) {
 			T->reroot(n);
-			T->set_depth(0);
-			T->fix_depths();
-			T->preorder_number();
+			T->renumber();
 		}
 		return true;
 	}
@@ -6735,9 +8846,7 @@ bool outgroup_reroot(Node *n, vector<int> &num_in, vector<int> &num_out) {
 		}
 	}
 	T->reroot(new_split);
-	T->set_depth(0);
-	T->fix_depths();
-	T->preorder_number();
+	T->renumber();
 	return true;
 }
 
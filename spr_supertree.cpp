@@ -193,6 +193,7 @@ OTHER OPTIONS
 #include "LCA.h"
 #include "ClusterInstance.h"
 #include "UndoMachine.h"
+#include "LineReader.h"
 #include "lgt.h"
 #include "sparse_counts.h"
 #include "node_glom.h"
@@ -512,6 +513,11 @@ bool is_pow_2(int n) {
 
 bool BIPARTITION_CLUSTER = false;
 
+// why a gene tree input line was skipped
+enum GeneTreeStatus {GENE_TREE_KEPT, GENE_TREE_NO_BRACKET,
+		GENE_TREE_MULTIFURCATING, GENE_TREE_SMALL, GENE_TREE_STAR,
+		GENE_TREE_NO_OUTGROUP};
+
 list<Node> taboo_trees = list<Node>();
 
 int main(int argc, char *argv[]) {
@@ -1117,7 +1123,20 @@ int main(int argc, char *argv[]) {
 	int skipped_no_bracket = 0;
 	int skipped_star = 0;
 	int skipped_no_outgroup = 0;
-	while (getline(cin, T_line)) {
+	// parse the gene trees in parallel, then count the skipped trees and
+	// keep the rest in input order
+	vector<char> input_buffer = vector<char>();
+	vector<char *> input_lines = vector<char *>();
+	vector<size_t> input_lengths = vector<size_t>();
+	read_lines(cin, &input_buffer, &input_lines, &input_lengths);
+	int num_lines = input_lines.size();
+	vector<Node *> line_trees = vector<Node *>(num_lines, (Node *)NULL);
+	vector<string> line_names = vector<string>(num_lines);
+	vector<string> line_trees_skipped = vector<string>(num_lines);
+	vector<int> line_status = vector<int>(num_lines, GENE_TREE_KEPT);
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(int l = 0; l < num_lines; l++) {
+		string T_line = string(input_lines[l], input_lengths[l]);
 		string name = "";
 		size_t loc = T_line.find_first_of("(");
 		if (loc != string::npos) {
@@ -1166,22 +1185,25 @@ int main(int argc, char *argv[]) {
 
 			if (T->is_leaf() && T->str() == "p") {
 				if (MULTI_TREES)
-					cout << name << T_line << endl;
+					line_trees_skipped[l] = name + T_line;
 
-				skipped_multifurcating++;
+				line_status[l] = GENE_TREE_MULTIFURCATING;
+				T->delete_tree();
 				continue;
 			}
 			int T_size = T->size();
 			if (((!INVALID_TREES && ((T_size <= 4)))
 					|| (T_size == 5 && !SMALL_TREES))) {
-				skipped_small++;
+				line_status[l] = GENE_TREE_SMALL;
+				T->delete_tree();
 				continue;
 			}
 			if (!IGNORE_MULTI && !INVALID_TREES) {
 				int T_depth = T->max_depth();
 				if (T_depth <= 1 ||
 						((UNROOTED || SIMPLE_UNROOTED) && T_depth <= 2)) {
-					skipped_star++;
+					line_status[l] = GENE_TREE_STAR;
+					T->delete_tree();
 					continue;
 				//cout << T->str_subtree() << endl;
 				//cout << T_depth << endl;
@@ -1196,7 +1218,8 @@ int main(int argc, char *argv[]) {
 				// TODO: do we simply skip the tree if the outgroup is seperate?
 				set<string>::iterator i;
 				if (!outgroup_root(T, outgroup)) {
-					skipped_no_outgroup++;
+					line_status[l] = GENE_TREE_NO_OUTGROUP;
+					T->delete_tree();
 					continue;
 				}
 				else {
@@ -1206,12 +1229,37 @@ int main(int argc, char *argv[]) {
 				
 			}
 
-			gene_tree_names.push_back(name);
-			gene_trees.push_back(T);
-			//gene_tree_map.insert(make_pair(T->size(), make_pair(T, name)));
+			line_names[l] = name;
+			line_trees[l] = T;
 		}
 		else
-			skipped_no_bracket++;
+			line_status[l] = GENE_TREE_NO_BRACKET;
+	}
+	for(int l = 0; l < num_lines; l++) {
+		switch(line_status[l]) {
+			case GENE_TREE_KEPT:
+				gene_tree_names.push_back(line_names[l]);
+				gene_trees.push_back(line_trees[l]);
+				//gene_tree_map.insert(make_pair(T->size(), make_pair(T, name)));
+				break;
+			case GENE_TREE_NO_BRACKET:
+				skipped_no_bracket++;
+				break;
+			case GENE_TREE_MULTIFURCATING:
+				if (MULTI_TREES)
+					cout << line_trees_skipped[l] << endl;
+				skipped_multifurcating++;
+				break;
+			case GENE_TREE_SMALL:
+				skipped_small++;
+				break;
+			case GENE_TREE_STAR:
+				skipped_star++;
+				break;
+			case GENE_TREE_NO_OUTGROUP:
+				skipped_no_outgroup++;
+				break;
+		}
 	}
 
 	cout << "skipped " << skipped_no_bracket << " lines with no opening bracket " << endl;
@@ -1664,9 +1712,7 @@ TODO:
 						double root_avg_acc = 0;
 						int count = 0;
 						super_tree->reroot(descendants[j]);
-						super_tree->set_depth(0);
-						super_tree->fix_depths();
-						super_tree->preorder_number();
+						super_tree->renumber();
 						if (APPROX_ROOTING) {
 							root_avg_acc = -rSPR_total_approx_distance_unrooted(super_tree, gene_trees);
 							//root_avg_acc = -rSPR_total_distance_unrooted(super_tree, current_gene_trees);
@@ -1715,16 +1761,14 @@ TODO:
 						}
 					}
 					super_tree->reroot(best_root);
-					super_tree->set_depth(0);
-					super_tree->fix_depths();
-					super_tree->preorder_number();
+					super_tree->renumber();
 				}
 	
 				cout << "rerooting gene trees" << endl;
 				// reroot the gene trees based on the balanced accuracy of splits
 				super_tree->preorder_number();
 				int end = current_gene_trees.size();
-				#pragma omp parallel for
+				#pragma omp parallel for copyin(PREFER_RHO)
 				for(int i = 0; i < end; i++) {
 					current_gene_trees[i]->preorder_number();
 					Node *new_root;
@@ -1736,9 +1780,7 @@ TODO:
 						new_root = find_best_root(super_tree, current_gene_trees[i]);
 					if (new_root != NULL) {
 						current_gene_trees[i]->reroot(new_root);
-						current_gene_trees[i]->set_depth(0);
-						current_gene_trees[i]->fix_depths();
-						current_gene_trees[i]->preorder_number();
+						current_gene_trees[i]->renumber();
 					}
 				}
 			}
@@ -1798,9 +1840,7 @@ TODO:
 					double root_avg_acc = 0;
 					int count = 0;
 					super_tree->reroot(descendants[j]);
-					super_tree->set_depth(0);
-					super_tree->fix_depths();
-					super_tree->preorder_number();
+					super_tree->renumber();
 					if (APPROX_ROOTING) {
 						root_avg_acc = -rSPR_total_approx_distance_unrooted(super_tree, gene_trees);
 						//root_avg_acc = -rSPR_total_distance_unrooted(super_tree, current_gene_trees);
@@ -1850,9 +1890,7 @@ TODO:
 					}
 				}
 				super_tree->reroot(best_root);
-				super_tree->set_depth(0);
-				super_tree->fix_depths();
-				super_tree->preorder_number();
+				super_tree->renumber();
 				super_tree->numbers_to_labels(&reverse_label_map);
 				cout << "Rerooted Supertree: " <<  super_tree->str_subtree() << endl;
 				super_tree->labels_to_numbers(&label_map, &reverse_label_map);
@@ -1862,7 +1900,7 @@ TODO:
 		// reroot the gene trees based on the balanced accuracy of splits
 		super_tree->preorder_number();
 		int end = gene_trees.size();
-		#pragma omp parallel for
+		#pragma omp parallel for copyin(PREFER_RHO)
 		for(int i = 0; i < end; i++) {
 			gene_trees[i]->preorder_number();
 			Node *new_root;
@@ -1875,15 +1913,11 @@ TODO:
 				//find_best_root(super_tree, gene_trees[i]);
 			if (new_root != NULL) {
 				gene_trees[i]->reroot(new_root);
-				gene_trees[i]->set_depth(0);
-				gene_trees[i]->fix_depths();
-				gene_trees[i]->preorder_number();
+				gene_trees[i]->renumber();
 			}
 		}
 	}
-	super_tree->set_depth(0);
-	super_tree->fix_depths();
-	super_tree->preorder_number();
+	super_tree->renumber();
 
 	if (APPROX)
 		if (UNROOTED)
@@ -2208,9 +2242,7 @@ TODO:
 					double root_avg_acc = 0;
 					int count = 0;
 					super_tree->reroot(descendants[j]);
-					super_tree->set_depth(0);
-					super_tree->fix_depths();
-					super_tree->preorder_number();
+					super_tree->renumber();
 					if (APPROX_ROOTING) {
 						root_avg_acc = -rSPR_total_approx_distance_unrooted(super_tree, gene_trees);
 						//root_avg_acc = -rSPR_total_distance_unrooted(super_tree, current_gene_trees);
@@ -2261,9 +2293,7 @@ TODO:
 				}
 				cout << "\r \r";
 				super_tree->reroot(best_root);
-				super_tree->set_depth(0);
-				super_tree->fix_depths();
-				super_tree->preorder_number();
+				super_tree->renumber();
 				super_tree->numbers_to_labels(&reverse_label_map);
 				cout << "Rerooted Supertree: " <<  super_tree->str_subtree() << endl;
 				super_tree->labels_to_numbers(&label_map, &reverse_label_map);
@@ -2276,7 +2306,7 @@ TODO:
 			// reroot the gene trees based on the balanced accuracy of splits
 			super_tree->preorder_number();
 			int end = gene_trees.size();
-			#pragma omp parallel for
+			#pragma omp parallel for copyin(PREFER_RHO)
 			for(int i = 0; i < end; i++) {
 				gene_trees[i]->preorder_number();
 				Node *new_root;
@@ -2288,9 +2318,7 @@ TODO:
 					new_root = find_best_root(super_tree, gene_trees[i]);
 				if (new_root != NULL) {
 					gene_trees[i]->reroot(new_root);
-					gene_trees[i]->set_depth(0);
-					gene_trees[i]->fix_depths();
-					gene_trees[i]->preorder_number();
+					gene_trees[i]->renumber();
 				}
 			}
 		}
@@ -2327,9 +2355,7 @@ TODO:
 			int min_distance;
 			int min_tie_distance;
 			int num_ties = 2;
-			super_tree->set_depth(0);
-			super_tree->fix_depths();
-			super_tree->preorder_number();
+			super_tree->renumber();
 			super_tree->edge_preorder_interval();
 			vector<int> original_scores = vector<int>(gene_trees.size());
 			vector<int> original_scores_temp = vector<int>(gene_trees.size());
@@ -2471,9 +2497,7 @@ TODO:
 					Node *old_super_tree = new Node(*super_tree);
 					int which_sibling = 0;
 					Node *undo = F1_source->spr(F1_target, which_sibling);
-					super_tree->set_depth(0);
-					super_tree->fix_depths();
-					super_tree->preorder_number();
+					super_tree->renumber();
 					super_tree->edge_preorder_interval();
 
 					//		cout << "Proposed Super Tree: "
@@ -2565,9 +2589,7 @@ TODO:
 					else {
 						// restore the previous tree
 						F1_source->spr(undo, which_sibling);
-						super_tree->set_depth(0);
-						super_tree->fix_depths();
-						super_tree->preorder_number();
+						super_tree->renumber();
 						super_tree->edge_preorder_interval();
 						//		cout << "Reverted Super Tree: "
 						//		<< super_tree->str_support_subtree(true) << endl;
@@ -2674,9 +2696,7 @@ TODO:
 			for(int i = 0; i < approx_moves.size() && !check ; i++){
 				int which_sibling = 0;
 				Node *undo = approx_moves[i].first.first->spr(approx_moves[i].first.second, which_sibling);
-				super_tree->set_depth(0);
-				super_tree->fix_depths();
-				super_tree->preorder_number();
+				super_tree->renumber();
 	
 
 				if (APPROX)
@@ -2694,9 +2714,7 @@ TODO:
 
 				else {
 					approx_moves[i].first.first->spr(undo, which_sibling);
-					super_tree->set_depth(0);
-					super_tree->fix_depths();
-					super_tree->preorder_number();
+					super_tree->renumber();
 				}
 			}
 			super_tree->numbers_to_labels(&reverse_label_map);
@@ -2742,9 +2760,7 @@ TODO:
 			for(int i = 0; i < approx_moves.size() && !check ; i++){
 				int which_sibling = 0;
 				Node *undo = approx_moves[i].first.first->spr(approx_moves[i].first.second, which_sibling);
-				super_tree->set_depth(0);
-				super_tree->fix_depths();
-				super_tree->preorder_number();
+				super_tree->renumber();
 	
 
 				if (APPROX)
@@ -2762,9 +2778,7 @@ TODO:
 
 				else {
 					approx_moves[i].first.first->spr(undo, which_sibling);
-					super_tree->set_depth(0);
-					super_tree->fix_depths();
-					super_tree->preorder_number();
+					super_tree->renumber();
 				}
 			}
 			super_tree->numbers_to_labels(&reverse_label_map);
@@ -2790,9 +2804,7 @@ TODO:
 		if(!GREEDY && !GREEDY_REFINED) {
 			if (!ONE_TREE_AT_A_TIME){
 				best_subtree_root->spr(best_sibling);
-				super_tree->set_depth(0);
-				super_tree->fix_depths();
-				super_tree->preorder_number();
+				super_tree->renumber();
 			}
 			if (TABOO_SEARCH && !is_taboo(taboo_trees, super_tree))
 				taboo_trees.push_back(Node(*super_tree));
@@ -2956,9 +2968,7 @@ void test_sibling_helper(Node *n, Node *new_leaf, Node *super_tree,
 	new_node->add_child(new_leaf);
 //	cout << "New Super Tree" << super_tree->str_subtree() << endl;
 
-	super_tree->set_depth(0);
-	super_tree->fix_depths();
-	super_tree->preorder_number();
+	super_tree->renumber();
 	int distance;
 	if (RANDOM_TREE)
 		distance = 0;
@@ -3024,9 +3034,7 @@ void test_sibling_helper(Node *n, Node *new_leaf, Node *super_tree,
 			rc->cut_parent();
 			n->parent()->add_child(rc);
 		}
-	super_tree->set_depth(0);
-	super_tree->fix_depths();
-	super_tree->preorder_number();
+	super_tree->renumber();
 //	cout << "Reverted: " << super_tree->str_subtree() << endl;
 
 }
@@ -3089,9 +3097,7 @@ void find_best_siblings_helper(Node *n, Node *new_leaf, Node *super_tree,
 	new_node->add_child(new_leaf);
 //	cout << "New Super Tree" << super_tree->str_subtree() << endl;
 
-	super_tree->set_depth(0);
-	super_tree->fix_depths();
-	super_tree->preorder_number();
+	super_tree->renumber();
 	int distance;
 	distance = rSPR_total_approx_distance(super_tree, gene_trees,
 			min_distance);
@@ -3131,9 +3137,7 @@ void find_best_siblings_helper(Node *n, Node *new_leaf, Node *super_tree,
 			rc->cut_parent();
 			n->parent()->add_child(rc);
 		}
-	super_tree->set_depth(0);
-	super_tree->fix_depths();
-	super_tree->preorder_number();
+	super_tree->renumber();
 //	cout << "Reverted: " << super_tree->str_subtree() << endl;
 //	}
 
@@ -3224,9 +3228,7 @@ void find_best_spr_helper(Node *n, Node *new_sibling, Node *super_tree,
 		Node *undo = n->spr(new_sibling, which_sibling);
 
 
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 
 /*
 		super_tree->numbers_to_labels(&reverse_label_map);
@@ -3271,9 +3273,7 @@ void find_best_spr_helper(Node *n, Node *new_sibling, Node *super_tree,
 
 		n->spr(undo, which_sibling);
 
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 	}
 
 }
@@ -3296,9 +3296,7 @@ void get_support(Node *n, Node *super_tree, vector<Node *> *gene_trees) {
 			double root_avg_acc = 0;
 			Node *temp_tree = new Node(*super_tree);
 			temp_tree->reroot(temp_tree->find_by_prenum(n->get_preorder_number()));
-			temp_tree->set_depth(0);
-			temp_tree->fix_depths();
-			temp_tree->preorder_number();
+			temp_tree->renumber();
 			int end = gene_trees->size();
 			#pragma omp parallel for schedule(static) reduction(+: root_avg_acc) reduction(+: count)
 			for(int i = 0; i < end; i++) {
@@ -3378,7 +3376,7 @@ void find_best_distance(Node * n, Node * super_tree, vector<Node *> &gene_trees,
 		UndoMachine um = UndoMachine();
 		vector<Node *> components = vector<Node *>();
 		Node *n_parent = n->parent();
-		um.add_event(new CutParent(n));
+		um.add_event(CutParent(n));
 		n->cut_parent();
 		ContractEvent(&um, n_parent);
 		Node *post_contract = n_parent->contract();
@@ -3499,9 +3497,7 @@ void find_best_spr_helper(Node *n, Node *new_sibling, Node *super_tree,
 
 		int which_sibling = 0;
 		Node *undo = n->spr(new_sibling, which_sibling);
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 /*
 		super_tree->numbers_to_labels(&reverse_label_map);
 		cout << "Proposed Super Tree: " << super_tree->str_subtree() << endl;
@@ -3544,9 +3540,7 @@ void find_best_spr_helper(Node *n, Node *new_sibling, Node *super_tree,
 		}
 		// restore the previous tree
 		n->spr(undo, which_sibling);
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 //		cout << "Reverted Super Tree: "
 //	<< super_tree->str_subtree() << endl;
 	}
@@ -3670,9 +3664,7 @@ void find_best_spr_helper(Node *n, Node *new_sibling, Node *super_tree,
 
 		int which_sibling = 0;
 		Node *undo = n->spr(new_sibling, which_sibling);
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 /*
 		super_tree->numbers_to_labels(&reverse_label_map);
 		cout << "Proposed Super Tree: " << super_tree->str_subtree() << endl;
@@ -3703,9 +3695,7 @@ void find_best_spr_helper(Node *n, Node *new_sibling, Node *super_tree,
 		}*/
 		// restore the previous tree
 		n->spr(undo, which_sibling);
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 //		cout << "Reverted Super Tree: "
 //	<< super_tree->str_subtree() << endl;
 	}
@@ -3955,9 +3945,7 @@ void find_best_spr_r_helper(Node *n, Node *new_sibling, Node *super_tree,
 //		<< super_tree->str_support_subtree(true) << endl;
 		int which_sibling = 0;
 		Node *undo = n->spr(new_sibling, which_sibling);
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 //		cout << "Proposed Super Tree: "
 //		<< super_tree->str_support_subtree(true) << endl;
 /*
@@ -4030,9 +4018,7 @@ void find_best_spr_r_helper(Node *n, Node *new_sibling, Node *super_tree,
 //		cout << "Reverted Super Tree: "
 //		<< super_tree->str_support_subtree(true) << endl;
 
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 //		cout << "Reverted Super Tree: "
 //		<< super_tree->str_subtree() << endl;
 
@@ -4130,9 +4116,7 @@ void find_best_spr_r_helper(Node *n, Node *new_sibling, Node *super_tree,
 
 		int which_sibling = 0;
 		Node *undo = n->spr(new_sibling, which_sibling);
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 /*
 		super_tree->numbers_to_labels(&reverse_label_map);
 		cout << "Proposed Super Tree: " << super_tree->str_subtree() << endl;
@@ -4144,9 +4128,7 @@ void find_best_spr_r_helper(Node *n, Node *new_sibling, Node *super_tree,
 
 		// restore the previous tree
 		n->spr(undo, which_sibling);
-		super_tree->set_depth(0);
-		super_tree->fix_depths();
-		super_tree->preorder_number();
+		super_tree->renumber();
 //		cout << "Reverted Super Tree: "
 //		<< super_tree->str_subtree() << endl;
 